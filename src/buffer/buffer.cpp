@@ -1,7 +1,15 @@
 #include "buffer.h"
 #include <iostream>
+#include <algorithm>
 
-Buffer::Buffer(int initBuffSize) : buffer(initBuffSize), readPos(0), writePos(0) {}
+Buffer::Buffer() : mChunk(nullptr), readPos(0), writePos(0) {}
+
+Buffer::~Buffer()
+{
+    if (mChunk) {
+        ChunkPool::free(mChunk);
+    }
+}
 
 // 还没有被读走的字节数
 size_t Buffer::readableBytes() const
@@ -12,7 +20,7 @@ size_t Buffer::readableBytes() const
 // writepos之后还能写的字节数
 size_t Buffer::writableBytes() const
 {
-    return buffer.size() - writePos;
+    return (mChunk ? mChunk->capacity : 0) - writePos;
 }
 
 // readpos之前还能写的字节数（这些字节已经被读走，所以这部分是可写的）
@@ -30,6 +38,11 @@ void Buffer::retrieve(size_t len)
 {
     assert(len <= readableBytes());
     readPos += len;
+    if (readPos == writePos) {
+        // 全部读走了，下次从头开始写，不用移动数据
+        readPos = 0;
+        writePos = 0;
+    }
 }
 
 void Buffer::retrieveUntil(const char *end)
@@ -40,11 +53,21 @@ void Buffer::retrieveUntil(const char *end)
 
 void Buffer::retrieveAll()
 {
-    bzero(&buffer[0], buffer.size());
+    // 之后写入时会覆盖，不需要清零
     readPos = 0;
     writePos = 0;
 }
 
+void Buffer::release()
+{
+    if (mChunk && readableBytes() == 0) {
+        ChunkPool::free(mChunk);
+        mChunk = nullptr;
+        readPos = 0;
+        writePos = 0;
+    }
+}
+
 std::string Buffer::retrieveAllToStr()
 {
     std::string str(peek(), readableBytes());
@@ -67,6 +90,12 @@ void Buffer::hasWritten(size_t len)
     writePos += len;
 } 
 
+void Buffer::unwrite(size_t len)
+{
+    assert(len <= readableBytes());
+    writePos -= len;
+}
+
 void Buffer::append(const std::string& str)
 {
     append(str.data(), str.length());
@@ -101,25 +130,42 @@ void Buffer::ensureWriteable(size_t len)
 
 ssize_t Buffer::readFd(int fd, int* saveErrno)
 {
-    char buff[65535];
+    // 写不下的部分读进线程的暂存块（不占用栈）
+    // 缓冲区为空、存储不超过一块时直接读进暂存块，读到数据后把暂存块换成缓冲区的存储，不用拷贝
+    BufferChunk *scratch = ChunkPool::scratch(0);
+    const bool swap = readableBytes() == 0 && (!mChunk || mChunk->capacity == ChunkPool::CHUNK_CAPACITY);
+    const size_t writable = swap ? 0 : writableBytes();
     struct iovec iov[2];
-    const size_t writable = writableBytes();
+    int count = 0;
     /* 分散读， 保证数据全部读完 */
-    iov[0].iov_base = beginPtr() + writePos;
-    iov[0].iov_len = writable;
-    iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
+    if (writable > 0) {
+        iov[count].iov_base = beginPtr() + writePos;
+        iov[count].iov_len = writable;
+        count++;
+    }
+    iov[count].iov_base = scratch->data;
+    iov[count].iov_len = scratch->capacity;
+    count++;
 
-    const ssize_t len = readv(fd, iov, 2);
+    const ssize_t len = readv(fd, iov, count);
     if (len < 0) {
         *saveErrno = errno;
     }
     else if (static_cast<size_t>(len) <= writable) {
         writePos += len;
     }
+    else if (swap) {
+        ChunkPool::takeScratch(0);
+        if (mChunk) {
+            ChunkPool::free(mChunk);
+        }
+        mChunk = scratch;
+        readPos = 0;
+        writePos = len;
+    }
     else {
-        writePos = buffer.size();
-        append(buff, len - writable);
+        writePos += writable;
+        append(scratch->data, len - writable);
     }
     return len;
 }
@@ -132,25 +178,34 @@ ssize_t Buffer::writeFd(int fd, int* saveErrno)
         *saveErrno = errno;
         return len;
     } 
-    readPos += len;
+    retrieve(len);
     return len;
 }
 
 char *Buffer::beginPtr()
 {
-    return &*buffer.begin();
+    return mChunk ? mChunk->data : nullptr;
 }
 
 const char *Buffer::beginPtr() const
 {
-    return &*buffer.begin();
+    return mChunk ? mChunk->data : nullptr;
 }
 
 void Buffer::makeSpace(size_t len)
 {
-    // 如果前后能写的总字节数小于len，直接扩展空间
+    // 如果前后能写的总字节数小于len，换一块成倍大的存储，逐步追加大量数据时只需要扩展对数次
     if (writableBytes() + prependableBytes() < len) {
-        buffer.resize(writePos + len + 1);
+        size_t readable = readableBytes();
+        size_t capacity = std::max(readable + len, (mChunk ? mChunk->capacity : 0) * 2);
+        BufferChunk *chunk = capacity <= ChunkPool::CHUNK_CAPACITY ? ChunkPool::alloc() : ChunkPool::allocLarge(capacity);
+        if (mChunk) {
+            memcpy(chunk->data, beginPtr() + readPos, readable);
+            ChunkPool::free(mChunk);
+        }
+        mChunk = chunk;
+        readPos = 0;
+        writePos = readable;
     } 
     // 否则，将剩余未读走的字节前移到缓冲区首地址处
     else {
@@ -160,4 +215,4 @@ void Buffer::makeSpace(size_t len)
         writePos = readPos + readable;
         assert(readable == readableBytes());
     }
-}
\ No newline at end of file
+}
@@ -5,14 +5,17 @@
 #include <iostream>
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
-#include <vector> //readv
-#include <atomic>
 #include <cassert>
+#include "chain_buffer.h"
 
+// 连续的缓冲区，存储来自ChunkPool：不超过一块时使用内存池中的块，更大时单独分配
+// 第一次写入时才分配，没有数据时可以用release()还给内存池，空闲的连接不占用缓冲区内存
 class Buffer {
 public:
-    Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    Buffer();
+    ~Buffer();
+    Buffer(const Buffer&) = delete;
+    Buffer &operator=(const Buffer&) = delete;
 
     size_t writableBytes() const;       
     size_t readableBytes() const ;
@@ -21,12 +24,14 @@ public:
     const char* peek() const;
     void ensureWriteable(size_t len);
     void hasWritten(size_t len);
+    void unwrite(size_t len); // 撤销最后写入的len字节
 
     void retrieve(size_t len);
     void retrieveUntil(const char* end);
 
     void retrieveAll() ;
     std::string retrieveAllToStr();
+    void release(); // 没有可读的数据时把存储还给内存池，之后写入时重新分配
 
     const char *beginWriteConst() const;
     char *beginWrite();
@@ -44,9 +49,9 @@ private:
     const char *beginPtr() const;
     void makeSpace(size_t len);
 
-    std::vector<char> buffer;
-    std::atomic<std::size_t> readPos;
-    std::atomic<std::size_t> writePos;
+    BufferChunk *mChunk; // 为空表示还没有分配存储
+    std::size_t readPos; // 缓冲区只在处理这个连接的线程中使用，不需要原子操作
+    std::size_t writePos;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,394 @@
+#include "chain_buffer.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <new>
+#include "../thread/locker.h"
+
+static const size_t LOCAL_LIMIT = 32; // 线程的空闲块超过这个数时，一半还给共享链表
+static const size_t BATCH = LOCAL_LIMIT / 2;
+static const size_t SHARED_LIMIT = 1024; // 共享链表最多保留的空闲块（16MB），更多的直接释放
+
+static Locker sharedLock;
+static BufferChunk *sharedHead = nullptr;
+static size_t sharedCount = 0;
+
+// 线程退出时把空闲块还给共享链表
+struct LocalChunks {
+    BufferChunk *head = nullptr;
+    size_t count = 0;
+
+    ~LocalChunks()
+    {
+        while (head) {
+            BufferChunk *chunk = head;
+            head = chunk->next;
+            count--;
+            sharedLock.lock();
+            bool keep = sharedCount < SHARED_LIMIT;
+            if (keep) {
+                chunk->next = sharedHead;
+                sharedHead = chunk;
+                sharedCount++;
+            }
+            sharedLock.unlock();
+            if (!keep) {
+                ::free(chunk);
+            }
+        }
+    }
+};
+
+static thread_local LocalChunks localChunks;
+
+// 线程退出时直接释放（这时localChunks可能已经析构了）
+struct ScratchChunks {
+    BufferChunk *chunks[ChunkPool::SCRATCH_NUM] = {};
+
+    ~ScratchChunks()
+    {
+        for (BufferChunk *chunk : chunks) {
+            ::free(chunk);
+        }
+    }
+};
+
+static thread_local ScratchChunks scratchChunks;
+
+const size_t ChunkPool::CHUNK_SIZE;
+const size_t ChunkPool::CHUNK_CAPACITY;
+const size_t ChainBuffer::MAX_READ_SIZE;
+
+BufferChunk *ChunkPool::alloc()
+{
+    LocalChunks &local = localChunks;
+    if (!local.head) {
+        // 从共享链表成批取
+        sharedLock.lock();
+        while (sharedHead && local.count < BATCH) {
+            BufferChunk *chunk = sharedHead;
+            sharedHead = chunk->next;
+            sharedCount--;
+            chunk->next = local.head;
+            local.head = chunk;
+            local.count++;
+        }
+        sharedLock.unlock();
+    }
+    BufferChunk *chunk = local.head;
+    if (chunk) {
+        local.head = chunk->next;
+        local.count--;
+    }
+    else {
+        chunk = (BufferChunk*)malloc(CHUNK_SIZE);
+        if (!chunk) {
+            throw std::bad_alloc();
+        }
+    }
+    chunk->next = nullptr;
+    chunk->capacity = CHUNK_CAPACITY;
+    chunk->readPos = chunk->writePos = 0;
+    return chunk;
+}
+
+BufferChunk *ChunkPool::allocLarge(size_t capacity)
+{
+    BufferChunk *chunk = (BufferChunk*)malloc(offsetof(BufferChunk, data) + capacity);
+    if (!chunk) {
+        throw std::bad_alloc();
+    }
+    chunk->next = nullptr;
+    chunk->capacity = capacity;
+    chunk->readPos = chunk->writePos = 0;
+    return chunk;
+}
+
+void ChunkPool::free(BufferChunk *chunk)
+{
+    if (chunk->capacity != CHUNK_CAPACITY) {
+        ::free(chunk);
+        return;
+    }
+    LocalChunks &local = localChunks;
+    chunk->next = local.head;
+    local.head = chunk;
+    local.count++;
+    if (local.count <= LOCAL_LIMIT) {
+        return;
+    }
+    // 成批还给共享链表，共享链表满了的部分直接释放
+    BufferChunk *batch = nullptr;
+    for (size_t i = 0; i < BATCH; ++i) {
+        BufferChunk *c = local.head;
+        local.head = c->next;
+        local.count--;
+        c->next = batch;
+        batch = c;
+    }
+    sharedLock.lock();
+    while (batch && sharedCount < SHARED_LIMIT) {
+        BufferChunk *c = batch;
+        batch = c->next;
+        c->next = sharedHead;
+        sharedHead = c;
+        sharedCount++;
+    }
+    sharedLock.unlock();
+    while (batch) {
+        BufferChunk *c = batch;
+        batch = c->next;
+        ::free(c);
+    }
+}
+
+BufferChunk *ChunkPool::scratch(int i)
+{
+    BufferChunk *&chunk = scratchChunks.chunks[i];
+    if (!chunk) {
+        chunk = alloc();
+    }
+    return chunk;
+}
+
+void ChunkPool::takeScratch(int i)
+{
+    scratchChunks.chunks[i] = nullptr;
+}
+
+ChainBuffer::ChainBuffer() : mHead(nullptr), mTail(nullptr), mReadable(0)
+{
+    resetReadSize();
+}
+
+ChainBuffer::~ChainBuffer()
+{
+    retrieveAll();
+}
+
+void ChainBuffer::pushChunk(BufferChunk *chunk)
+{
+    if (mTail) {
+        mTail->next = chunk;
+    }
+    else {
+        mHead = chunk;
+    }
+    mTail = chunk;
+}
+
+const char *ChainBuffer::pullup(size_t len)
+{
+    assert(len <= mReadable);
+    if (!mHead) {
+        return nullptr;
+    }
+    if (mHead->readable() >= len) {
+        return mHead->data + mHead->readPos;
+    }
+    // 合并前len字节，大块的容量是len的两倍，后面读入的数据接在它后面，之后不需要再次合并
+    BufferChunk *merged = ChunkPool::allocLarge(std::max(len * 2, ChunkPool::CHUNK_CAPACITY));
+    while (merged->writePos < len) {
+        BufferChunk *chunk = mHead;
+        size_t n = std::min(chunk->readable(), len - merged->writePos);
+        memcpy(merged->data + merged->writePos, chunk->data + chunk->readPos, n);
+        merged->writePos += n;
+        chunk->readPos += n;
+        if (chunk->readable() == 0) {
+            mHead = chunk->next;
+            if (chunk == mTail) {
+                mTail = nullptr;
+            }
+            ChunkPool::free(chunk);
+        }
+    }
+    if (mHead && mHead->readable() <= merged->writable()) {
+        // 后面剩下的不多，一起合并，下一次读入的数据可以直接写在后面
+        BufferChunk *chunk = mHead;
+        memcpy(merged->data + merged->writePos, chunk->data + chunk->readPos, chunk->readable());
+        merged->writePos += chunk->readable();
+        mHead = chunk->next;
+        if (chunk == mTail) {
+            mTail = nullptr;
+        }
+        ChunkPool::free(chunk);
+    }
+    merged->next = mHead;
+    mHead = merged;
+    if (!mTail) {
+        mTail = merged;
+    }
+    return merged->data + merged->readPos;
+}
+
+void ChainBuffer::retrieve(size_t len)
+{
+    assert(len <= mReadable);
+    mReadable -= len;
+    while (len > 0) {
+        BufferChunk *chunk = mHead;
+        size_t n = std::min(len, chunk->readable());
+        chunk->readPos += n;
+        len -= n;
+        if (chunk->readable() == 0) {
+            mHead = chunk->next;
+            if (chunk == mTail) {
+                mTail = nullptr;
+            }
+            ChunkPool::free(chunk);
+        }
+    }
+}
+
+void ChainBuffer::retrieveAll()
+{
+    while (mHead) {
+        BufferChunk *chunk = mHead;
+        mHead = chunk->next;
+        ChunkPool::free(chunk);
+    }
+    mTail = nullptr;
+    mReadable = 0;
+}
+
+std::string ChainBuffer::retrieveAllToStr()
+{
+    std::string str;
+    str.reserve(mReadable);
+    for (BufferChunk *chunk = mHead; chunk; chunk = chunk->next) {
+        str.append(chunk->data + chunk->readPos, chunk->readable());
+    }
+    retrieveAll();
+    return str;
+}
+
+void ChainBuffer::append(const char *data, size_t len)
+{
+    while (len > 0) {
+        if (!mTail && mReadSize > ChunkPool::CHUNK_CAPACITY) {
+            // 和readFd一样，按最近的请求大小分配第一块
+            pushChunk(ChunkPool::allocLarge(mReadSize));
+        }
+        else if (!mTail || mTail->writable() == 0) {
+            pushChunk(ChunkPool::alloc());
+        }
+        size_t n = std::min(len, mTail->writable());
+        memcpy(mTail->data + mTail->writePos, data, n);
+        mTail->writePos += n;
+        mReadable += n;
+        data += n;
+        len -= n;
+    }
+}
+
+int ChainBuffer::peekIov(struct iovec *iov, int maxIov) const
+{
+    int count = 0;
+    for (BufferChunk *chunk = mHead; chunk && count < maxIov; chunk = chunk->next) {
+        if (chunk->readable() > 0) {
+            iov[count].iov_base = chunk->data + chunk->readPos;
+            iov[count].iov_len = chunk->readable();
+            count++;
+        }
+    }
+    return count;
+}
+
+void ChainBuffer::recordRequest(size_t size)
+{
+    if (size > mReadSize) {
+        // 成倍扩大到能放下这个请求
+        while (mReadSize < size && mReadSize < MAX_READ_SIZE) {
+            mReadSize *= 2;
+        }
+        mReadSize = std::min(mReadSize, MAX_READ_SIZE);
+        mSmallRequests = 0;
+    }
+    else if (size <= mReadSize / 2 && mReadSize > ChunkPool::CHUNK_CAPACITY) {
+        if (++mSmallRequests >= SHRINK_AFTER) {
+            mReadSize = std::max(mReadSize / 2, ChunkPool::CHUNK_CAPACITY);
+            mSmallRequests = 0;
+        }
+    }
+    else {
+        mSmallRequests = 0;
+    }
+}
+
+void ChainBuffer::resetReadSize()
+{
+    mReadSize = ChunkPool::CHUNK_CAPACITY;
+    mSmallRequests = 0;
+}
+
+ssize_t ChainBuffer::readFd(int fd, int *savedErrno)
+{
+    // 最后一块的剩余空间（缓冲区为空而最近的请求比较大时是新分配的一大块）加上线程的暂存块，
+    // 读到数据的暂存块直接接到链表后面
+    struct iovec iov[MAX_READ_IOV];
+    int count = 0;
+    BufferChunk *first = nullptr;
+    if (!mTail && mReadSize > ChunkPool::CHUNK_CAPACITY) {
+        first = ChunkPool::allocLarge(mReadSize);
+        iov[count].iov_base = first->data;
+        iov[count].iov_len = first->capacity;
+        count++;
+    }
+    else if (mTail && mTail->writable() > 0) {
+        iov[count].iov_base = mTail->data + mTail->writePos;
+        iov[count].iov_len = mTail->writable();
+        count++;
+    }
+    int scratchBegin = count;
+    for (int i = 0; i < ChunkPool::SCRATCH_NUM; ++i) {
+        BufferChunk *chunk = ChunkPool::scratch(i);
+        iov[count].iov_base = chunk->data;
+        iov[count].iov_len = chunk->capacity;
+        count++;
+    }
+
+    ssize_t len = readv(fd, iov, count);
+    if (len < 0) {
+        *savedErrno = errno;
+    }
+    size_t remain = len > 0 ? len : 0;
+    mReadable += remain;
+    if (first) {
+        if (remain > 0) {
+            first->writePos = std::min(remain, first->capacity);
+            remain -= first->writePos;
+            pushChunk(first);
+        }
+        else {
+            ChunkPool::free(first);
+        }
+    }
+    else if (scratchBegin > 0) {
+        size_t n = std::min(remain, mTail->writable());
+        mTail->writePos += n;
+        remain -= n;
+    }
+    for (int i = 0; i < ChunkPool::SCRATCH_NUM && remain > 0; ++i) {
+        BufferChunk *chunk = ChunkPool::scratch(i);
+        ChunkPool::takeScratch(i);
+        chunk->writePos = std::min(remain, chunk->capacity);
+        remain -= chunk->writePos;
+        pushChunk(chunk);
+    }
+    return len;
+}
+
+ssize_t ChainBuffer::writeFd(int fd, int *savedErrno)
+{
+    struct iovec iov[64];
+    int count = peekIov(iov, sizeof(iov) / sizeof(iov[0]));
+    ssize_t len = writev(fd, iov, count);
+    if (len < 0) {
+        *savedErrno = errno;
+        return len;
+    }
+    retrieve(len);
+    return len;
+}
@@ -0,0 +1,89 @@
+#ifndef CHAIN_BUFFER_H
+#define CHAIN_BUFFER_H
+
+#include <cstddef>
+#include <string>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// 缓冲区的一块，固定大小的块来自内存池，pullup合并出的大块单独分配
+struct BufferChunk {
+    BufferChunk *next;
+    size_t capacity; // data的大小
+    size_t readPos;
+    size_t writePos;
+    char data[1]; // 实际大小为capacity
+
+    size_t readable() const { return writePos - readPos; }
+    size_t writable() const { return capacity - writePos; }
+};
+
+// 固定大小的块的内存池：每个线程一个空闲链表，分配和归还都不加锁
+// 线程的空闲块太多时成批还给共享的链表，空闲链表为空时先从共享的链表成批取，这时才需要加锁
+// （读缓冲区的块在Reactor线程中分配，在工作线程中取走数据后归还，成批转移避免块都堆积在工作线程中）
+class ChunkPool {
+public:
+    static const size_t CHUNK_SIZE = 16384; // 每块占用的内存（包括块头）
+    static const size_t CHUNK_CAPACITY = CHUNK_SIZE - offsetof(BufferChunk, data);
+
+    static const int SCRATCH_NUM = 4; // 每个线程的读入暂存块数
+
+    static BufferChunk *alloc();
+    static BufferChunk *allocLarge(size_t capacity); // 不来自内存池，归还时直接释放
+    static void free(BufferChunk *chunk);
+
+    // 每个线程的读入暂存块（代替栈上的大数组）：readv读进暂存块的数据不再拷贝，整块交给缓冲区，
+    // 用takeScratch取走，空位下次用到时从内存池补上；没有读到数据的暂存块留给这个线程的下一次读
+    static BufferChunk *scratch(int i);
+    static void takeScratch(int i);
+};
+
+// 由固定大小的块组成的缓冲区，用于连接的读缓冲区
+// 读写都用iovec数组：readv直接读进最后一块的剩余空间和线程的暂存块（读到数据的暂存块整块接到链表后面），writev直接从各块发送
+// 数据全部取走的块立即还给内存池，空闲的连接不占用缓冲区内存；写入不会移动已有的数据
+// 需要连续的数据时（解析请求）用pullup，数据只在一块中时不拷贝
+class ChainBuffer {
+public:
+    ChainBuffer();
+    ~ChainBuffer();
+    ChainBuffer(const ChainBuffer&) = delete;
+    ChainBuffer &operator=(const ChainBuffer&) = delete;
+
+    size_t readableBytes() const { return mReadable; }
+    size_t contiguousBytes() const { return mHead ? mHead->readable() : 0; } // 第一块中的可读字节数，pullup不超过它时不拷贝
+    // 前len字节的连续地址，跨越多块时合并到一个新的大块中（留出同样大小的空间给后面的数据，合并的次数是对数级的）
+    const char *pullup(size_t len);
+    const char *peek() { return pullup(mReadable); }
+    void retrieve(size_t len); // 取走数据，取完的块还给内存池
+    void retrieveAll();
+    std::string retrieveAllToStr();
+
+    void append(const char *data, size_t len);
+    void append(const std::string &str) { append(str.data(), str.size()); }
+    int peekIov(struct iovec *iov, int maxIov) const; // 用iovec描述可读的数据（最多maxIov块），返回使用的个数
+
+    ssize_t readFd(int fd, int *savedErrno);
+    ssize_t writeFd(int fd, int *savedErrno);
+
+    // 按最近的请求大小调整空缓冲区第一次读入的块大小：请求比它大时直接扩大到能放下，
+    // 连续SHRINK_AFTER个请求不到一半时减半，最小为一块。请求经常跨越多块时，读入的数据一开始就是连续的，pullup不用合并
+    void recordRequest(size_t size);
+    void resetReadSize(); // 对象给新的连接使用
+    size_t readSize() const { return mReadSize; }
+
+    static const size_t MAX_READ_SIZE = 256 * 1024;
+    static const int SHRINK_AFTER = 2;
+
+private:
+    static const int MAX_READ_IOV = 1 + ChunkPool::SCRATCH_NUM; // readv一次最多读入的块数（最后一块的剩余空间或者按readSize分配的块，加上暂存块）
+
+    void pushChunk(BufferChunk *chunk);
+
+    BufferChunk *mHead;
+    BufferChunk *mTail;
+    size_t mReadable;
+    size_t mReadSize;
+    int mSmallRequests; // 连续的不到mReadSize一半的请求数
+};
+
+#endif
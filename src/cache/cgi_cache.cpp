@@ -0,0 +1,254 @@
+#include "cgi_cache.h"
+#include <cstring>
+#include <strings.h>
+#include <algorithm>
+#include "../utils/utils.h"
+
+using namespace std;
+
+CgiCache::CgiCache() : mShardCapacity(0), mTtl(0), mStale(0) {}
+
+CgiCache *CgiCache::getInstance()
+{
+    static CgiCache cache;
+    return &cache;
+}
+
+void CgiCache::init(size_t capacity, int ttl, int stale)
+{
+    mShardCapacity = capacity / SHARD_NUM;
+    mTtl = ttl;
+    mStale = stale;
+}
+
+CgiCache::Shard &CgiCache::shardOf(const string &key)
+{
+    return shards[hash<string>()(key) % SHARD_NUM];
+}
+
+void CgiCache::erase(Shard &shard, list<Entry>::iterator it)
+{
+    shard.bytes -= it->bytes;
+    shard.index.erase(it->key);
+    shard.lru.erase(it);
+}
+
+void CgiCache::insert(Shard &shard, Entry &&entry)
+{
+    auto it = shard.index.find(entry.key);
+    if (it != shard.index.end()) {
+        erase(shard, it->second);
+    }
+    shard.bytes += entry.bytes;
+    shard.lru.push_front(std::move(entry));
+    shard.index[shard.lru.front().key] = shard.lru.begin();
+    while (shard.bytes > mShardCapacity) {
+        erase(shard, --shard.lru.end());
+    }
+}
+
+// 取出"名字=值"形式的指令的值，值可以带引号
+static bool directiveValue(const string &directive, const char *name, long &value)
+{
+    size_t len = strlen(name);
+    if (directive.size() <= len || strncasecmp(directive.c_str(), name, len) != 0 || directive[len] != '=') {
+        return false;
+    }
+    string text = directive.substr(len + 1);
+    text.erase(remove(text.begin(), text.end(), '"'), text.end());
+    if (text.empty() || text.find_first_not_of("0123456789") != string::npos || text.size() > 9) {
+        value = 0; // 格式不对时当作已经过期
+        return true;
+    }
+    value = stol(text);
+    return true;
+}
+
+bool CgiCache::expiration(CgiResponse &response, time_t now) const
+{
+    long maxAge = -1, sharedMaxAge = -1, staleWindow = -1;
+    bool hasExpires = false;
+    time_t expires = 0;
+    const string &headers = response.headers;
+    size_t pos = 0;
+    while (pos < headers.size()) {
+        size_t end = headers.find("\r\n", pos);
+        if (end == string::npos) {
+            end = headers.size();
+        }
+        string line = headers.substr(pos, end - pos);
+        pos = end + 2;
+        size_t colon = line.find(':');
+        if (colon == string::npos) {
+            continue;
+        }
+        string name = line.substr(0, colon);
+        size_t begin = line.find_first_not_of(' ', colon + 1);
+        string value = begin == string::npos ? "" : line.substr(begin);
+        if (strcasecmp(name.c_str(), "Set-Cookie") == 0) {
+            return false; // 每个用户不同
+        }
+        if (strcasecmp(name.c_str(), "Expires") == 0) {
+            // 格式不对的Expires表示已经过期
+            hasExpires = true;
+            if (!parseHttpDate(value, expires)) {
+                expires = 0;
+            }
+            continue;
+        }
+        if (strcasecmp(name.c_str(), "Cache-Control") != 0) {
+            continue;
+        }
+        size_t start = 0;
+        while (start <= value.size()) {
+            size_t comma = value.find(',', start);
+            if (comma == string::npos) {
+                comma = value.size();
+            }
+            string directive = value.substr(start, comma - start);
+            start = comma + 1;
+            size_t first = directive.find_first_not_of(" \t");
+            if (first == string::npos) {
+                continue;
+            }
+            directive = directive.substr(first, directive.find_last_not_of(" \t") - first + 1);
+            if (strncasecmp(directive.c_str(), "no-store", 8) == 0 || strncasecmp(directive.c_str(), "no-cache", 8) == 0 ||
+                strncasecmp(directive.c_str(), "private", 7) == 0) {
+                return false;
+            }
+            long seconds;
+            if (directiveValue(directive, "s-maxage", seconds)) {
+                sharedMaxAge = seconds;
+            }
+            else if (directiveValue(directive, "max-age", seconds)) {
+                maxAge = seconds;
+            }
+            else if (directiveValue(directive, "stale-while-revalidate", seconds)) {
+                staleWindow = seconds;
+            }
+        }
+    }
+
+    // 共享缓存优先使用s-maxage，其次max-age、Expires，都没有时使用默认的有效期
+    long lifetime = mTtl;
+    if (sharedMaxAge < 0 && maxAge < 0 && !hasExpires && mTtl == 0) {
+        return false; // 默认的有效期为0时只缓存脚本指定了有效期的输出
+    }
+    if (sharedMaxAge >= 0) {
+        lifetime = sharedMaxAge;
+    }
+    else if (maxAge >= 0) {
+        lifetime = maxAge;
+    }
+    else if (hasExpires) {
+        lifetime = max(0L, (long)(expires - now));
+    }
+    if (staleWindow < 0) {
+        staleWindow = mStale;
+    }
+    if (lifetime == 0 && staleWindow == 0) {
+        return false;
+    }
+    response.fresh = now + lifetime;
+    response.stale = response.fresh + staleWindow;
+    return true;
+}
+
+CgiCache::Result CgiCache::lookup(const string &key, shared_ptr<const CgiResponse> &response, bool fill, const Waiter &waiter)
+{
+    if (!isEnabled()) {
+        return PASS;
+    }
+    Shard &shard = shardOf(key);
+    time_t now = time(nullptr);
+    shard.lock.lock();
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        list<Entry>::iterator entry = it->second;
+        if (!entry->response) {
+            if (now < entry->passUntil) {
+                shard.lock.unlock();
+                return PASS;
+            }
+            erase(shard, entry);
+        }
+        else if (now < entry->response->stale) {
+            // 过期不久：已经有请求在重新执行时继续使用，否则由这个请求重新执行，其他请求在此期间继续使用
+            if (now < entry->response->fresh || shard.fetching.count(key) || !fill) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+                response = entry->response;
+                shard.lock.unlock();
+                return HIT;
+            }
+            shard.fetching[key];
+            shard.lock.unlock();
+            return MISS;
+        }
+        else {
+            erase(shard, entry);
+        }
+    }
+    if (!fill) {
+        shard.lock.unlock();
+        return PASS;
+    }
+    auto fetching = shard.fetching.find(key);
+    if (fetching == shard.fetching.end()) {
+        shard.fetching[key];
+        shard.lock.unlock();
+        return MISS;
+    }
+    if (!waiter) {
+        shard.lock.unlock();
+        return PASS;
+    }
+    // 同一个键的脚本正在执行，挂起等待它的结果
+    fetching->second.push_back(waiter);
+    shard.lock.unlock();
+    return WAIT;
+}
+
+void CgiCache::wake(Shard &shard, const string &key)
+{
+    vector<Waiter> waiters;
+    auto it = shard.fetching.find(key);
+    if (it != shard.fetching.end()) {
+        waiters.swap(it->second);
+        shard.fetching.erase(it);
+    }
+    shard.lock.unlock();
+    for (const Waiter &waiter : waiters) {
+        waiter();
+    }
+}
+
+void CgiCache::complete(const string &key, shared_ptr<CgiResponse> response)
+{
+    Shard &shard = shardOf(key);
+    time_t now = time(nullptr);
+    Entry entry;
+    entry.key = key;
+    entry.passUntil = 0;
+    entry.bytes = key.size();
+    if (response && expiration(*response, now)) {
+        size_t size = response->mimeType.size() + response->headers.size() + response->body->size();
+        if (size <= entryLimit()) {
+            entry.response = response;
+            entry.bytes += size;
+        }
+    }
+    if (!entry.response) {
+        // 之后一段时间内的请求直接执行脚本
+        entry.passUntil = now + max(mTtl, 1);
+    }
+    shard.lock.lock();
+    insert(shard, std::move(entry));
+    wake(shard, key);
+}
+
+void CgiCache::abandon(const string &key)
+{
+    Shard &shard = shardOf(key);
+    shard.lock.lock();
+    wake(shard, key);
+}
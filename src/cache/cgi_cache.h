@@ -0,0 +1,80 @@
+#ifndef CGI_CACHE_H
+#define CGI_CACHE_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+#include "../thread/locker.h"
+
+// 缓存的CGI输出：解析后的响应头和响应体，响应行、Connection等每个连接不同的部分发送时再生成
+struct CgiResponse {
+    std::string mimeType;
+    std::string headers; // 脚本输出的其他响应头（Cache-Control、Expires等），每行以\r\n结尾
+    std::shared_ptr<const std::string> body; // 和文件内容一样直接作为writev的一块发送
+    time_t fresh = 0; // 在这之前直接使用
+    time_t stale = 0; // fresh之后、这之前仍然可以使用（stale-while-revalidate），同时由一个请求重新执行脚本
+};
+
+// GET请求的CGI输出缓存，键为脚本路径、查询字符串和Cookie（脚本能看到的全部输入）
+// 有效期按脚本输出的Cache-Control（s-maxage、max-age、no-store等）或Expires计算，都没有时使用默认值
+// 同一个键同时只有一个请求执行脚本，其他请求挂在这个键上等待它的结果，不占用工作线程；
+// 过期不久的条目在重新执行期间继续提供给其他请求
+// 不可缓存的输出记录一个标记，有效期内的请求直接执行脚本，不用排队等待
+// 按键分片，每个分片有自己的内存预算和LRU链表
+class CgiCache {
+public:
+    // HIT: 使用缓存的输出；MISS: 由调用者执行脚本，之后必须调用complete或abandon；PASS: 直接执行脚本，输出不放入缓存；
+    // WAIT: 同一个键的脚本正在执行，请求已经挂起，结果出来后调用登记的Waiter，由它重新查找
+    enum Result { HIT, MISS, PASS, WAIT };
+    typedef std::function<void()> Waiter;
+
+    static CgiCache *getInstance();
+
+    // capacity为内存预算（字节），0表示不缓存；ttl、stale为脚本没有指定时的有效期和过期后还可以使用的时间（秒）
+    void init(size_t capacity, int ttl, int stale);
+    bool isEnabled() const { return mShardCapacity > 0; }
+    size_t entryLimit() const { return mShardCapacity / 8; } // 更大的输出会挤掉很多小的，不缓存
+
+    // fill为false时（HEAD请求）只查找，不等待也不负责执行脚本；waiter为空时不挂起，要等待的请求直接执行脚本（PASS）
+    Result lookup(const std::string &key, std::shared_ptr<const CgiResponse> &response, bool fill, const Waiter &waiter);
+    // MISS的请求执行完脚本，response为空表示执行失败；不可缓存的输出记为PASS
+    // 这两个函数返回前在调用者的线程中调用挂起的请求登记的Waiter
+    void complete(const std::string &key, std::shared_ptr<CgiResponse> response);
+    void abandon(const std::string &key); // MISS的请求没有执行完（连接关闭了），挂起的请求重新查找，其中一个重新执行
+
+private:
+    CgiCache();
+
+    static const int SHARD_NUM = 16;
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const CgiResponse> response; // 为空表示不可缓存的标记
+        time_t passUntil; // 标记的有效期
+        size_t bytes;
+    };
+    struct Shard {
+        Locker lock;
+        std::list<Entry> lru; // 最近使用的在前面
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        std::unordered_map<std::string, std::vector<Waiter>> fetching; // 正在执行脚本的键，以及挂起等待结果的请求
+        size_t bytes = 0;
+    };
+
+    void wake(Shard &shard, const std::string &key); // 取出键上挂起的请求并释放分片的锁，然后唤醒它们
+
+    Shard &shardOf(const std::string &key);
+    void erase(Shard &shard, std::list<Entry>::iterator it);
+    void insert(Shard &shard, Entry &&entry);
+    bool expiration(CgiResponse &response, time_t now) const; // 计算fresh和stale，不可缓存时返回false
+
+    Shard shards[SHARD_NUM];
+    size_t mShardCapacity;
+    int mTtl;
+    int mStale;
+};
+
+#endif
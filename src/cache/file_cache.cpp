@@ -0,0 +1,334 @@
+#include "file_cache.h"
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "../log/log.h"
+#include "../utils/utils.h"
+
+using namespace std;
+
+CachedFile::CachedFile() : fd(-1), data(nullptr)
+{
+    memset(&st, 0, sizeof(st));
+}
+
+CachedFile::~CachedFile()
+{
+    if (data) {
+        munmap(data, st.st_size);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+FileCache::FileCache() :
+    shardCapacity(0),
+    mapLimit(-1),
+    enabled(false),
+    inotifyFd(-1),
+    stopFd(-1),
+    watching(false)
+{
+}
+
+FileCache::~FileCache()
+{
+    stop();
+}
+
+FileCache *FileCache::getInstance()
+{
+    static FileCache cache;
+    return &cache;
+}
+
+void FileCache::init(const string &docRoot, int capacity, long mapLimit,
+                     function<string(const string&)> mimeOf)
+{
+    this->mapLimit = mapLimit;
+    this->mimeOf = mimeOf;
+    this->docRoot = docRoot;
+    shardCapacity = (capacity + SHARD_NUM - 1) / SHARD_NUM;
+    if (capacity <= 0) {
+        return;
+    }
+
+    // 请求的路径是docRoot拼接URL，docRoot本身可能不是规范路径（相对路径展开、结尾的/、符号链接）
+    char real[PATH_MAX];
+    if (!realpath(docRoot.c_str(), real)) {
+        LOG_WARN("Resolve %s failed, file cache disabled.", docRoot.c_str());
+        return;
+    }
+    realRoot = real;
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotifyFd == -1 || stopFd == -1) {
+        perror("inotify_init1");
+        LOG_WARN("%s", "Create inotify failed, file cache disabled.");
+        return;
+    }
+    addWatch(realRoot);
+    if (watchDirs.empty()) {
+        LOG_WARN("Watch %s failed, file cache disabled.", realRoot.c_str());
+        return;
+    }
+    if (pthread_create(&watcher, nullptr, watchThread, this) != 0) {
+        LOG_WARN("%s", "Create file cache watch thread failed, file cache disabled.");
+        return;
+    }
+    watching = true;
+    enabled = true;
+}
+
+void FileCache::stop()
+{
+    if (watching) {
+        uint64_t one = 1;
+        ::write(stopFd, &one, sizeof(one));
+        pthread_join(watcher, nullptr);
+        watching = false;
+    }
+    enabled = false;
+    if (inotifyFd != -1) {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+    if (stopFd != -1) {
+        close(stopFd);
+        stopFd = -1;
+    }
+}
+
+FileCache::Shard &FileCache::shardOf(const string &path)
+{
+    return shards[hash<string>()(path) % SHARD_NUM];
+}
+
+shared_ptr<const CachedFile> FileCache::lookup(const string &path)
+{
+    if (!enabled) {
+        bool cacheable;
+        return load(path, cacheable);
+    }
+
+    Shard &shard = shardOf(path);
+    shard.lock.lock();
+    auto it = shard.files.find(path);
+    if (it != shard.files.end()) {
+        shared_ptr<const CachedFile> file = it->second;
+        shard.lock.unlock();
+        return file;
+    }
+    unsigned long generation = shard.generation;
+    shard.lock.unlock();
+
+    // 未命中时在锁外访问文件系统
+    bool cacheable = false;
+    shared_ptr<const CachedFile> file = load(path, cacheable);
+    if (!file || !cacheable) {
+        return file;
+    }
+
+    shard.lock.lock();
+    // 加载期间文件可能已经变化，这时的结果只给这一次请求使用
+    if (shard.generation == generation) {
+        if (shard.files.size() >= shardCapacity) {
+            shard.files.erase(shard.files.begin());
+        }
+        shard.files[path] = file;
+    }
+    shard.lock.unlock();
+    return file;
+}
+
+shared_ptr<const CachedFile> FileCache::load(const string &path, bool &cacheable)
+{
+    shared_ptr<CachedFile> file(new CachedFile());
+    if (stat(path.c_str(), &file->st) < 0) {
+        return nullptr;
+    }
+    file->mimeType = mimeOf(path);
+    if (S_ISREG(file->st.st_mode)) {
+        // 验证器只由文件状态决定，条目随文件变化失效，每个条目只需要生成一次
+        char etag[64];
+        snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", (unsigned long)file->st.st_ino, (unsigned long)file->st.st_size,
+                 (unsigned long)file->st.st_mtim.tv_sec * 1000000000UL + file->st.st_mtim.tv_nsec);
+        file->etag = etag;
+        file->lastModified = httpDate(file->st.st_mtime);
+    }
+    if (S_ISREG(file->st.st_mode) && (file->st.st_mode & S_IROTH)) {
+        file->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file->fd != -1 && file->st.st_size > 0 && (mapLimit < 0 || file->st.st_size < mapLimit)) {
+            void *data = mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+            if (data != MAP_FAILED) {
+                file->data = (char*)data;
+            }
+        }
+        else if (file->fd != -1) {
+            // 用sendfile发送的大文件大多从头到尾顺序读，让内核加大预读
+            posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+
+    // 只缓存能收到inotify事件的路径：去掉"//"、"."、".."和符号链接之后必须还是同一个路径，
+    // 否则同一个文件会有多个键，或者文件在没有监视的目录中
+    if (enabled && path.compare(0, docRoot.size(), docRoot) == 0) {
+        char real[PATH_MAX];
+        cacheable = realpath(path.c_str(), real) && realRoot + path.substr(docRoot.size()) == real;
+    }
+    return file;
+}
+
+void FileCache::invalidate(const string &path, bool recursive)
+{
+    if (!recursive) {
+        Shard &shard = shardOf(path);
+        shard.lock.lock();
+        shard.files.erase(path);
+        shard.generation++;
+        shard.lock.unlock();
+        return;
+    }
+
+    // 目录被删除、移动或修改权限，目录下的所有条目都要删除
+    string prefix = path + "/";
+    for (int i = 0; i < SHARD_NUM; ++i) {
+        Shard &shard = shards[i];
+        shard.lock.lock();
+        for (auto it = shard.files.begin(); it != shard.files.end();) {
+            if (it->first == path || it->first.compare(0, prefix.size(), prefix) == 0) {
+                it = shard.files.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        shard.generation++;
+        shard.lock.unlock();
+    }
+}
+
+void FileCache::invalidateAll()
+{
+    for (int i = 0; i < SHARD_NUM; ++i) {
+        shards[i].lock.lock();
+        shards[i].files.clear();
+        shards[i].generation++;
+        shards[i].lock.unlock();
+    }
+}
+
+void FileCache::addWatch(const string &dir)
+{
+    // 不跟随符号链接，链接到的目录不在监视范围内，load()也不会缓存其中的文件
+    uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                    IN_ONLYDIR | IN_DONT_FOLLOW;
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(), mask);
+    if (wd == -1) {
+        LOG_WARN("inotify_add_watch %s failed: %s", dir.c_str(), strerror(errno));
+        return;
+    }
+    watchDirs[wd] = dir;
+
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        string child = dir + "/" + entry->d_name;
+        bool isDir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isDir = lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (isDir) {
+            addWatch(child);
+        }
+    }
+    closedir(d);
+}
+
+void *FileCache::watchThread(void *arg)
+{
+    static_cast<FileCache*>(arg)->watchLoop();
+    return nullptr;
+}
+
+void FileCache::watchLoop()
+{
+    // inotify_event按自身对齐，缓冲区至少能放下一个最长文件名的事件
+    alignas(struct inotify_event) char buf[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+    struct pollfd fds[2];
+    fds[0].fd = inotifyFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopFd;
+    fds[1].events = POLLIN;
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        ssize_t len;
+        while ((len = read(inotifyFd, buf, sizeof(buf))) > 0) {
+            handleEvents(buf, len);
+        }
+    }
+}
+
+void FileCache::handleEvents(const char *buf, ssize_t len)
+{
+    for (const char *p = buf; p < buf + len;) {
+        const struct inotify_event *event = (const struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            // 事件丢失了，不知道哪些文件变了
+            LOG_WARN("%s", "inotify queue overflow, clear file cache.");
+            invalidateAll();
+            continue;
+        }
+        auto it = watchDirs.find(event->wd);
+        if (it == watchDirs.end()) {
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            // 目录被删除或移走，监视已经被内核移除
+            watchDirs.erase(it);
+            continue;
+        }
+
+        // 事件中的路径在规范的根目录下，换成请求使用的路径（docRoot开头）
+        string real = it->second;
+        if (event->len > 0) {
+            real += "/";
+            real += event->name;
+        }
+        string path = docRoot + real.substr(realRoot.size());
+        bool isDir = (event->mask & IN_ISDIR) || event->len == 0;
+        invalidate(path, isDir);
+
+        if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR)) {
+            addWatch(real);
+        }
+    }
+}
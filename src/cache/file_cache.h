@@ -0,0 +1,79 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <atomic>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../thread/locker.h"
+
+// 缓存的静态文件：文件状态、MIME类型、打开的fd，小文件还有整个文件的只读映射
+// 条目被淘汰或失效后，正在发送它的连接仍然持有shared_ptr，发送完才真正关闭和解除映射
+struct CachedFile {
+    CachedFile();
+    ~CachedFile();
+
+    struct stat st;
+    std::string mimeType;
+    int fd; // 可读的普通文件才会打开，否则为-1
+    char *data; // 小于映射上限的非空普通文件被mmap到这里，否则为nullptr
+    std::string etag; // 由inode、大小和修改时间生成的强验证器（带引号），普通文件才有
+    std::string lastModified; // 修改时间的HTTP日期格式
+};
+
+// 静态文件的打开文件和元数据缓存，按解析后的完整路径索引，分成多个分片各自加锁
+// 通过inotify监视资源根目录（包括所有子目录），文件被修改、删除、移动或改变权限时删除对应的条目，
+// 所以命中时不需要任何文件系统调用（stat/open/mmap/close/munmap）
+class FileCache {
+public:
+    static FileCache *getInstance();
+
+    // capacity为0时不缓存，每次查找都重新stat/open/mmap；mapLimit为小于它的文件建立映射，-1表示不限
+    // 监视资源根目录失败时也不缓存（无法知道文件何时变化）
+    void init(const std::string &docRoot, int capacity, long mapLimit,
+              std::function<std::string(const std::string&)> mimeOf);
+    void stop(); // 停止监视线程
+
+    // 查找文件，不存在（stat失败）时返回空指针
+    std::shared_ptr<const CachedFile> lookup(const std::string &path);
+
+private:
+    FileCache();
+    ~FileCache();
+
+    static const int SHARD_NUM = 16;
+    struct Shard {
+        Locker lock;
+        std::unordered_map<std::string, std::shared_ptr<const CachedFile>> files;
+        unsigned long generation = 0; // 每次失效加1，查找期间发生过失效的结果不放入缓存
+    };
+
+    std::shared_ptr<const CachedFile> load(const std::string &path, bool &cacheable);
+    Shard &shardOf(const std::string &path);
+    void invalidate(const std::string &path, bool recursive); // recursive为true时同时删除路径下的所有条目
+    void invalidateAll();
+
+    static void *watchThread(void *arg);
+    void watchLoop();
+    void addWatch(const std::string &dir); // 监视目录及其所有子目录
+    void handleEvents(const char *buf, ssize_t len);
+
+    Shard shards[SHARD_NUM];
+    size_t shardCapacity;
+    long mapLimit;
+    std::function<std::string(const std::string&)> mimeOf;
+    std::atomic<bool> enabled;
+    std::string docRoot; // 请求路径的前缀，缓存的键以它开头
+    std::string realRoot; // docRoot的规范路径，inotify事件中的路径以它开头
+
+    int inotifyFd;
+    int stopFd; // eventfd，通知监视线程退出
+    pthread_t watcher;
+    bool watching;
+    std::unordered_map<int, std::string> watchDirs; // inotify的wd -> 目录路径，只在监视线程中修改
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "response_cache.h"
+
+using namespace std;
+
+ResponseCache::ResponseCache() : mShardCapacity(0) {}
+
+ResponseCache *ResponseCache::getInstance()
+{
+    static ResponseCache cache;
+    return &cache;
+}
+
+void ResponseCache::init(size_t capacity)
+{
+    mShardCapacity = capacity / SHARD_NUM;
+}
+
+ResponseCache::Shard &ResponseCache::shardOf(const string &key)
+{
+    return shards[hash<string>()(key) % SHARD_NUM];
+}
+
+void ResponseCache::erase(Shard &shard, list<Entry>::iterator it)
+{
+    shard.bytes -= it->key.size() + it->response->size();
+    shard.index.erase(it->key);
+    shard.lru.erase(it);
+}
+
+shared_ptr<const string> ResponseCache::lookup(const string &key, const shared_ptr<const CachedFile> &file)
+{
+    if (!isEnabled()) {
+        return nullptr;
+    }
+    Shard &shard = shardOf(key);
+    shard.lock.lock();
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        shard.lock.unlock();
+        return nullptr;
+    }
+    list<Entry>::iterator entry = it->second;
+    if (entry->hasFile && (!file || entry->file.lock() != file)) {
+        // 生成响应之后文件变化过，或者文件缓存条目已经被淘汰
+        erase(shard, entry);
+        shard.lock.unlock();
+        return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+    shared_ptr<const string> response = entry->response;
+    shard.lock.unlock();
+    return response;
+}
+
+void ResponseCache::insert(const string &key, const shared_ptr<const CachedFile> &file, shared_ptr<const string> response)
+{
+    size_t size = key.size() + response->size();
+    // 太大的响应会挤掉很多小响应，不缓存
+    if (!isEnabled() || size > mShardCapacity / 8) {
+        return;
+    }
+    Shard &shard = shardOf(key);
+    shard.lock.lock();
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        erase(shard, it->second);
+    }
+    Entry entry;
+    entry.key = key;
+    entry.file = file;
+    entry.hasFile = (file != nullptr);
+    entry.response = response;
+    shard.lru.push_front(entry);
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += size;
+    while (shard.bytes > mShardCapacity) {
+        erase(shard, --shard.lru.end());
+    }
+    shard.lock.unlock();
+}
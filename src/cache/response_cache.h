@@ -0,0 +1,49 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <string>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include "../thread/locker.h"
+#include "file_cache.h"
+
+// 序列化好的完整响应（响应行+响应头+响应体）的缓存，用于小文件和错误页面
+// 响应是不可修改的共享字符串，命中时直接从它writev，不需要拼接响应头、也不需要映射文件
+// 按键分片，每个分片有自己的内存预算和LRU链表
+class ResponseCache {
+public:
+    static ResponseCache *getInstance();
+
+    void init(size_t capacity); // 内存预算（字节），0表示不缓存
+    bool isEnabled() const { return mShardCapacity > 0; }
+
+    // file为响应依赖的文件缓存条目（错误页面为空），文件缓存中的条目已经换成新的（文件变化了）时缓存的响应无效
+    std::shared_ptr<const std::string> lookup(const std::string &key, const std::shared_ptr<const CachedFile> &file);
+    void insert(const std::string &key, const std::shared_ptr<const CachedFile> &file, std::shared_ptr<const std::string> response);
+
+private:
+    ResponseCache();
+
+    static const int SHARD_NUM = 16;
+    struct Entry {
+        std::string key;
+        std::weak_ptr<const CachedFile> file; // 不延长文件缓存条目（fd和映射）的生命周期
+        bool hasFile;
+        std::shared_ptr<const std::string> response;
+    };
+    struct Shard {
+        Locker lock;
+        std::list<Entry> lru; // 最近使用的在前面
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    Shard &shardOf(const std::string &key);
+    void erase(Shard &shard, std::list<Entry>::iterator it);
+
+    Shard shards[SHARD_NUM];
+    size_t mShardCapacity;
+};
+
+#endif
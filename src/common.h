@@ -31,7 +31,9 @@ enum {
     CREATE_DIR_ERROR,
     MYSQL_ERROR,
     REDIS_ERROR,
-    SYSCALL_ERROR
+    SYSCALL_ERROR,
+    CREATE_TIMERFD_ERROR,
+    CREATE_SIGNALFD_ERROR
 };
 
 #endif
\ No newline at end of file
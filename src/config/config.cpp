@@ -17,6 +17,19 @@ void Config::showUsage(const char *argv)
     cerr << " -d, --daemon                           Run in daemon process." << endl;
     cerr << " -t NUM, --thread_pool_size=NUM         The thread pool size of the server." << endl;
     cerr << " -s NUM, --connectcion_pool_size=NUM    The connectcion pool size of the server." << endl;
+    cerr << " -n NUM, --reactor_num=NUM              The number of reactor (event loop) threads." << endl;
+    cerr << " -T TYPE, --timer=TYPE                  The timer of idle connections: heap or wheel." << endl;
+    cerr << " -q TYPE, --task_queue=TYPE             The task queue of the thread pool: list, lockfree or stealing." << endl;
+    cerr << " -b TYPE, --io_backend=TYPE             The network I/O backend: epoll or io_uring." << endl;
+    cerr << " -S SIZE, --sendfile_threshold=SIZE    Send static files of at least SIZE bytes with sendfile, -1 to disable." << endl;
+    cerr << " -F NUM, --file_cache_size=NUM          The max number of cached static files, 0 to disable." << endl;
+    cerr << " -R SIZE, --response_cache_size=SIZE    The memory budget in bytes of cached responses, 0 to disable." << endl;
+    cerr << " -C RULES, --cache_control=RULES        Cache-Control of static files by URL prefix, e.g. \"/images/=max-age=86400;/=no-cache\"." << endl;
+    cerr << " -w NUM, --cgi_workers=NUM              Run CGI scripts in NUM persistent FastCGI workers, 0 to fork per request." << endl;
+    cerr << " -a PATH, --cgi_adapter=PATH            The FastCGI worker program that runs the CGI scripts." << endl;
+    cerr << " -G SIZE, --cgi_cache_size=SIZE         The memory budget in bytes of cached CGI output of GET requests, 0 to disable." << endl;
+    cerr << " -L SEC, --cgi_cache_ttl=SEC            The lifetime of CGI output without Cache-Control or Expires." << endl;
+    cerr << " -W SEC, --cgi_cache_stale=SEC          Serve expired CGI output for SEC more seconds while it is regenerated." << endl;
     cerr << " -i, --config                           Specify config file." << endl;
     cerr << " -v, --version                          Print the version number and exit." << endl;
     cerr << " -h, --help                             Print this message and exit." << endl;
@@ -34,12 +47,25 @@ void Config::parseArgs(int argc, char *argv[])
             {"daemon", no_argument, 0, 'd'},
             {"thread_pool_size", required_argument, 0, 't'},
             {"connectcion_pool_size", required_argument, 0, 's'},
+            {"reactor_num", required_argument, 0, 'n'},
+            {"task_queue", required_argument, 0, 'q'},
+            {"timer", required_argument, 0, 'T'},
+            {"io_backend", required_argument, 0, 'b'},
+            {"sendfile_threshold", required_argument, 0, 'S'},
+            {"file_cache_size", required_argument, 0, 'F'},
+            {"response_cache_size", required_argument, 0, 'R'},
+            {"cache_control", required_argument, 0, 'C'},
+            {"cgi_workers", required_argument, 0, 'w'},
+            {"cgi_adapter", required_argument, 0, 'a'},
+            {"cgi_cache_size", required_argument, 0, 'G'},
+            {"cgi_cache_ttl", required_argument, 0, 'L'},
+            {"cgi_cache_stale", required_argument, 0, 'W'},
             {"config", required_argument, 0, 'i'},
             {"version", no_argument, 0, 'v'},
             {"help", no_argument, 0, 'h'},
             {0, 0, 0, 0}};
 
-        int c = getopt_long(argc, argv, "p:r:t:s:i:cdvh",
+        int c = getopt_long(argc, argv, "p:r:t:s:n:q:T:b:S:F:R:C:w:a:G:L:W:i:cdvh",
                         long_options, &option_index);
         if (c == -1)
             break;
@@ -81,6 +107,102 @@ void Config::parseArgs(int argc, char *argv[])
             }
             break;
         
+        case 'n':
+            reactorNum = atoi(optarg);
+            if (reactorNum <= 0) {
+                cerr << "The reactor number " << reactorNum << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'q':
+            if (!parseTaskQueueType(optarg, taskQueue)) {
+                cerr << "The task queue type " << optarg << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'T':
+            if (!parseTimerType(optarg, timer)) {
+                cerr << "The timer type " << optarg << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'b':
+            if (!parseIoBackend(optarg, ioBackend)) {
+                cerr << "The I/O backend " << optarg << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'S':
+            sendfileThreshold = atol(optarg);
+            if (sendfileThreshold < -1) {
+                cerr << "The sendfile threshold " << sendfileThreshold << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'F':
+            fileCacheSize = atoi(optarg);
+            if (fileCacheSize < 0) {
+                cerr << "The file cache size " << fileCacheSize << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'R':
+            responseCacheSize = atol(optarg);
+            if (responseCacheSize < 0) {
+                cerr << "The response cache size " << responseCacheSize << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'C':
+            if (!parseCacheControl(optarg)) {
+                cerr << "The cache control rules " << optarg << " are invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'w':
+            cgiWorkers = atoi(optarg);
+            if (cgiWorkers < 0) {
+                cerr << "The CGI worker number " << cgiWorkers << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'a':
+            cgiAdapter = optarg;
+            break;
+
+        case 'G':
+            cgiCacheSize = atol(optarg);
+            if (cgiCacheSize < 0) {
+                cerr << "The CGI cache size " << cgiCacheSize << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'L':
+            cgiCacheTtl = atoi(optarg);
+            if (cgiCacheTtl < 0) {
+                cerr << "The CGI cache TTL " << cgiCacheTtl << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
+        case 'W':
+            cgiCacheStale = atoi(optarg);
+            if (cgiCacheStale < 0) {
+                cerr << "The CGI cache stale time " << cgiCacheStale << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+            break;
+
         case 'i':
             configFile = optarg;
             break;
@@ -107,6 +229,7 @@ void Config::parseArgs(int argc, char *argv[])
         loadConfigFile();
 
     docRoot = getPath(docRoot);
+    cgiAdapter = getPath(cgiAdapter);
 }
 
 void Config::loadConfigFile()
@@ -189,6 +312,89 @@ void Config::loadConfigFile()
                 exit(INVALID_OPTION);
             }
         }
+        else if (key == "server.reactor_num") {
+            reactorNum = stoi(value);
+            if (reactorNum <= 0) {
+                cerr << "The reactor number " << reactorNum << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.task_queue") {
+            if (!parseTaskQueueType(value, taskQueue)) {
+                cerr << "The task queue type " << value << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.timer") {
+            if (!parseTimerType(value, timer)) {
+                cerr << "The timer type " << value << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.io_backend") {
+            if (!parseIoBackend(value, ioBackend)) {
+                cerr << "The I/O backend " << value << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.sendfile_threshold") {
+            sendfileThreshold = stol(value);
+            if (sendfileThreshold < -1) {
+                cerr << "The sendfile threshold " << sendfileThreshold << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.file_cache_size") {
+            fileCacheSize = stoi(value);
+            if (fileCacheSize < 0) {
+                cerr << "The file cache size " << fileCacheSize << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.response_cache_size") {
+            responseCacheSize = stol(value);
+            if (responseCacheSize < 0) {
+                cerr << "The response cache size " << responseCacheSize << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.cache_control") {
+            if (!parseCacheControl(value)) {
+                cerr << "The cache control rules " << value << " are invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.cgi_workers") {
+            cgiWorkers = stoi(value);
+            if (cgiWorkers < 0) {
+                cerr << "The CGI worker number " << cgiWorkers << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.cgi_adapter") {
+            cgiAdapter = value;
+        }
+        else if (key == "server.cgi_cache_size") {
+            cgiCacheSize = stol(value);
+            if (cgiCacheSize < 0) {
+                cerr << "The CGI cache size " << cgiCacheSize << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.cgi_cache_ttl") {
+            cgiCacheTtl = stoi(value);
+            if (cgiCacheTtl < 0) {
+                cerr << "The CGI cache TTL " << cgiCacheTtl << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
+        else if (key == "server.cgi_cache_stale") {
+            cgiCacheStale = stoi(value);
+            if (cgiCacheStale < 0) {
+                cerr << "The CGI cache stale time " << cgiCacheStale << " is invalid." << endl;
+                exit(INVALID_OPTION);
+            }
+        }
         else if (key == "mysql.user") {
             mysqlUser = value;
         }
@@ -250,4 +456,36 @@ void Config::trim(string &temp)
         // 说明字符串后面有空格
         temp = temp.substr(0, idx + 1);
     }
+}
+
+// 解析Cache-Control规则，如 "/images/=public, max-age=86400;/=no-cache"
+// 前缀必须以/开头，值中可以有=和,，不能有;
+bool Config::parseCacheControl(const string &value)
+{
+    cacheControl.clear();
+    size_t pos = 0;
+    while (pos < value.size()) {
+        size_t end = value.find(';', pos);
+        if (end == string::npos) {
+            end = value.size();
+        }
+        string rule = value.substr(pos, end - pos);
+        pos = end + 1;
+        if (rule.find_first_not_of(' ') == string::npos) {
+            continue;
+        }
+        size_t idx = rule.find('=');
+        if (idx == string::npos) {
+            return false;
+        }
+        string prefix = rule.substr(0, idx);
+        string control = rule.substr(idx + 1);
+        trim(prefix);
+        trim(control);
+        if (prefix.empty() || prefix[0] != '/' || control.find_first_not_of(' ') == string::npos) {
+            return false;
+        }
+        cacheControl.push_back(make_pair(prefix, control));
+    }
+    return true;
 }
\ No newline at end of file
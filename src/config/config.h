@@ -6,8 +6,13 @@
 #include <string>
 #include <fstream>
 #include <regex>
+#include <vector>
+#include <utility>
 #include "../common.h"
 #include "../utils/utils.h"
+#include "../thread/task_queue.h"
+#include "../timer/Timer.h"
+#include "../uring/uring.h"
 
 using namespace std;
 
@@ -19,7 +24,20 @@ public:
 
     bool closeLog = false;
     int threadPool = 8;
+    TaskQueueType taskQueue = TASK_QUEUE_LIST; // 线程池请求队列的实现
+    TimerType timer = TIMER_HEAP; // 管理非活跃连接的定时器实现
+    int reactorNum = 1; // Reactor（事件循环线程）的数量，大于1时每个Reactor各自监听端口（SO_REUSEPORT）
+    IoBackend ioBackend = IO_BACKEND_EPOLL; // 网络I/O的实现
+    long sendfileThreshold = 65536; // 不小于该大小的静态文件用sendfile发送，更小的用mmap+writev，-1表示不使用sendfile
+    int fileCacheSize = 512; // 静态文件缓存的最大条目数（每个条目占用一个fd），0表示不缓存
+    long responseCacheSize = 16 * 1024 * 1024; // 完整响应缓存的内存预算（字节），0表示不缓存
+    vector<pair<string, string>> cacheControl; // 静态文件响应的Cache-Control：(URL前缀, 值)，默认不添加
     int connectionPool = 8;
+    int cgiWorkers = 0; // 常驻的FastCGI工作进程数量，0表示每个CGI请求fork+exec一个进程
+    string cgiAdapter = "./tools/cgi_adapter.py"; // FastCGI工作进程的可执行文件
+    long cgiCacheSize = 0; // GET请求的CGI输出缓存的内存预算（字节），0表示不缓存
+    int cgiCacheTtl = 10; // 脚本没有输出Cache-Control和Expires时，输出的有效期（秒）
+    int cgiCacheStale = 10; // 脚本没有指定stale-while-revalidate时，过期后还可以使用的时间（秒）
     bool daemonProcess = false;
 
     string mysqlUser = "root";
@@ -35,6 +53,7 @@ private:
     void showUsage(const char *argv);
     void loadConfigFile();
     void trim(string &temp); // 去掉字符串前后空格
+    bool parseCacheControl(const string &value); // 解析以;分隔的"前缀=值"规则
     string configFile;
 };
 
@@ -1,9 +1,9 @@
 #include "epoll.h"
 
-void addfd(int epollfd, int fd, bool one_shot, bool et)
+void addfd(int epollfd, int fd, bool one_shot, bool et, uint32_t generation)
 {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = makeEpollData(fd, generation);
     event.events = EPOLLIN | EPOLLRDHUP;
     if (et)
         event.events |= EPOLLET;
@@ -26,10 +26,20 @@ void removefd(int epollfd, int fd)
 }
 
 // 重置socket上的EPOLLONESHOT事件，以确保下一次可读时，EPOLLON能被触发
-void modifyfd(int epollfd, int fd, int ev)
+void modifyfd(int epollfd, int fd, int ev, uint32_t generation)
 {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = makeEpollData(fd, generation);
     event.events = ev | EPOLLRDHUP | EPOLLONESHOT | EPOLLET; // TODO: 是否使用ET可以作为程序的选项
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
-}
\ No newline at end of file
+}
+
+void watchfd(int epollfd, int fd, int ev, uint64_t data)
+{
+    epoll_event event;
+    event.data.u64 = data;
+    event.events = ev | EPOLLONESHOT;
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) == -1 && errno == ENOENT) {
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
@@ -5,9 +5,37 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include "../utils/utils.h"
+#include <cstdint>
 
-void addfd(int epollfd, int fd, bool one_shot, bool et);
+// epoll_event.data的低24位是fd，接下来8位是事件来源，高32位是连接的代数（generation）
+// fd关闭后可能马上被新连接复用，同一批事件中属于旧连接的事件可以通过代数识别出来
+// CGI管道的事件中fd是所属连接的socket，代数换成CGI子进程的序号（CgiProcess::serial）
+// FastCGI连接的事件中fd是到工作进程的socket，代数换成连接的序号
+enum EpollSource { EPOLL_SOURCE_SOCKET = 0, EPOLL_SOURCE_CGI_INPUT, EPOLL_SOURCE_CGI_OUTPUT, EPOLL_SOURCE_FCGI };
+
+inline uint64_t makeEpollData(int fd, uint32_t generation, int source = EPOLL_SOURCE_SOCKET)
+{
+    return ((uint64_t)generation << 32) | ((uint32_t)source << 24) | ((uint32_t)fd & 0xffffff);
+}
+
+inline int epollDataFd(uint64_t data)
+{
+    return (int)((uint32_t)data & 0xffffff);
+}
+
+inline int epollDataSource(uint64_t data)
+{
+    return (int)(((uint32_t)data >> 24) & 0xff);
+}
+
+inline uint32_t epollDataGeneration(uint64_t data)
+{
+    return (uint32_t)(data >> 32);
+}
+
+void addfd(int epollfd, int fd, bool one_shot, bool et, uint32_t generation = 0);
 void removefd(int epollfd, int fd);
-void modifyfd(int epollfd, int fd, int ev);
+void modifyfd(int epollfd, int fd, int ev, uint32_t generation = 0);
+void watchfd(int epollfd, int fd, int ev, uint64_t data); // 单次等待fd上的ev事件，fd还没有注册时先注册
 
 #endif
\ No newline at end of file
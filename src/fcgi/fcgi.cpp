@@ -0,0 +1,536 @@
+#include "fcgi.h"
+#include <cstddef>
+#include <algorithm>
+#include <csignal>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "../utils/utils.h"
+
+using namespace std;
+
+static const int FCGI_VERSION_1 = 1;
+static const int FCGI_HEADER_LEN = 8;
+static const int FCGI_MAX_CONTENT = 65535;
+static const int FCGI_RESPONDER = 1;
+static const int FCGI_KEEP_CONN = 1;
+static const int FCGI_REQUEST_COMPLETE = 0;
+
+extern char **environ;
+
+FastCgiPool::FastCgiPool() : mWorkers(0) {}
+
+FastCgiPool::~FastCgiPool()
+{
+    stop();
+}
+
+FastCgiPool *FastCgiPool::getInstance()
+{
+    static FastCgiPool cgiPool;
+    return &cgiPool;
+}
+
+void FastCgiPool::init(int workers, const string &adapter)
+{
+    if (workers <= 0) {
+        return;
+    }
+    mAdapter = adapter;
+    if (access(mAdapter.c_str(), X_OK) != 0) {
+        perror(mAdapter.c_str());
+        LOG_ERROR("CGI adapter %s is not executable.", mAdapter.c_str());
+        exit(INVALID_OPTION);
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            perror("socket");
+            LOG_ERROR("%s", "Create FastCGI socket failed.");
+            exit(CREATE_SOCKET_ERROR);
+        }
+        // 抽象命名空间的地址以'\0'开头，进程退出后自动消失
+        string path = string(1, '\0') + "my-webserver-fcgi-" + to_string(getpid()) + "-" + to_string(i);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.data(), path.size());
+        socklen_t addrLen = offsetof(sockaddr_un, sun_path) + path.size();
+        if (bind(listenFd, (sockaddr*)&addr, addrLen) < 0) {
+            perror("bind");
+            LOG_ERROR("%s", "Bind FastCGI socket failed.");
+            exit(BIND_ERROR);
+        }
+        if (listen(listenFd, SOMAXCONN) < 0) {
+            perror("listen");
+            LOG_ERROR("%s", "Listen FastCGI socket failed.");
+            exit(LISTEN_ERROR);
+        }
+        mListenFds.push_back(listenFd);
+        mSocketPaths.push_back(path);
+    }
+
+    mProcs = vector<Proc>(workers);
+    for (int i = 0; i < workers; ++i) {
+        pid_t pid = spawnWorker(i);
+        if (pid < 0) {
+            exit(SYSCALL_ERROR);
+        }
+        mProcs[i].pid = pid;
+        mProcs[i].started = currentTimeMs();
+    }
+    mWorkers = workers;
+    LOG_INFO("started %d FastCGI workers: %s", workers, mAdapter.c_str());
+}
+
+pid_t FastCgiPool::spawnWorker(int index)
+{
+    // FastCGI约定监听socket作为工作进程的标准输入，其他描述符都不需要
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, mListenFds[index], 0);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+
+    // 与fork+exec的CGI一样，恢复服务器修改过的信号屏蔽字，以及忽略的SIGPIPE和SIGHUP
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    sigaddset(&signals, SIGHUP);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    // 不复制服务器的页表，可以在Reactor线程中调用；服务器退出时工作进程自己设置的PR_SET_PDEATHSIG让它随之退出
+    pid_t pid;
+    char *argv[] = { const_cast<char*>(mAdapter.c_str()), nullptr };
+    int ret = posix_spawn(&pid, mAdapter.c_str(), &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (ret != 0) {
+        errno = ret;
+        perror("posix_spawn");
+        LOG_ERROR("%s", "Spawn FastCGI worker failed.");
+        return -1;
+    }
+    return pid;
+}
+
+void FastCgiPool::startWorker(int index, int64_t now)
+{
+    Proc &proc = mProcs[index];
+    pid_t pid = spawnWorker(index);
+    proc.pid = pid;
+    if (pid > 0) {
+        proc.started = now;
+        proc.retryAt = 0;
+    }
+    else {
+        delayWorker(index, now);
+    }
+}
+
+void FastCgiPool::delayWorker(int index, int64_t now)
+{
+    Proc &proc = mProcs[index];
+    proc.delay = proc.delay == 0 ? RESPAWN_DELAY_MS : min(proc.delay * 2, MAX_RESPAWN_DELAY_MS);
+    proc.retryAt = now + proc.delay;
+    LOG_WARN("FastCGI worker %d will be restarted in %d ms.", index, proc.delay);
+}
+
+void FastCgiPool::reapWorkers()
+{
+    int64_t now = currentTimeMs();
+    lock.lock();
+    for (size_t i = 0; i < mProcs.size(); ++i) {
+        Proc &proc = mProcs[i];
+        pid_t pid = proc.pid;
+        if (pid <= 0 || waitpid(pid, nullptr, WNOHANG) != pid) {
+            continue;
+        }
+        if (now - proc.started < RESPAWN_DELAY_MS) {
+            // 刚启动就退出，多半是适配器本身有问题，不能每次SIGCHLD都立即重启
+            LOG_WARN("FastCGI worker %d exited right after start.", pid);
+            proc.pid = -1;
+            delayWorker(i, now);
+        }
+        else {
+            LOG_WARN("FastCGI worker %d exited, restarting", pid);
+            proc.delay = 0;
+            startWorker(i, now);
+        }
+    }
+    lock.unlock();
+}
+
+void FastCgiPool::respawnWorkers()
+{
+    if (mWorkers == 0) {
+        return;
+    }
+    int64_t now = currentTimeMs();
+    lock.lock();
+    for (size_t i = 0; i < mProcs.size(); ++i) {
+        if (mProcs[i].pid <= 0 && mProcs[i].retryAt > 0 && now >= mProcs[i].retryAt) {
+            startWorker(i, now);
+        }
+    }
+    lock.unlock();
+}
+
+int FastCgiPool::connectWorker(int index)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    // 监听socket一直属于服务器，工作进程正在重新启动时连接留在监听队列中，等它启动后再处理
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, mSocketPaths[index].data(), mSocketPaths[index].size());
+    socklen_t addrLen = offsetof(sockaddr_un, sun_path) + mSocketPaths[index].size();
+    if (connect(fd, (sockaddr*)&addr, addrLen) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void FastCgiPool::stop()
+{
+    if (mWorkers == 0) {
+        return;
+    }
+    lock.lock();
+    // 不清空mProcs，Reactor线程可能还在检查工作进程是否在运行
+    for (Proc &proc : mProcs) {
+        pid_t pid = proc.pid;
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+        proc.pid = -1;
+        proc.retryAt = 0;
+    }
+    for (int fd : mListenFds) {
+        close(fd);
+    }
+    mListenFds.clear();
+    mWorkers = 0;
+    lock.unlock();
+}
+
+// 记录头：版本、类型、请求ID、内容长度、填充长度，内容按8字节对齐
+static void appendRecord(string &out, int type, uint16_t id, const char *data, size_t len)
+{
+    do {
+        size_t n = min(len, (size_t)FCGI_MAX_CONTENT);
+        unsigned char padding = (8 - n % 8) % 8;
+        unsigned char header[FCGI_HEADER_LEN] = {
+            FCGI_VERSION_1, (unsigned char)type, (unsigned char)(id >> 8), (unsigned char)id,
+            (unsigned char)(n >> 8), (unsigned char)n, padding, 0
+        };
+        out.append((const char*)header, FCGI_HEADER_LEN);
+        out.append(data, n);
+        out.append(padding, '\0');
+        data += n;
+        len -= n;
+    } while (len > 0);
+}
+
+// 名字和值的长度小于128时用1个字节，否则用最高位为1的4个字节
+static void appendLength(string &out, size_t len)
+{
+    if (len < 128) {
+        out.push_back((char)len);
+    }
+    else {
+        out.push_back((char)((len >> 24) | 0x80));
+        out.push_back((char)(len >> 16));
+        out.push_back((char)(len >> 8));
+        out.push_back((char)len);
+    }
+}
+
+// 整个请求（BEGIN_REQUEST、PARAMS、STDIN）拼成一块，和连接上其他请求的记录一起写入
+static void appendRequest(string &out, uint16_t id, const vector<pair<string, string>> &params, const string &input)
+{
+    unsigned char begin[8] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+    appendRecord(out, FCGI_BEGIN_REQUEST, id, (const char*)begin, sizeof(begin));
+
+    string pairs;
+    for (const auto &param : params) {
+        appendLength(pairs, param.first.size());
+        appendLength(pairs, param.second.size());
+        pairs += param.first;
+        pairs += param.second;
+    }
+    appendRecord(out, FCGI_PARAMS, id, pairs.data(), pairs.size());
+    if (!pairs.empty()) {
+        appendRecord(out, FCGI_PARAMS, id, nullptr, 0); // 空记录表示流结束
+    }
+    appendRecord(out, FCGI_STDIN, id, input.data(), input.size());
+    if (!input.empty()) {
+        appendRecord(out, FCGI_STDIN, id, nullptr, 0);
+    }
+}
+
+FastCgiClient::FastCgiClient(FastCgiListener *listener) :
+    mListener(listener), mConns(FastCgiPool::getInstance()->workers()), mNext(0), mSerial(0) {}
+
+FastCgiClient::~FastCgiClient()
+{
+    for (Conn &conn : mConns) {
+        if (conn.fd != -1) {
+            close(conn.fd);
+        }
+    }
+}
+
+bool FastCgiClient::open(Conn &conn, int index)
+{
+    conn.fd = FastCgiPool::getInstance()->connectWorker(index);
+    if (conn.fd == -1) {
+        return false;
+    }
+    do {
+        conn.serial = ++mSerial & 0xffffff;
+    } while (conn.serial == 0);
+    mListener->watchFastCgi(conn.fd, conn.serial, true, false);
+    return true;
+}
+
+void FastCgiClient::submit(HttpConn *httpConn, uint32_t generation, const vector<pair<string, string>> &params,
+                           const string &input, int64_t now)
+{
+    // 交给正在运行的工作进程中正在执行的请求最少的一个，起点轮流变化，空闲时请求也分散到各个进程
+    FastCgiPool *pool = FastCgiPool::getInstance();
+    int count = mConns.size();
+    int start = mNext++ % count;
+    int index = -1;
+    for (int i = 0; i < count; ++i) {
+        int other = (start + i) % count;
+        if (pool->alive(other) && (index == -1 || mConns[other].requests.size() < mConns[index].requests.size())) {
+            index = other;
+        }
+    }
+    if (index == -1) {
+        LOG_ERROR("%s", "No FastCGI worker is running.");
+        string output;
+        mListener->onFastCgiDone(httpConn, generation, false, output);
+        return;
+    }
+    Conn &conn = mConns[index];
+    if (conn.fd == -1 && !open(conn, index)) {
+        LOG_ERROR("Connect to FastCGI worker %d failed.", index);
+        string output;
+        mListener->onFastCgiDone(httpConn, generation, false, output);
+        return;
+    }
+    // 请求ID在连接上收到END_REQUEST之前一直被占用，包括已经取消的请求
+    uint16_t id;
+    do {
+        id = ++conn.nextId; // 0是管理记录使用的ID
+    } while (id == 0 || conn.requests.count(id));
+    appendRequest(conn.out, id, params, input);
+    conn.requests[id] = Request{ httpConn, generation, string() };
+    mSlots[httpConn] = Slot{ index, id, now + FastCgiPool::IO_TIMEOUT_MS };
+    if (!conn.writable && !flush(conn)) {
+        fail(conn);
+    }
+}
+
+void FastCgiClient::cancel(HttpConn *httpConn)
+{
+    auto it = mSlots.find(httpConn);
+    if (it == mSlots.end()) {
+        return;
+    }
+    Conn &conn = mConns[it->second.worker];
+    uint16_t id = it->second.id;
+    mSlots.erase(it);
+    if (conn.fd == -1) {
+        return;
+    }
+    // 还没有开始执行的请求工作进程不再执行，已经在执行的请求结束后丢弃它的输出
+    Request &request = conn.requests[id];
+    request.conn = nullptr;
+    string().swap(request.output);
+    appendRecord(conn.out, FCGI_ABORT_REQUEST, id, nullptr, 0);
+    if (!conn.writable && !flush(conn)) {
+        fail(conn);
+    }
+}
+
+int64_t FastCgiClient::deadline(HttpConn *httpConn) const
+{
+    auto it = mSlots.find(httpConn);
+    return it == mSlots.end() ? -1 : it->second.deadline;
+}
+
+bool FastCgiClient::onEvent(int fd, uint32_t serial, bool readable, bool writable)
+{
+    for (Conn &conn : mConns) {
+        if (conn.fd != fd || conn.serial != serial) {
+            continue;
+        }
+        if (writable && conn.writable) {
+            // io_uring的poll是单次的，还没写完时flush重新等待可写
+            conn.writable = false;
+            if (!flush(conn)) {
+                fail(conn);
+                return false;
+            }
+            if (!conn.writable) {
+                mListener->watchFastCgi(conn.fd, conn.serial, false, false);
+            }
+        }
+        if (readable && !readRecords(conn)) {
+            fail(conn);
+        }
+        // 通知的过程中连接可能已经关闭
+        return conn.fd == fd && conn.serial == serial;
+    }
+    return false;
+}
+
+bool FastCgiClient::flush(Conn &conn)
+{
+    while (conn.outOffset < conn.out.size()) {
+        ssize_t n = ::send(conn.fd, conn.out.data() + conn.outOffset, conn.out.size() - conn.outOffset, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                if (!conn.writable) {
+                    conn.writable = true;
+                    mListener->watchFastCgi(conn.fd, conn.serial, false, true);
+                }
+                return true;
+            }
+            return false;
+        }
+        conn.outOffset += n;
+    }
+    conn.out.clear();
+    conn.outOffset = 0;
+    return true;
+}
+
+bool FastCgiClient::readRecords(Conn &conn)
+{
+    char buf[16384];
+    while (true) {
+        ssize_t n = ::read(conn.fd, buf, sizeof(buf));
+        if (n > 0) {
+            conn.in.append(buf, n);
+            if (n < (ssize_t)sizeof(buf)) {
+                break;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        // 工作进程退出了
+        return false;
+    }
+
+    // 取出所有完整的记录，不完整的留到下次
+    size_t pos = 0;
+    while (conn.in.size() - pos >= FCGI_HEADER_LEN) {
+        const unsigned char *header = (const unsigned char*)conn.in.data() + pos;
+        if (header[0] != FCGI_VERSION_1) {
+            LOG_ERROR("%s", "Invalid FastCGI record.");
+            return false;
+        }
+        size_t contentLen = (header[4] << 8) | header[5];
+        size_t recordLen = FCGI_HEADER_LEN + contentLen + header[6];
+        if (conn.in.size() - pos < recordLen) {
+            break;
+        }
+        int type = header[1];
+        uint16_t id = (header[2] << 8) | header[3];
+        const char *content = conn.in.data() + pos + FCGI_HEADER_LEN;
+        pos += recordLen;
+        auto it = conn.requests.find(id);
+        if (it == conn.requests.end()) {
+            continue;
+        }
+        if (type == FCGI_STDOUT && it->second.conn) {
+            it->second.output.append(content, contentLen);
+        }
+        else if (type == FCGI_STDERR) {
+            LOG_WARN("cgi stderr: %.*s", (int)contentLen, content);
+        }
+        else if (type == FCGI_END_REQUEST) {
+            uint32_t serial = conn.serial;
+            finish(conn, it, contentLen >= 5 && (unsigned char)content[4] == FCGI_REQUEST_COMPLETE);
+            if (conn.fd == -1 || conn.serial != serial) {
+                // 通知的过程中连接出错关闭了（取消其他请求时写失败）
+                return true;
+            }
+        }
+    }
+    conn.in.erase(0, pos);
+    return true;
+}
+
+void FastCgiClient::finish(Conn &conn, unordered_map<uint16_t, Request>::iterator it, bool ok)
+{
+    Request request = std::move(it->second);
+    conn.requests.erase(it);
+    if (request.conn) {
+        mSlots.erase(request.conn);
+        mListener->onFastCgiDone(request.conn, request.generation, ok, request.output);
+    }
+}
+
+void FastCgiClient::checkWorkers()
+{
+    // 工作进程推迟重新启动期间，它监听队列中的连接没有进程接受，不等到每个请求超时
+    FastCgiPool *pool = FastCgiPool::getInstance();
+    for (size_t i = 0; i < mConns.size(); ++i) {
+        if (mConns[i].fd != -1 && !pool->alive(i)) {
+            fail(mConns[i]);
+        }
+    }
+}
+
+void FastCgiClient::fail(Conn &conn)
+{
+    mListener->unwatchFastCgi(conn.fd, conn.serial);
+    close(conn.fd);
+    conn.fd = -1;
+    string().swap(conn.in);
+    string().swap(conn.out);
+    conn.outOffset = 0;
+    conn.writable = false;
+    // 先从连接上取下所有请求，通知的过程中Reactor可能关闭其他连接（cancel）
+    unordered_map<uint16_t, Request> requests;
+    requests.swap(conn.requests);
+    LOG_ERROR("FastCGI connection to worker %d failed, %zu requests aborted.", (int)(&conn - &mConns[0]), requests.size());
+    for (auto &it : requests) {
+        if (it.second.conn) {
+            mSlots.erase(it.second.conn);
+        }
+    }
+    for (auto &it : requests) {
+        Request &request = it.second;
+        if (request.conn) {
+            string output;
+            mListener->onFastCgiDone(request.conn, request.generation, false, output);
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef FCGI_H
+#define FCGI_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <sys/types.h>
+#include "../thread/locker.h"
+#include "../log/log.h"
+#include "../common.h"
+
+class HttpConn;
+
+// FastCGI协议（只用到responder角色）的记录类型和常量
+enum {
+    FCGI_BEGIN_REQUEST = 1,
+    FCGI_ABORT_REQUEST = 2,
+    FCGI_END_REQUEST = 3,
+    FCGI_PARAMS = 4,
+    FCGI_STDIN = 5,
+    FCGI_STDOUT = 6,
+    FCGI_STDERR = 7
+};
+
+// CGI程序交给常驻的FastCGI工作进程执行，代替每个请求fork+exec一个解释器
+// 服务器启动时为每个工作进程创建一个Unix域监听socket，用posix_spawn启动工作进程，按FastCGI的约定把监听socket作为它的标准输入
+// 每个Reactor到每个工作进程保持一条长连接（FastCgiClient），请求按请求ID复用在连接上（FCGI_MPXS_CONNS），工作进程并发执行
+// 工作进程退出后由主Reactor在收到SIGCHLD时重新启动（reapWorkers），监听socket不变，连接断开的Reactor下次使用时重新连接；
+// 启动失败或者刚启动就退出的工作进程推迟重新启动（respawnWorkers），期间请求不交给它
+class FastCgiPool {
+public:
+    static const int IO_TIMEOUT_MS = 30000; // 等待工作进程响应的超时时间，超时的请求返回500
+    static const int RESPAWN_DELAY_MS = 1000; // 运行不到这么久就退出（或者启动失败）的工作进程推迟这么久再启动，连续失败时每次翻倍
+    static const int MAX_RESPAWN_DELAY_MS = 60000;
+
+    static FastCgiPool *getInstance();
+
+    // workers为工作进程数量，0表示不使用（仍然每个请求fork+exec），adapter为工作进程的可执行文件
+    void init(int workers, const std::string &adapter);
+    bool enabled() const { return mWorkers > 0; }
+    int workers() const { return mWorkers; }
+    int connectWorker(int index); // 连接第index个工作进程的监听socket，返回非阻塞的socket，失败返回-1
+    bool alive(int index) const { return mProcs[index].pid.load() > 0; } // 有正在运行的进程，可以把请求交给它
+    void reapWorkers(); // 回收退出的工作进程并重新启动，收到SIGCHLD时调用
+    void respawnWorkers(); // 启动推迟时间已到的工作进程，由主Reactor定时调用
+    void stop(); // 结束所有工作进程
+
+private:
+    FastCgiPool();
+    ~FastCgiPool();
+
+    struct Proc {
+        std::atomic<pid_t> pid{-1}; // 为-1时没有正在运行的进程，Reactor线程也会读
+        int64_t started = 0; // 启动的时间
+        int64_t retryAt = 0; // 推迟启动时下一次启动的时间，0表示没有推迟
+        int delay = 0; // 上一次推迟的时间
+    };
+
+    pid_t spawnWorker(int index);
+    void startWorker(int index, int64_t now); // 启动失败时推迟重试
+    void delayWorker(int index, int64_t now);
+
+    int mWorkers;
+    std::string mAdapter;
+    std::vector<std::string> mSocketPaths; // 抽象命名空间的地址，不在文件系统中留下文件
+    std::vector<int> mListenFds;
+    std::vector<Proc> mProcs; // 按工作进程下标，只在持有lock时修改
+    Locker lock;
+};
+
+// FastCGI连接上的事件由所属的Reactor等待，请求结束（或者失败）时通知它
+class FastCgiListener {
+public:
+    virtual ~FastCgiListener() {}
+    // 等待fd可读，writable为true时同时等待可写；add表示新的连接
+    virtual void watchFastCgi(int fd, uint32_t serial, bool add, bool writable) = 0;
+    virtual void unwatchFastCgi(int fd, uint32_t serial) = 0; // 连接关闭之前调用
+    // 请求结束，ok为false时请求失败（工作进程退出、超时），成功时output为脚本的标准输出
+    virtual void onFastCgiDone(HttpConn *conn, uint32_t generation, bool ok, std::string &output) = 0;
+};
+
+// 一个Reactor到所有FastCGI工作进程的连接，只在Reactor线程中使用，不需要加锁
+// 新的请求交给正在执行的请求最少的工作进程；请求ID在每条连接上分配，连接上的输出按请求ID分给各个请求
+class FastCgiClient {
+public:
+    explicit FastCgiClient(FastCgiListener *listener);
+    ~FastCgiClient();
+
+    // 提交一个请求：params为CGI环境变量，input为标准输入（请求体），结果（包括连接失败）都通过onFastCgiDone通知
+    void submit(HttpConn *conn, uint32_t generation, const std::vector<std::pair<std::string, std::string>> &params,
+                const std::string &input, int64_t now);
+    void cancel(HttpConn *conn); // 连接关闭了，不再需要结果
+    int64_t deadline(HttpConn *conn) const; // 请求的超时时间，没有请求时返回-1
+    bool onEvent(int fd, uint32_t serial, bool readable, bool writable); // 返回连接是否还打开着
+    void checkWorkers(); // 关闭到没有在运行的工作进程的连接，留在它监听队列中的请求失败，由Reactor定时调用
+
+private:
+    struct Request {
+        HttpConn *conn; // 为nullptr时请求已经取消，等END_REQUEST之后才能释放请求ID
+        uint32_t generation;
+        std::string output;
+    };
+    struct Conn {
+        int fd = -1;
+        uint32_t serial = 0; // 每次连接不同，Reactor用它识别已经关闭的连接遗留的事件
+        std::string in;
+        std::string out; // 还没有写出去的记录
+        size_t outOffset = 0;
+        bool writable = false; // 正在等待可写
+        uint16_t nextId = 0;
+        std::unordered_map<uint16_t, Request> requests;
+    };
+    struct Slot {
+        int worker;
+        uint16_t id;
+        int64_t deadline;
+    };
+
+    bool open(Conn &conn, int index);
+    bool flush(Conn &conn);
+    bool readRecords(Conn &conn);
+    void fail(Conn &conn); // 连接出错，关闭连接，上面的请求都失败
+    void finish(Conn &conn, std::unordered_map<uint16_t, Request>::iterator it, bool ok);
+
+    FastCgiListener *mListener;
+    std::vector<Conn> mConns; // 按工作进程下标
+    std::unordered_map<HttpConn*, Slot> mSlots; // 每个等待结果的HTTP连接的请求
+    unsigned mNext; // 下一次选择工作进程的起点
+    uint32_t mSerial;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "cgi_process.h"
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <unordered_set>
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include "../thread/locker.h"
+#include "../utils/utils.h"
+
+using namespace std;
+
+// 还没有回收的子进程，SIGCHLD由主Reactor通过signalfd读取后统一回收
+static Locker childLock;
+static unordered_set<pid_t> children;
+static atomic<uint32_t> serialCount(0);
+
+extern char **environ;
+
+// 子进程的环境：服务器自己的环境变量（PATH等）加上CGI变量，同名时使用CGI变量
+// 不修改服务器的environ（putenv在多线程中不安全），只组织一个新的指针数组，字符串仍然属于env和environ
+static vector<char*> buildEnvironment(const vector<string> &env)
+{
+    vector<char*> envp;
+    for (const string &var : env) {
+        envp.push_back(const_cast<char*>(var.c_str()));
+    }
+    for (char **p = environ; *p; ++p) {
+        const char *eq = strchr(*p, '=');
+        size_t nameLen = eq ? eq - *p + 1 : strlen(*p);
+        bool overridden = false;
+        for (const string &var : env) {
+            if (var.compare(0, nameLen, *p, nameLen) == 0) {
+                overridden = true;
+                break;
+            }
+        }
+        if (!overridden) {
+            envp.push_back(*p);
+        }
+    }
+    envp.push_back(nullptr);
+    return envp;
+}
+
+CgiProcess::CgiProcess() : mPid(-1), mInFd(-1), mOutFd(-1), mInputOffset(0), mSocketInput(0), mSerial(0) {}
+
+CgiProcess::~CgiProcess()
+{
+    abort();
+}
+
+bool CgiProcess::start(const char *path, const vector<string> &env, const string &input, size_t socketInput)
+{
+    // fd[0]: 读管道，fd[1]:写管道；父进程一端带O_CLOEXEC，不会泄漏给其他子进程
+    int cgiOutput[2];
+    int cgiInput[2];
+    if (pipe2(cgiOutput, O_CLOEXEC) < 0) {
+        return false;
+    }
+    if (pipe2(cgiInput, O_CLOEXEC) < 0) {
+        close(cgiOutput[0]);
+        close(cgiOutput[1]);
+        return false;
+    }
+    // 子进程的标准输入、标准输出换成两个管道，dup2得到的描述符不带O_CLOEXEC，exec之后只剩下这两个管道
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, cgiOutput[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, cgiInput[0], 0);
+
+    // 服务器屏蔽了SIGTERM等信号改用signalfd处理，忽略了SIGPIPE和SIGHUP，这些会被exec继承，在子进程中恢复默认
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    sigaddset(&signals, SIGHUP);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    // glibc的posix_spawn用CLONE_VM|CLONE_VFORK创建子进程，不复制页表，耗时和服务器占用的内存无关；exec失败时直接返回错误
+    vector<char*> envp = buildEnvironment(env);
+    pid_t pid;
+    char *argv[] = { const_cast<char*>(path), nullptr };
+    int ret = posix_spawn(&pid, path, &actions, &attr, argv, envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (ret != 0) {
+        errno = ret;
+        close(cgiOutput[0]);
+        close(cgiOutput[1]);
+        close(cgiInput[0]);
+        close(cgiInput[1]);
+        return false;
+    }
+
+    close(cgiOutput[1]);
+    close(cgiInput[0]);
+    setnonblocking(cgiOutput[0]);
+    setnonblocking(cgiInput[1]);
+    // 子进程可能在加入之前就已经退出，它的SIGCHLD已经处理过了，这里直接回收
+    childLock.lock();
+    if (waitpid(pid, nullptr, WNOHANG) != pid) {
+        children.insert(pid);
+    }
+    childLock.unlock();
+
+    mPid = pid;
+    mOutFd = cgiOutput[0];
+    mInFd = cgiInput[1];
+    mInput = input;
+    mInputOffset = 0;
+    mSocketInput = socketInput;
+    uint32_t serial;
+    do {
+        serial = ++serialCount & 0xffffff;
+    } while (serial == 0);
+    mSerial.store(serial, std::memory_order_release);
+
+    // 请求体通常一次就能写进管道
+    writeInput();
+    return true;
+}
+
+CgiProcess::Input CgiProcess::writeInput(int sockfd)
+{
+    if (mInFd == -1) {
+        return INPUT_DONE;
+    }
+    while (mInputOffset < mInput.size()) {
+        ssize_t n = ::write(mInFd, mInput.data() + mInputOffset, mInput.size() - mInputOffset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return INPUT_WAIT_PIPE;
+            }
+            // 子进程不再读标准输入（EPIPE），剩下的请求体丢弃，还在socket中的部分没法丢弃
+            bool pending = mSocketInput > 0;
+            closeInput();
+            return pending ? INPUT_ERROR : INPUT_DONE;
+        }
+        mInputOffset += n;
+    }
+    while (mSocketInput > 0) {
+        if (sockfd == -1) {
+            return INPUT_WAIT_SOCKET;
+        }
+        ssize_t n = splice(sockfd, nullptr, mInFd, nullptr, mSocketInput, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            mSocketInput -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            // 两端都是非阻塞的，socket中还有数据说明是管道满了
+            int available = 0;
+            ioctl(sockfd, FIONREAD, &available);
+            return available > 0 ? INPUT_WAIT_PIPE : INPUT_WAIT_SOCKET;
+        }
+        closeInput(); // 客户端关闭了连接，或者子进程不再读标准输入
+        return INPUT_ERROR;
+    }
+    // 关闭写端，子进程读到文件结束
+    closeInput();
+    return INPUT_DONE;
+}
+
+CgiProcess::Output CgiProcess::readOutput(Buffer &buffer, size_t limit)
+{
+    size_t total = 0;
+    while (total < limit) {
+        int readErrno = 0;
+        ssize_t n = buffer.readFd(mOutFd, &readErrno);
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n < 0 && readErrno == EINTR) {
+            continue;
+        }
+        if (n < 0 && readErrno == EAGAIN) {
+            return OUTPUT_AGAIN;
+        }
+        return OUTPUT_EOF; // 子进程关闭了标准输出（通常是已经退出），读出错也当作结束
+    }
+    return OUTPUT_AGAIN;
+}
+
+size_t CgiProcess::outputAvailable() const
+{
+    int available = 0;
+    if (mOutFd == -1 || ioctl(mOutFd, FIONREAD, &available) == -1) {
+        return 0;
+    }
+    return available;
+}
+
+void CgiProcess::closeInput()
+{
+    if (mInFd != -1) {
+        close(mInFd);
+        mInFd = -1;
+    }
+    string().swap(mInput);
+    mInputOffset = 0;
+    mSocketInput = 0;
+}
+
+void CgiProcess::finish()
+{
+    // 关闭描述符时epoll中的注册也随之删除
+    mSerial.store(0, std::memory_order_release);
+    closeInput();
+    if (mOutFd != -1) {
+        close(mOutFd);
+        mOutFd = -1;
+    }
+    mPid = -1;
+}
+
+void CgiProcess::abort()
+{
+    if (mPid != -1) {
+        // 还没有回收的子进程pid不会被复用，可以安全地发信号
+        childLock.lock();
+        if (children.count(mPid)) {
+            kill(mPid, SIGTERM);
+        }
+        childLock.unlock();
+    }
+    finish();
+}
+
+void CgiProcess::reapChildren()
+{
+    childLock.lock();
+    for (auto it = children.begin(); it != children.end();) {
+        pid_t ret = waitpid(*it, nullptr, WNOHANG);
+        if (ret == *it || (ret == -1 && errno == ECHILD)) {
+            it = children.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    childLock.unlock();
+}
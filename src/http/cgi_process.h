@@ -0,0 +1,55 @@
+#ifndef CGI_PROCESS_H
+#define CGI_PROCESS_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include "../buffer/buffer.h"
+
+// 一个CGI子进程，以及连接到它的标准输入、标准输出的两个非阻塞管道
+// 子进程在工作线程中启动，之后管道作为事件源交给连接所属的Reactor：请求体在标准输入可写时写入，
+// 输出在标准输出可读时读出并转发给客户端，工作线程不会因为慢的脚本阻塞
+// 子进程退出后由主Reactor在收到SIGCHLD时回收（reapChildren），不需要任何线程等待
+// 子进程用posix_spawn启动（vfork方式，不复制服务器的页表），环境变量直接传给子进程，不修改服务器自己的environ
+// 请求体还没有收完时，剩下的部分用splice从socket直接移到标准输入的管道，不经过用户态
+class CgiProcess {
+public:
+    enum Output { OUTPUT_AGAIN, OUTPUT_EOF };
+    // INPUT_WAIT_PIPE: 等待管道可写；INPUT_WAIT_SOCKET: 等待socket中的请求体；INPUT_ERROR: 请求体没有全部从socket中取走
+    enum Input { INPUT_DONE, INPUT_WAIT_PIPE, INPUT_WAIT_SOCKET, INPUT_ERROR };
+
+    CgiProcess();
+    ~CgiProcess();
+
+    // 执行path，env中是"名字=值"形式的环境变量，input写入子进程的标准输入，管道写不下的部分留到可写时再写
+    // socketInput是input之后还要从socket中转给子进程的请求体字节数
+    bool start(const char *path, const std::vector<std::string> &env, const std::string &input, size_t socketInput = 0);
+    bool running() const { return mOutFd != -1; } // 输出还没有读完
+    bool inputPending() const { return mInFd != -1; } // 请求体还没有写完
+    int inputFd() const { return mInFd; }
+    int outputFd() const { return mOutFd; }
+    // 每个子进程不同（24位，不为0），没有子进程时为0，Reactor用它识别已经结束的子进程遗留的事件
+    uint32_t serial() const { return mSerial.load(std::memory_order_acquire); }
+    Input writeInput(int sockfd = -1); // 继续写请求体，内存中的写完后再从sockfd转移剩下的部分
+    Output readOutput(Buffer &buffer, size_t limit); // 把输出读入buffer，最多limit字节
+    size_t outputAvailable() const; // 标准输出的管道中可以读的字节数
+    void finish(); // 输出已经读完，关闭两个管道
+    void abort(); // 连接关闭了，关闭管道并终止还没有退出的子进程
+
+    static void reapChildren(); // 回收所有已经退出的子进程，收到SIGCHLD时调用
+
+private:
+    void closeInput();
+
+    pid_t mPid;
+    int mInFd; // 子进程标准输入的写端
+    int mOutFd; // 子进程标准输出的读端
+    std::string mInput;
+    size_t mInputOffset;
+    size_t mSocketInput; // 还要从socket中转移的请求体字节数
+    std::atomic<uint32_t> mSerial;
+};
+
+#endif
@@ -2,23 +2,30 @@
 
 using namespace std;
 
-int HttpConn::m_epollfd = -1;
-int HttpConn::mUserCount = 0;
+std::atomic<int> HttpConn::mUserCount(0);
 
 const char *HttpConn::OK_200_TITLE = "OK";
 const char *HttpConn::OK_200_FORM = "<html><head><meta charset=\"utf-8\"><title>200 OK</title></head><body><h2>200 OK</h2><p>Request success.</p><hr><em>MyHTTPServer v1.0</em></body></html>";
+const char *HttpConn::PARTIAL_206_TITLE = "Partial Content";
+const char *HttpConn::FOUND_302_TITLE = "Found";
+const char *HttpConn::NOT_MODIFIED_304_TITLE = "Not Modified";
 const char *HttpConn::ERROR_400_TITLE = "Bad Request";
 const char *HttpConn::ERROR_400_FORM = "<html><head><meta charset=\"utf-8\"><title>400 Bad Request</title></head><body><h2>400 Bad Request</h2><p>Your request has bad syntax or is inherently impossible to satisfy.</p><hr><em>MyHTTPServer v1.0</em></body></html>";
 const char *HttpConn::ERROR_403_TITLE = "Forbidden";
 const char *HttpConn::ERROR_403_FORM = "<html><head><meta charset=\"utf-8\"><title>403 Forbidden</title></head><body><h2>403 Forbidden</h2><p>You do not have permission to get file from this server.</p><hr><em>MyHTTPServer v1.0</em></body></html>";
 const char *HttpConn::ERROR_404_TITLE = "Not Found";
 const char *HttpConn::ERROR_404_FORM = "<html><head><meta charset=\"utf-8\"><title>404 Not Found</title></head><body><h2>404 Not Found</h2><p>The requested file was not found on this server.</p><hr><em>MyHTTPServer v1.0</em></body></html>";
+const char *HttpConn::ERROR_416_TITLE = "Range Not Satisfiable";
+const char *HttpConn::ERROR_416_FORM = "<html><head><meta charset=\"utf-8\"><title>416 Range Not Satisfiable</title></head><body><h2>416 Range Not Satisfiable</h2><p>None of the requested ranges overlap the file.</p><hr><em>MyHTTPServer v1.0</em></body></html>";
 const char *HttpConn::ERROR_500_TITLE = "Internal Error";
 const char *HttpConn::ERROR_500_FORM = "<html><head><meta charset=\"utf-8\"><title>500 Internal Error</title></head><body><h2>500 Internal Error</h2><p>There was an unusual problem serving the requested file.</p><hr><em>MyHTTPServer v1.0</em></body></html>";
 
+const char *HttpConn::UPLOAD_URL = "/upload";
 const char *HttpConn::TYPE_BIN = "application/octet-stream";
 
 string HttpConn::docRoot = "./resources";
+long HttpConn::sendfileThreshold = 65536;
+vector<pair<string, string>> HttpConn::cacheControl;
 
 const unordered_map<string, string> HttpConn::SUFFIX_TYPE = {
     { ".html",  "text/html" },
@@ -48,13 +55,26 @@ const unordered_map<string, string> HttpConn::SUFFIX_TYPE = {
 
 std::unordered_map<std::string, std::string> HttpConn::mUsers;
 
-HttpConn::HttpConn() {}
+HttpConn::HttpConn() : m_sockfd(-1), m_epollfd(-1), mGeneration(0), mListener(nullptr), mUring(false), mWorkerRef(0), mLastWorker(-1), mBatchLinger(false),
+                       mFileAddress(nullptr), mFileFd(-1), mFileOffset(0), mFileRemain(0), mSpliceFd(-1), mSpliceRemain(0),
+                       m_iv_Count(0), mResponseStart(0), mIovIndex(0), mIovBytes(0),
+                       mCgiStarted(false), mCgiRelayBody(false), mCgiChunkOpen(false), mCgiStatus(200),
+                       mCgiParked(false), mCgiMayPark(false), mFcgiPending(false), mFcgiDone(false), mFcgiOk(false) {}
 
 HttpConn::~HttpConn() {}
 
-void HttpConn::init(int sockfd, const sockaddr_in &addr)
+void HttpConn::init(int sockfd, const sockaddr_in &addr, int epollfd, ConnListener *listener, bool uring)
 {
     m_sockfd = sockfd;
+    m_epollfd = epollfd;
+    mListener = listener;
+    mUring = uring;
+    mWorkerRef = 0;
+    mCgiParked = false;
+    mFcgiPending = false;
+    mFcgiDone = false;
+    mGeneration++; // 对象被新连接复用，旧连接遗留的epoll事件都会被忽略
+    mLastWorker = -1;
     m_address = addr;
     // 设置端口复用
     // 端口复用一定要在绑定前设置
@@ -64,28 +84,58 @@ void HttpConn::init(int sockfd, const sockaddr_in &addr)
         exit(SET_REUSE_PORT_ERROR);
     }
 
-    // 添加到epoll对象中
-    addfd(m_epollfd, sockfd, true, true);
+    // 添加到epoll对象中，io_uring模式下由Reactor提交recv请求
+    if (!mUring) {
+        addfd(m_epollfd, sockfd, true, true, mGeneration);
+    }
     mUserCount++; // 总用户数+1
 
+    // 对象是复用的，清掉上一个连接没有处理完的数据
+    unmap();
+    readBuffer.retrieveAll();
+    readBuffer.resetReadSize();
+    writeBuffer.retrieveAll();
+    cgiBuffer.retrieveAll();
+    m_iv[0].iov_len = m_iv[1].iov_len = 0;
+    m_iv_Count = 0;
+    mIov.clear();
+    mIovIndex = 0;
+    mIovBytes = 0;
+    mBatchLinger = false;
+
     initInfos();
 }
 
-void HttpConn::closeConn()
+void HttpConn::closeConn(bool closeFd)
 {
     if (m_sockfd != -1) {
-        removefd(m_epollfd, m_sockfd);
+        if (!mUring) {
+            removefd(m_epollfd, m_sockfd);
+        }
+        else if (closeFd) {
+            close(m_sockfd);
+        }
         m_sockfd = -1;
+        unmap();
+        mUpload.reset(); // 上传到一半连接就关闭了，删除没有写完的文件
+        mCgi.abort(); // CGI脚本还没有运行完，不再需要它的输出
+        mFcgiPending = false; // FastCGI的请求已经由Reactor取消
+        mFcgiDone = false;
+        releaseCgiCache(true);
+        readBuffer.retrieveAll();
+        shrink(); // 对象留在连接表中等待复用，缓冲区先还回去
         mUserCount--; // 关闭一个连接，客户总数量-1
     }
 }
 
-// 循环读取用户数据，直到无数据可读或者对方关闭连接
+// 循环读取用户数据，直到无数据可读、对方关闭连接或者这一次已经读了READ_BUFFER_SIZE字节
+// 没有读完的数据在重新等待读时（EPOLL_CTL_MOD）会再次触发EPOLLIN
 bool HttpConn::read()
 {
     // 读取到的字节
     int bytesRead = 0;
-    while (true) {
+    int total = 0;
+    while (total < READ_BUFFER_SIZE) {
         int readErrno = 0;
         bytesRead = readBuffer.readFd(m_sockfd, &readErrno);
         if (bytesRead == -1) {
@@ -99,77 +149,170 @@ bool HttpConn::read()
             return false;
         }
         mReadIndex += bytesRead;
+        total += bytesRead;
     }
     return true;
 }
 
+void HttpConn::appendRead(const char *data, size_t len)
+{
+    readBuffer.append(data, len);
+    mReadIndex += len;
+}
+
+void HttpConn::rearm(int ev)
+{
+    if (mUring) {
+        mListener->onRearm(this, mGeneration, ev);
+    }
+    else if (ev == EV_CGI_INPUT) {
+        watchfd(m_epollfd, mCgi.inputFd(), EPOLLOUT, makeEpollData(m_sockfd, mCgi.serial(), EPOLL_SOURCE_CGI_INPUT));
+    }
+    else if (ev == EV_CGI_OUTPUT) {
+        watchfd(m_epollfd, mCgi.outputFd(), EPOLLIN, makeEpollData(m_sockfd, mCgi.serial(), EPOLL_SOURCE_CGI_OUTPUT));
+    }
+    else {
+        modifyfd(m_epollfd, m_sockfd, ev, mGeneration);
+    }
+}
+
 bool HttpConn::write()
 {
-    int temp = 0;
+    ssize_t temp = 0;
     
-    if (m_iv[0].iov_len + m_iv[1].iov_len == 0) {
+    if (pendingBytes() == 0) {
+        if (cgiRunning()) {
+            // CGI还没有产生可以发送的数据
+            continueCgi();
+            return true;
+        }
         // 将要发送的字节为0，这一次响应结束。
-        modifyfd(m_epollfd, m_sockfd, EPOLLIN); 
         initInfos();
+        if (!hasBufferedRequest()) {
+            shrink();
+            rearm(EPOLLIN);
+        }
         return true;
     }
 
     while (true) {
-        // 分散写
-        // 有多块内存的数据要写，一起写出去
-        temp = writev(m_sockfd, m_iv, m_iv_Count);
+        if (mFileFd != -1 && mIovBytes == 0) {
+            // 响应头已经发完，文件内容由内核直接从页缓存发送到socket，不经过用户态
+            temp = sendfile(m_sockfd, mFileFd, &mFileOffset, mFileRemain);
+            if (temp == 0) {
+                // 文件在发送过程中被截断了，已经发送的长度和Content-Length对不上，只能关闭连接
+                unmap();
+                return false;
+            }
+        }
+        else if (mSpliceFd != -1 && mIovBytes == 0) {
+            // chunk的数据直接从CGI标准输出的管道移到socket，不经过用户态
+            temp = splice(mSpliceFd, nullptr, m_sockfd, nullptr, mSpliceRemain, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (temp == 0) {
+                // 管道中的数据不会比之前看到的少，只可能是出错了
+                unmap();
+                return false;
+            }
+        }
+        else if (mFileFd != -1 || mSpliceFd != -1) {
+            // 后面紧跟着sendfile的文件内容（或splice的CGI输出），MSG_MORE让响应头和文件开头合并成一个报文
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = const_cast<struct iovec*>(getIov());
+            msg.msg_iovlen = getIovCount();
+            temp = sendmsg(m_sockfd, &msg, MSG_MORE);
+        }
+        else {
+            // 分散写
+            // 这一批的所有响应一起写出去
+            temp = writev(m_sockfd, getIov(), getIovCount());
+        }
         if (temp <= -1) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if (errno == EAGAIN) {
-                modifyfd(m_epollfd, m_sockfd, EPOLLOUT);
+                rearm(EPOLLOUT);
                 return true;
             }
             unmap();
             return false;
         }
-        mBytesToSend -= temp;
-        mBytesHaveSend += temp;
-
-        if (temp > m_iv[0].iov_len) {
-            m_iv[1].iov_base = (uint8_t*)m_iv[1].iov_base + (temp - m_iv[0].iov_len);
-            m_iv[1].iov_len -= (temp - m_iv[0].iov_len);
-            if (m_iv[0].iov_len) {
-                writeBuffer.retrieveAll();
-                m_iv[0].iov_len = 0;
+        if (onWritten(temp)) {
+            // 没有数据要发送了，读缓冲区中还有请求时由Reactor交给工作线程，不重新等待读
+            if (!finishResponse()) {
+                return false;
             }
+            if (cgiRunning()) {
+                // 继续等待CGI的输出
+                continueCgi();
+            }
+            else if (!hasBufferedRequest()) {
+                rearm(EPOLLIN);
+            }
+            return true;
         }
-        else {
-            m_iv[0].iov_base = (uint8_t*)m_iv[0].iov_base + temp;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
-            writeBuffer.retrieve(temp);
-        }
+    }
+}
 
-        if (m_iv[0].iov_len + m_iv[1].iov_len == 0) {
-            // 没有数据要发送了
-            unmap();
-            modifyfd(m_epollfd, m_sockfd, EPOLLIN);
+bool HttpConn::onWritten(size_t bytes)
+{
+    mBytesToSend -= bytes;
+    mBytesHaveSend += bytes;
 
-            if (mLinger) {
-                initInfos();
-                return true;
-            }
-            else {
-                return false;
-            }
+    if (mFileFd != -1 && mIovBytes == 0) {
+        // sendfile已经推进了mFileOffset
+        mFileRemain -= bytes;
+        return pendingBytes() == 0;
+    }
+    if (mSpliceFd != -1 && mIovBytes == 0) {
+        mSpliceRemain -= bytes;
+        return pendingBytes() == 0;
+    }
+    // 跳过已经写完的内存块，写了一部分的内存块从写到的位置继续
+    mIovBytes -= bytes;
+    while (bytes > 0 && bytes >= mIov[mIovIndex].iov_len) {
+        bytes -= mIov[mIovIndex].iov_len;
+        mIovIndex++;
+    }
+    if (bytes > 0) {
+        mIov[mIovIndex].iov_base = (uint8_t*)mIov[mIovIndex].iov_base + bytes;
+        mIov[mIovIndex].iov_len -= bytes;
+    }
+    return pendingBytes() == 0;
+}
+
+bool HttpConn::finishResponse()
+{
+    unmap();
+    writeBuffer.retrieveAll();
+    mIov.clear();
+    mIovIndex = 0;
+    mIovBytes = 0;
+    if (cgiRunning()) {
+        // CGI的输出还没有发送完，生成后面的数据还要用到这个请求的信息
+        return true;
+    }
+    if (mUpload.active()) {
+        // 后面的上传请求正在接收请求体，不能清掉它的状态
+        return mBatchLinger;
+    }
+    if (mBatchLinger) {
+        initInfos();
+        if (!hasBufferedRequest()) {
+            shrink();
         }
+        return true;
     }
+    return false;
 }
 
 void HttpConn::initInfos()
 {
-    mysql.setConn(nullptr);
-    redis.setConn(nullptr);
+    mysql.release();
+    redis.release();
     mBytesHaveSend = 0;
     mBytesToSend = 0;
-    mCheckState = CHECK_STATE_REQUESTLINE; // 初始化状态为解析请求首行
-    mCheckedIndex = 0;
-    mStartLine = 0;
+    mParser.reset(); // 开始解析下一个请求
     mReadIndex = 0;
     mWriteIndex = 0;
     mUrl = "";
@@ -178,21 +321,520 @@ void HttpConn::initInfos()
     mHost = "";
     mContentType = "";
     mCookie = "";
+    mRange.clear();
+    mIfRange.clear();
+    mIfNoneMatch.clear();
+    mIfModifiedSince.clear();
+    mRanges.clear();
+    mUpload.reset();
+    mUploadRemain = 0;
     mMethod = GET;
     memset(mRealFile, 0, FILENAME_LENGTH);
     mLinger = false;
     cgi = 0;
     mMimeType = TYPE_BIN;
     mCgiLen = 0;
+    mCgiStarted = false;
+    mCgiRelayBody = false;
+    mCgiChunkOpen = false;
+    mCgiHeaders.clear();
+    mCgiStatus = 200;
+    mCgiStatusTitle = OK_200_TITLE;
     mFileAddress = nullptr;
 }
 
+// 容量超过limit时释放，小的留着给下一个请求用
+template <typename T>
+static void shrinkIfLarge(T &container, size_t limit)
+{
+    if (container.capacity() > limit) {
+        T().swap(container);
+    }
+}
+
+void HttpConn::shrink()
+{
+    writeBuffer.release();
+    cgiBuffer.release();
+    mParser.shrink();
+    shrinkIfLarge(mQueryString, SHRINK_STRING_LIMIT);
+    shrinkIfLarge(mCookie, SHRINK_STRING_LIMIT);
+    shrinkIfLarge(mUrl, SHRINK_STRING_LIMIT);
+    shrinkIfLarge(mIfNoneMatch, SHRINK_STRING_LIMIT);
+    shrinkIfLarge(mCgiHeaders, SHRINK_STRING_LIMIT);
+    shrinkIfLarge(mCgiCacheBody, 0);
+    shrinkIfLarge(mIov, SHRINK_VECTOR_LIMIT);
+    shrinkIfLarge(mHeldFiles, SHRINK_VECTOR_LIMIT);
+    shrinkIfLarge(mHeldResponses, SHRINK_VECTOR_LIMIT);
+    shrinkIfLarge(mRanges, SHRINK_VECTOR_LIMIT);
+}
+
 void HttpConn::unmap()
 {
-    if (mFileAddress) {
+    if (mFileAddress && (!mFile || mFileAddress != mFile->data)) {
         munmap(mFileAddress, mFileStat.st_size);
-        mFileAddress = nullptr;
     }
+    mFileAddress = nullptr;
+    mFileFd = -1;
+    mFileOffset = 0;
+    mFileRemain = 0;
+    mSpliceFd = -1;
+    mSpliceRemain = 0;
+    mFile.reset();
+    mResponse.reset();
+    mHeldFiles.clear();
+    mHeldResponses.clear();
+}
+
+bool HttpConn::statFile()
+{
+    mFile = FileCache::getInstance()->lookup(mRealFile);
+    if (!mFile) {
+        return false;
+    }
+    mFileStat = mFile->st;
+    return true;
+}
+
+bool HttpConn::openFile()
+{
+    // 按实际发送的文件确定类型（请求目录时发送的是其中的index.html）
+    mMimeType = mFile->mimeType;
+    if (mFileStat.st_size == 0) {
+        // 空文件不需要映射，processWrite会返回默认页面
+        return true;
+    }
+    if (mFile->fd == -1) {
+        return false;
+    }
+    // io_uring没有sendfile请求，这种模式下始终使用mmap+writev
+    if (!mUring && sendfileThreshold >= 0 && mFileStat.st_size >= sendfileThreshold) {
+        // 大文件用sendfile：不用建立和拆除页表映射，也不需要把数据拷贝到用户态
+        mFileFd = mFile->fd;
+        mFileOffset = 0;
+        return true;
+    }
+    if (mFile->data) {
+        mFileAddress = mFile->data;
+        return true;
+    }
+    // 缓存没有映射这个文件（大文件），临时映射，响应发送完后解除
+    void *address = mmap(0, mFileStat.st_size, PROT_READ, MAP_PRIVATE, mFile->fd, 0);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+    mFileAddress = (char*)address;
+    return true;
+}
+
+// fork+exec和FastCGI共用的CGI环境变量，SCRIPT_FILENAME是FastCGI工作进程用来找到脚本的
+vector<pair<string, string>> HttpConn::cgiEnvironment(string &input) const
+{
+    vector<pair<string, string>> params;
+    if (mMethod == GET || mMethod == HEAD) {
+        params.emplace_back("REQUEST_METHOD", mMethod == GET ? "GET" : "HEAD");
+        params.emplace_back("QUERY_STRING", mQueryString);
+    }
+    else if (mMethod == POST) {
+        params.emplace_back("REQUEST_METHOD", "POST");
+        params.emplace_back("CONTENT_LENGTH", to_string(mContentLength));
+        params.emplace_back("CONTENT_TYPE", mContentType);
+        input = mQueryString.substr(0, mContentLength);
+    }
+    if (!mCookie.empty()) {
+        params.emplace_back("HTTP_COOKIE", mCookie);
+    }
+    params.emplace_back("DOCUMENT_ROOT", docRoot);
+    params.emplace_back("SCRIPT_FILENAME", mRealFile);
+    params.emplace_back("SCRIPT_NAME", mUrl);
+    params.emplace_back("GATEWAY_INTERFACE", "CGI/1.1");
+    params.emplace_back("SERVER_PROTOCOL", "HTTP/1.1");
+    return params;
+}
+
+void HttpConn::setFastCgiOutput(bool ok, const string &output)
+{
+    cgiBuffer.retrieveAll();
+    cgiBuffer.append(output.data(), output.size());
+    mFcgiOk = ok;
+    mFcgiDone = true;
+}
+
+void HttpConn::readFastCgiOutput()
+{
+    mFcgiPending = false;
+    mFcgiDone = false;
+    if (!mFcgiOk || cgiBuffer.readableBytes() == 0) {
+        LOG_ERROR("FastCGI request %s failed.", mRealFile);
+        releaseCgiCache(false);
+        queueCgiResponse(INTERNAL_ERROR);
+        return;
+    }
+    parseCgiOutput();
+    fillCgiCache(cgiBuffer.peek(), cgiBuffer.readableBytes(), true);
+    queueCgiResponse(CGI_REQUEST);
+}
+
+HttpConn::HTTP_CODE HttpConn::startCgi()
+{
+    string input;
+    vector<string> env;
+    for (const auto &param : cgiEnvironment(input)) {
+        env.push_back(param.first + "=" + param.second);
+    }
+    // 转发请求体时input只是已经收到的部分
+    size_t socketInput = mCgiRelayBody ? mContentLength - input.size() : 0;
+    if (!mCgi.start(mRealFile, env, input, socketInput)) {
+        perror("posix_spawn");
+        LOG_ERROR("Start CGI %s failed.", mRealFile);
+        releaseCgiCache(false);
+        return INTERNAL_ERROR;
+    }
+    mQueryString.clear();
+    cgiBuffer.retrieveAll();
+    mCgiStarted = false;
+    mCgiLen = 0;
+    return CGI_STREAM;
+}
+
+// CGI输出是否以响应头开始：第一行是Content-Type、Cache-Control或Expires，输出还不够长时只比较已有的部分
+static bool cgiHeaderStart(const char *p, size_t len)
+{
+    static const char *names[] = { "Content-Type:", "Status:", "Location:", "Cache-Control:", "Expires:" };
+    for (const char *name : names) {
+        if (strncasecmp(p, name, min(len, strlen(name))) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HttpConn::cgiHeaderReady(bool eof) const
+{
+    const char *p = cgiBuffer.peek();
+    size_t len = cgiBuffer.readableBytes();
+    if (eof || len >= CGI_HEADER_LIMIT) {
+        return true;
+    }
+    // 开头不是响应头就没有要解析的，否则要等到响应头后面的空行
+    if (!cgiHeaderStart(p, len)) {
+        return true;
+    }
+    const char *end = p + len;
+    for (const char *q = p; (q = (const char*)memchr(q, '\n', end - q)) != nullptr; ++q) {
+        if ((q + 1 < end && q[1] == '\n') || (q + 2 < end && q[1] == '\r' && q[2] == '\n')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpConn::parseCgiOutput()
+{
+    // 取出开头的响应头：Content-Type作为响应的类型，Status作为响应的状态行，只有Location没有Status时返回302，
+    // 其他的（Location、Cache-Control、Expires等）原样转发，由服务器生成的Content-Length、Transfer-Encoding、Connection不转发
+    mCgiHeaders.clear();
+    mCgiStatus = 200;
+    mCgiStatusTitle = OK_200_TITLE;
+    bool hasStatus = false, hasLocation = false;
+    const char *p = cgiBuffer.peek();
+    size_t len = cgiBuffer.readableBytes();
+    if (len > 0 && cgiHeaderStart(p, len)) {
+        size_t pos = 0;
+        while (pos < len) {
+            const char *newline = (const char*)memchr(p + pos, '\n', len - pos);
+            size_t lineEnd = newline ? newline - p : len;
+            size_t next = newline ? lineEnd + 1 : len;
+            if (lineEnd > pos && p[lineEnd - 1] == '\r')
+                lineEnd--;
+            if (lineEnd == pos) {
+                pos = next; // 空行，响应头结束
+                break;
+            }
+            const char *colon = (const char*)memchr(p + pos, ':', lineEnd - pos);
+            if (colon) {
+                size_t nameLen = colon - (p + pos);
+                size_t i = colon - p + 1;
+                while (i < lineEnd && p[i] == ' ')
+                    i++;
+                if (nameLen == 12 && strncasecmp(p + pos, "Content-Type", 12) == 0) {
+                    mMimeType.assign(p + i, lineEnd - i);
+                }
+                else if (nameLen == 6 && strncasecmp(p + pos, "Status", 6) == 0) {
+                    // 格式为“Status: 404 Not Found”，状态码不合法时忽略这一行
+                    int status = 0;
+                    size_t j = i;
+                    while (j < lineEnd && j < i + 3 && isdigit((unsigned char)p[j]))
+                        status = status * 10 + (p[j++] - '0');
+                    if (j == i + 3 && status >= 100 && status <= 599 && (j == lineEnd || p[j] == ' ')) {
+                        while (j < lineEnd && p[j] == ' ')
+                            j++;
+                        mCgiStatus = status;
+                        mCgiStatusTitle.assign(p + j, lineEnd - j);
+                        hasStatus = true;
+                    }
+                }
+                else if (!(nameLen == 14 && strncasecmp(p + pos, "Content-Length", 14) == 0) &&
+                         !(nameLen == 17 && strncasecmp(p + pos, "Transfer-Encoding", 17) == 0) &&
+                         !(nameLen == 10 && strncasecmp(p + pos, "Connection", 10) == 0)) {
+                    if (nameLen == 8 && strncasecmp(p + pos, "Location", 8) == 0) {
+                        hasLocation = true;
+                    }
+                    mCgiHeaders.append(p + pos, lineEnd - pos);
+                    mCgiHeaders += "\r\n";
+                }
+            }
+            pos = next;
+        }
+        cgiBuffer.retrieve(pos);
+        if (hasLocation && !hasStatus) {
+            mCgiStatus = 302;
+            mCgiStatusTitle = FOUND_302_TITLE;
+        }
+    }
+    mCgiLen = cgiBuffer.readableBytes();
+}
+
+// 由Reactor在CGI标准输出可读（或者子进程关闭了标准输出）时调用，这时上一次生成的数据已经发送完毕
+// 输出一次就读完时生成带Content-Length的完整响应，否则先发送响应头，之后每次读到的输出作为一个chunk发送
+void HttpConn::readCgiOutput()
+{
+    writeBuffer.retrieveAll();
+    mIov.clear();
+    mIovIndex = 0;
+    mIovBytes = 0;
+    mResponseStart = 0;
+
+    // 响应头已经发送之后，管道中的输出用splice直接发送（io_uring模式下没有对应的请求，仍然读出来发送）
+    // 管道中没有数据时可能是子进程关闭了标准输出，用read确认
+    size_t spliceLen = 0;
+    // 要放入缓存的输出需要经过用户态，不使用splice
+    if (mCgiStarted && mMethod != HEAD && !mUring && mCgiCacheKey.empty()) {
+        spliceLen = mCgi.outputAvailable();
+    }
+    bool eof = false;
+    if (spliceLen == 0) {
+        eof = mCgi.readOutput(cgiBuffer, READ_BUFFER_SIZE) == CgiProcess::OUTPUT_EOF;
+        if (eof) {
+            mCgi.finish();
+        }
+    }
+    if (!mCgiStarted) {
+        if (!cgiHeaderReady(eof)) {
+            return;
+        }
+        if (cgiBuffer.readableBytes() == 0) {
+            // 子进程没有任何输出就退出了（比如exec失败）
+            LOG_ERROR("CGI %s exited without output.", mRealFile);
+            releaseCgiCache(false);
+            queueCgiResponse(INTERNAL_ERROR);
+            return;
+        }
+        parseCgiOutput();
+        if (eof) {
+            fillCgiCache(cgiBuffer.peek(), cgiBuffer.readableBytes(), true);
+            queueCgiResponse(CGI_REQUEST);
+            return;
+        }
+        mCgiStarted = true;
+        mCgiLen = 0;
+        if (mMethod != HEAD) {
+            addStatusLine(mCgiStatus, mCgiStatusTitle.c_str());
+            if (!mCookie.empty() && cgi)
+                addCookie();
+            addResponse(mCgiHeaders);
+            addResponse("Transfer-Encoding: chunked\r\n");
+            addContentType();
+            addLinger();
+            addServerInfo();
+            addBlankLine();
+        }
+    }
+
+    size_t len = cgiBuffer.readableBytes();
+    if (mMethod == HEAD) {
+        // HEAD请求只统计输出的长度，输出结束后再生成响应头
+        mCgiLen += len;
+        cgiBuffer.retrieveAll();
+        if (eof) {
+            queueCgiResponse(CGI_REQUEST);
+        }
+        return;
+    }
+    if (mCgiChunkOpen) {
+        // 上一个chunk的数据已经全部splice到socket中了
+        addBlankLine();
+        mCgiChunkOpen = false;
+    }
+    fillCgiCache(cgiBuffer.peek(), len, eof);
+    char chunkSize[32];
+    if (len > 0) {
+        snprintf(chunkSize, sizeof(chunkSize), "%zx\r\n", len);
+        addResponse(chunkSize);
+        writeBuffer.append(cgiBuffer.peek(), len);
+        addBlankLine();
+        cgiBuffer.retrieveAll();
+    }
+    if (spliceLen > 0) {
+        // 写缓冲区中只有chunk的长度，数据在write()中从管道移到socket
+        snprintf(chunkSize, sizeof(chunkSize), "%zx\r\n", spliceLen);
+        addResponse(chunkSize);
+        mSpliceFd = mCgi.outputFd();
+        mSpliceRemain = spliceLen;
+        mCgiChunkOpen = true;
+    }
+    if (eof) {
+        addResponse("0\r\n\r\n"); // 最后一个chunk
+    }
+    setResponseIov(nullptr, 0);
+    queueResponse();
+    prepareSend();
+}
+
+void HttpConn::queueCgiResponse(HTTP_CODE ret)
+{
+    processWrite(ret);
+    cgiBuffer.retrieveAll();
+    queueResponse();
+    prepareSend();
+}
+
+void HttpConn::writeCgiInput()
+{
+    switch (mCgi.writeInput(mCgiRelayBody ? m_sockfd : -1)) {
+        case CgiProcess::INPUT_WAIT_PIPE:
+            rearm(EV_CGI_INPUT);
+            return;
+        case CgiProcess::INPUT_WAIT_SOCKET:
+            rearm(EPOLLIN);
+            return;
+        case CgiProcess::INPUT_ERROR:
+            // 请求体剩下的部分还在socket中，没法跳过，发送完响应后关闭连接
+            mLinger = false;
+            break;
+        default:
+            break;
+    }
+    if (mCgiRelayBody) {
+        // 请求体转发完了，开始读CGI的输出
+        mCgiRelayBody = false;
+        rearm(EV_CGI_OUTPUT);
+    }
+}
+
+void HttpConn::continueCgi()
+{
+    if (mFcgiPending) {
+        // FastCGI的结果还没有返回时由Reactor收到结果后生成响应
+        if (mFcgiDone) {
+            readFastCgiOutput();
+            rearm(EPOLLOUT);
+        }
+    }
+    else if (mCgiRelayBody) {
+        writeCgiInput();
+    }
+    else {
+        rearm(EV_CGI_OUTPUT);
+    }
+}
+
+HttpConn::HTTP_CODE HttpConn::cgiRequest()
+{
+    switch (lookupCgiCache()) {
+        case CgiCache::HIT:
+            return CGI_REQUEST;
+        case CgiCache::WAIT:
+            return CGI_WAIT;
+        default:
+            break;
+    }
+
+    if (FastCgiPool::getInstance()->enabled()) {
+        // 工作线程不等待工作进程，请求在processRequests()的最后交给Reactor
+        mFcgiPending = true;
+        mFcgiDone = false;
+        return FCGI_REQUEST;
+    }
+
+    return startCgi();
+}
+
+CgiCache::Result HttpConn::lookupCgiCache()
+{
+    CgiCache *cache = CgiCache::getInstance();
+    if ((mMethod != GET && mMethod != HEAD) || !cache->isEnabled()) {
+        return CgiCache::PASS;
+    }
+    // 脚本能看到的请求信息只有环境变量中的路径、查询字符串和Cookie，它们相同时输出相同
+    string key = string(mRealFile) + "?" + mQueryString + "\n" + mCookie;
+    // 挂起时由生成结果（或者放弃）的线程通知Reactor，连接关闭、对象被复用之后的通知会因为generation不同被忽略
+    CgiCache::Waiter waiter;
+    if (mCgiMayPark) {
+        ConnListener *listener = mListener;
+        uint32_t generation = mGeneration;
+        waiter = [listener, this, generation]() { listener->onRearm(this, generation, EV_RESUME); };
+    }
+    shared_ptr<const CgiResponse> cached;
+    CgiCache::Result result = cache->lookup(key, cached, mMethod == GET, waiter);
+    if (result == CgiCache::HIT) {
+        mMimeType = cached->mimeType;
+        mCgiHeaders = cached->headers;
+        mResponse = cached->body;
+        mCgiLen = mResponse->size();
+    }
+    else if (result == CgiCache::MISS) {
+        mCgiCacheKey = std::move(key);
+    }
+    return result;
+}
+
+void HttpConn::fillCgiCache(const char *data, size_t len, bool done)
+{
+    if (mCgiCacheKey.empty()) {
+        return;
+    }
+    // 只缓存200的响应，错误和重定向每次都执行脚本
+    if (mCgiStatus != 200 || mCgiCacheBody.size() + len > CgiCache::getInstance()->entryLimit()) {
+        releaseCgiCache(false);
+        return;
+    }
+    mCgiCacheBody.append(data, len);
+    if (done) {
+        shared_ptr<CgiResponse> response(new CgiResponse);
+        response->mimeType = mMimeType;
+        response->headers = mCgiHeaders;
+        response->body = make_shared<const string>(std::move(mCgiCacheBody));
+        CgiCache::getInstance()->complete(mCgiCacheKey, response);
+        mCgiCacheKey.clear();
+        mCgiCacheBody.clear();
+    }
+}
+
+void HttpConn::releaseCgiCache(bool closed)
+{
+    if (mCgiCacheKey.empty()) {
+        return;
+    }
+    if (closed) {
+        CgiCache::getInstance()->abandon(mCgiCacheKey);
+    }
+    else {
+        CgiCache::getInstance()->complete(mCgiCacheKey, nullptr);
+    }
+    mCgiCacheKey.clear();
+    string().swap(mCgiCacheBody);
+}
+
+bool HttpConn::relayCgiBody() const
+{
+    // 只用于epoll模式下fork+exec的CGI脚本；登录注册等由服务器处理的请求需要完整的请求体
+    if (mUring || FastCgiPool::getInstance()->enabled() || !mParser.method().equals("POST")) {
+        return false;
+    }
+    StrView uri = mParser.uri();
+    return !(uri.size() >= 10 && memcmp(uri.data(), "/register/", 10) == 0) &&
+           !(uri.size() >= 7 && memcmp(uri.data(), "/login/", 7) == 0);
 }
 
 HttpConn::HTTP_CODE HttpConn::doRequest() {
@@ -445,7 +1087,7 @@ HttpConn::HTTP_CODE HttpConn::doRequest() {
             len = strlen(mRealFile);
 
             // 先看看有没有对应的文件
-            if (stat(mRealFile, &mFileStat) < 0) {
+            if (!statFile()) {
                 return NO_RESOURCE; // 没有这个文件
             }
 
@@ -460,7 +1102,7 @@ HttpConn::HTTP_CODE HttpConn::doRequest() {
                 strncpy(mRealFile + len, "/index.html", FILENAME_LENGTH - len - 1);
 
                 // 先看看有没有对应的文件
-                if (stat(mRealFile, &mFileStat) < 0) {
+                if (!statFile()) {
                     return NO_RESOURCE; // 没有这个文件
                 }
 
@@ -479,128 +1121,10 @@ HttpConn::HTTP_CODE HttpConn::doRequest() {
                 }
                 cgi = 0;
                 // 否则，是GET请求，改成静态请求处理
-                // 以只读方式打开文件
-                int fd = open(mRealFile, O_RDONLY);
-                // 创建内存映射
-                mFileAddress = (char*)mmap(0, mFileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0); // 要发送的资源
-                close(fd);
-                return FILE_REQUEST;
-            }
-
-            // fd[0]: 读管道，fd[1]:写管道
-            pid_t pid;
-            int cgiOutput[2];
-            int cgiInput[2];
-            if (pipe(cgiOutput) < 0) {
-                perror("pipe");
-                LOG_ERROR("%s", "Create pipe failed.");
-                return INTERNAL_ERROR;
-            }
-            if (pipe(cgiInput) < 0) {
-                perror("pipe");
-                LOG_ERROR("%s", "Create pipe failed.");
-                return INTERNAL_ERROR;
-            }
-            if ((pid = fork()) < 0) {
-                perror("fork");
-                LOG_ERROR("%s", "Fork failed.");
-                return INTERNAL_ERROR;
-            }
-            if (pid == 0) {
-                char methEnv[255] = {0};
-                char queryEnv[255] = {0};
-                char lengthEnv[255] = {0};
-                char typeEnv[255] = {0};
-                char rootEnv[255] = {0};
-                char cookieEnv[255] = {0};
-
-                dup2(cgiOutput[1], 1);
-                dup2(cgiInput[0], 0);
-
-                close(cgiOutput[0]); // 关闭了cgiOutput中的读通道
-                close(cgiInput[1]); // 关闭了cgiInput中的写通道
-
-                if (mMethod == GET) {
-                    strcpy(methEnv, "REQUEST_METHOD=GET");
-                    putenv(methEnv);
-                    // 存储QUERY_STRING
-                    std::sprintf(queryEnv, "QUERY_STRING=%s", mQueryString.c_str());
-                    putenv(queryEnv);
-                }
-                else if (mMethod == HEAD) {
-                    strcpy(methEnv, "REQUEST_METHOD=HEAD");
-                    putenv(methEnv);
-                    // 存储QUERY_STRING
-                    std::sprintf(queryEnv, "QUERY_STRING=%s", mQueryString.c_str());
-                    putenv(queryEnv);
-                }
-                else if (mMethod == POST) {
-                    strcpy(methEnv, "REQUEST_METHOD=POST");
-                    putenv(methEnv);
-                    // 存储CONTENT_LENGTH
-                    std::sprintf(lengthEnv, "CONTENT_LENGTH=%d", mContentLength);
-                    putenv(lengthEnv);
-                    // 存储CONTENT_TYPE
-                    std::sprintf(typeEnv, "CONTENT_TYPE=%s", mContentType.c_str());
-                    putenv(typeEnv);
-                }
-                if (!mCookie.empty()) {
-                    std::sprintf(cookieEnv, "HTTP_COOKIE=%s", mCookie.c_str());
-                    putenv(cookieEnv);
-                }
-                std::sprintf(rootEnv, "DOCUMENT_ROOT=%s", docRoot.c_str());
-                putenv(rootEnv);
-
-                execl(mRealFile, mRealFile, nullptr);
+                return fileRequest();
             }
-            else
-            {
-                // 父进程关闭写端，打开读端，读取子进程的输出
-                close(cgiOutput[1]);
-                close(cgiInput[0]);
-                int ret = 0;
-                if (mMethod == POST) {
-                    // 向cgi程序标准输入中写入querystring
-                    ret = ::write(cgiInput[1], mQueryString.c_str(), mContentLength);
-                    if (ret < 0) {
-                        perror("write");
-                        LOG_ERROR("%s", "Write to pipe failed.");
-                        return INTERNAL_ERROR;
-                    }
-                }
-
-                // 读取cgi脚本返回数据
-                int currErrno = 0;
-                ret = cgiBuffer.readFd(cgiOutput[0], &currErrno);
-                if (ret <= 0) {
-                    perror("read");
-                    LOG_ERROR("%s", "Read from pipe failed.");
-                    return INTERNAL_ERROR;
-                }
-                // TODO: 严格的来说，这里还需要再解析可能出现的响应头信息，这里只处理Content-Type
-                const char *p = cgiBuffer.peek();
-                if (strncasecmp(p, "Content-Type:", 13) == 0) {
-                    int i = 13;
-                    while (p[i] == ' ' && p[i] != '\0')
-                        i++;
-                    mMimeType.clear();
-                    while (p[i] != '\n' && p[i] != '\0')
-                        mMimeType.push_back(p[i++]);
-                    if (p[i] == '\n')
-                        i += 2;
-                    cgiBuffer.retrieve(i);
-                }
-                mCgiLen = cgiBuffer.readableBytes();
 
-                // 运行结束关闭
-                close(cgiOutput[0]);
-                close(cgiInput[1]);
-
-                // 回收子进程资源
-                waitpid(pid, nullptr, 0);
-
-                return CGI_REQUEST;
-            }
+            return cgiRequest();
         }
     }
     else {
@@ -609,7 +1133,7 @@ HttpConn::HTTP_CODE HttpConn::doRequest() {
     }
 
     // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if (stat(mRealFile, &mFileStat) < 0) {
+    if (!statFile()) {
         return NO_RESOURCE; // 没有这个文件
     }
 
@@ -624,7 +1148,7 @@ HttpConn::HTTP_CODE HttpConn::doRequest() {
         strncpy(mRealFile + len, "/index.html", FILENAME_LENGTH - len - 1);
 
         // 先看看有没有对应的文件
-        if (stat(mRealFile, &mFileStat) < 0) {
+        if (!statFile()) {
             return NO_RESOURCE; // 没有这个文件
         }
 
@@ -634,65 +1158,125 @@ HttpConn::HTTP_CODE HttpConn::doRequest() {
         }
     }
 
-    // 以只读方式打开文件
-    int fd = open(mRealFile, O_RDONLY);
-    // 创建内存映射
-    mFileAddress = (char*)mmap(0, mFileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0); // 要发送的资源
-    close(fd);
-    return FILE_REQUEST;
+    return fileRequest();
 }
 
 HttpConn::HTTP_CODE HttpConn::processRead()
 {
-    LINE_STATUS lineStatus = LINE_OK;
-    HTTP_CODE ret = NO_REQUEST;
+    if (mUpload.active()) {
+        return processUpload(); // 上传请求的请求体，收到多少处理多少
+    }
+    // 从上次扫描到的位置继续解析，请求不完整时数据留在读缓冲区中，下次读到更多数据后继续
+    HttpParser::Status status = mParser.parse(readBuffer.peek(), readBuffer.readableBytes());
+    if (status == HttpParser::PARSE_ERROR) {
+        readBuffer.retrieveAll();
+        return BAD_REQUEST;
+    }
+    // 上传请求在头部完整之后就开始处理，请求体不在读缓冲区中累积
+    bool upload = mParser.headersDone() && mParser.method().equals("POST") && mParser.uri().equals(UPLOAD_URL);
+    // 请求体比一次读入的数据大的CGI请求也不在读缓冲区中累积，边收边转发给CGI
+    bool relay = !upload && status == HttpParser::PARSE_AGAIN && mParser.headersDone() && relayCgiBody();
+    if (status == HttpParser::PARSE_AGAIN && !upload && !relay) {
+        return NO_REQUEST;
+    }
 
-    // char *text = nullptr;
+    HTTP_CODE ret = parseRequestLine(mParser.method(), mParser.uri(), mParser.version());
+    if (ret == BAD_REQUEST) {
+        // 请求体可能还没有收完，这时只能取走已经收到的部分，之后关闭连接（还没有解析Connection，mLinger为false）
+        readBuffer.retrieve(min(mParser.requestSize(), readBuffer.readableBytes()));
+        return BAD_REQUEST;
+    }
+    for (size_t i = 0; i < mParser.headerCount(); ++i) {
+        parseHeader(mParser.headerName(i), mParser.headerValue(i));
+    }
+    mContentLength = mParser.contentLength();
+    if (upload) {
+        readBuffer.retrieve(mParser.headerSize());
+        return beginUpload();
+    }
+    if (relay) {
+        // 已经收到的请求体先交给CGI，剩下的部分由writeCgiInput从socket直接转发
+        readBuffer.retrieve(mParser.headerSize());
+        mQueryString.assign(readBuffer.peek(), readBuffer.readableBytes());
+        readBuffer.retrieveAll();
+        mCgiRelayBody = true;
+        HTTP_CODE ret = doRequest();
+        if (ret != CGI_STREAM) {
+            // 不是CGI脚本，请求体剩下的部分没法跳过，处理完这个请求后关闭连接
+            mCgiRelayBody = false;
+            mLinger = false;
+        }
+        return ret;
+    }
+    if (mContentLength > 0) {
+        // 请求体（POST的表单）交给cgi程序
+        StrView body = mParser.body();
+        mQueryString.append(body.data(), body.size());
+    }
+    // 需要的内容都已经保存下来，视图不再使用，取走这个请求
+    readBuffer.recordRequest(mParser.requestSize());
+    readBuffer.retrieve(mParser.requestSize());
+    return doRequest(); // 解析具体的请求信息
+}
 
-    // 解析到了请求体也是完整的数据
-    // 或者解析到了一行完整的数据
-    lineStatus = parseLine(); // 规避短路规则
-    while (lineStatus == LINE_OK) {
-        // 获取一行数据
-        if (mCheckState != CHECK_STATE_CONTENT)
-            std::cout << "got 1 http line: " << currLine << std::endl;
+HttpConn::HTTP_CODE HttpConn::beginUpload()
+{
+    if (!mUpload.begin(mContentType, docRoot + UPLOAD_URL + "/")) {
+        // 请求体还没有收完，没法跳过，处理完这个请求后关闭连接
+        mLinger = false;
+        readBuffer.retrieveAll();
+        return BAD_REQUEST;
+    }
+    mUploadRemain = mContentLength;
+    return processUpload();
+}
 
-        switch (mCheckState) {
-            case CHECK_STATE_REQUESTLINE: {
-                ret = parseRequestLine(currLine);
-                if (ret == BAD_REQUEST) {
-                    return BAD_REQUEST;
-                }
-                break;
-            }
-            case CHECK_STATE_HEADER: {
-                ret = parseHeaders(currLine);
-                if (ret == BAD_REQUEST) {
-                    return BAD_REQUEST;
-                } else if (ret == GET_REQUEST) { // 已经获得了完整的请求
-                    currLine.clear();
-                    return doRequest(); // 解析具体的请求信息
-                }
-                break;
-            }
-            case CHECK_STATE_CONTENT: {
-                ret = parseContent(currLine);
-                if (ret == GET_REQUEST) { // 已经获得了完整的请求
-                    currLine.clear();
-                    return doRequest(); // 解析具体的请求信息
-                }
-                lineStatus = LINE_OPEN; // 失败，请求数据不完整
-                break;
-            }
-            default: {
-                return INTERNAL_ERROR;
-            }
+HttpConn::HTTP_CODE HttpConn::processUpload()
+{
+    // 读缓冲区中后面可能是流水线中的下一个请求
+    // 逐块交给mUpload，不把整个请求体合并成连续的；一块中剩下的数据不够处理时（分隔符跨越了两块），
+    // 只把它和后面的一小段合并，不够再加倍
+    do {
+        size_t len = min(readBuffer.readableBytes(), mUploadRemain);
+        size_t n = min(len, readBuffer.contiguousBytes());
+        size_t used = mUpload.feed(readBuffer.pullup(n), n, n == mUploadRemain);
+        while (used == 0 && n < len && mUpload.status() == MultipartUpload::UPLOAD_AGAIN) {
+            n = min(len, max(n * 2, (size_t)256));
+            used = mUpload.feed(readBuffer.pullup(n), n, n == mUploadRemain);
+        }
+        readBuffer.retrieve(used);
+        mUploadRemain -= used;
+        if (used == 0) {
+            break;
         }
-        if (mCheckState != CHECK_STATE_CONTENT)
-            currLine.clear();
-        lineStatus = parseLine();
+    } while (mUploadRemain > 0 && readBuffer.readableBytes() > 0 && mUpload.status() == MultipartUpload::UPLOAD_AGAIN);
+    switch (mUpload.status()) {
+        case MultipartUpload::UPLOAD_AGAIN:
+            return NO_REQUEST;
+        case MultipartUpload::UPLOAD_DONE:
+            return UPLOAD_REQUEST;
+        default:
+            // 请求体剩下的部分没法跳过，返回错误后关闭连接
+            LOG_ERROR("upload to %s failed", UPLOAD_URL);
+            mLinger = false;
+            readBuffer.retrieveAll();
+            return mUpload.status() == MultipartUpload::UPLOAD_IO_ERROR ? INTERNAL_ERROR : BAD_REQUEST;
     }
-    return NO_REQUEST;
+}
+
+string HttpConn::uploadResult() const
+{
+    const vector<string> &files = mUpload.files();
+    string message;
+    if (files.empty()) {
+        message = "<h2>No file was uploaded.</h2>";
+    }
+    for (const string &file : files) {
+        string name = htmlEscape(file);
+        message += "<h2>The file \"" + name + "\" was uploaded successfully!</h2><p>The uploaded file is " +
+                   UPLOAD_URL + "/" + name + "</p>";
+    }
+    return "<html><head><meta charset=\"utf-8\"><title>File Upload</title></head><body>" + message + "</body></html>";
 }
 
 bool HttpConn::addResponse(const string &str)
@@ -706,7 +1290,7 @@ bool HttpConn::addStatusLine(int status, const char *title)
     return addResponse("HTTP/1.1 " + to_string(status) + " " + title + "\r\n");
 }
 
-bool HttpConn::addContentLength(int contentLen)
+bool HttpConn::addContentLength(long contentLen)
 {
     return addResponse("Content-Length: " + to_string(contentLen) + "\r\n");
 }
@@ -716,6 +1300,23 @@ bool HttpConn::addContentType()
     return addResponse("Content-Type: " + mMimeType + "\r\n");
 }
 
+bool HttpConn::addAcceptRanges()
+{
+    return addResponse("Accept-Ranges: bytes\r\n");
+}
+
+bool HttpConn::addValidators()
+{
+    addResponse("ETag: " + mFile->etag + "\r\n");
+    addResponse("Last-Modified: " + mFile->lastModified + "\r\n");
+    for (const auto &rule : cacheControl) {
+        if (mUrl.compare(0, rule.first.size(), rule.first) == 0) {
+            return addResponse("Cache-Control: " + rule.second + "\r\n");
+        }
+    }
+    return true;
+}
+
 bool HttpConn::addServerInfo()
 {
     return addResponse("Server: MyHTTPServer/1.0\r\n");
@@ -743,10 +1344,12 @@ bool HttpConn::addContent(const char *content)
 
 bool HttpConn::addCgiContent()
 {
-    return addResponse(cgiBuffer.retrieveAllToStr());
+    writeBuffer.append(cgiBuffer.peek(), cgiBuffer.readableBytes());
+    cgiBuffer.retrieveAll();
+    return true;
 }
 
-void HttpConn::addHeaders(int contentLen)
+void HttpConn::addHeaders(long contentLen)
 {
     addContentLength(contentLen);
     addContentType();
@@ -755,9 +1358,142 @@ void HttpConn::addHeaders(int contentLen)
     addBlankLine();
 }
 
+bool HttpConn::responseCacheable(HTTP_CODE ret) const
+{
+    if (mMethod != GET || !ResponseCache::getInstance()->isEnabled()) {
+        return false;
+    }
+    switch (ret) {
+        case FILE_REQUEST:
+            // 带Set-Cookie的响应每个用户不同；sendfile发送的大文件不缓存
+            return !(cgi && !mCookie.empty()) && mFileFd == -1;
+        case INTERNAL_ERROR:
+        case BAD_REQUEST:
+        case NO_RESOURCE:
+        case FORBIDDEN_REQUEST:
+            return true;
+        default:
+            return false;
+    }
+}
+
+string HttpConn::responseCacheKey(HTTP_CODE ret) const
+{
+    // 保持连接与否只影响Connection头，两种响应分别缓存
+    string key = ret == FILE_REQUEST ? string(mRealFile) : "#" + to_string(ret);
+    key += mLinger ? "\nkeep-alive" : "\nclose";
+    return key;
+}
+
+void HttpConn::cacheResponse(const string &key, HTTP_CODE ret)
+{
+    shared_ptr<string> response(new string(writeBuffer.peek() + mResponseStart, writeBuffer.readableBytes() - mResponseStart));
+    if (m_iv_Count == 2) {
+        response->append((const char*)m_iv[1].iov_base, m_iv[1].iov_len);
+    }
+    ResponseCache::getInstance()->insert(key, ret == FILE_REQUEST ? mFile : nullptr, response);
+}
+
+void HttpConn::sendCachedResponse()
+{
+    // 响应整个放在第二块，第一块（写缓冲区）为空
+    setResponseIov(mResponse->data(), mResponse->size());
+}
+
+void HttpConn::setResponseIov(const char *body, size_t len)
+{
+    m_iv[0].iov_base = const_cast<char*>(writeBuffer.peek()) + mResponseStart;
+    m_iv[0].iov_len = writeBuffer.readableBytes() - mResponseStart;
+    m_iv[1].iov_base = const_cast<char*>(body);
+    m_iv[1].iov_len = len;
+    m_iv_Count = len > 0 ? 2 : 1;
+}
+
+bool HttpConn::addRangeContent()
+{
+    off_t start = mRanges[0].first;
+    off_t length = mRanges[0].second - start + 1;
+    addStatusLine(206, PARTIAL_206_TITLE);
+    addAcceptRanges();
+    addValidators();
+    addResponse("Content-Range: bytes " + to_string(start) + "-" + to_string(mRanges[0].second) + "/" + to_string(mFileStat.st_size) + "\r\n");
+    addHeaders(length);
+    if (mFileFd != -1) {
+        // 只发送请求的这一段；拖动进度条之后是从新位置开始的顺序读，提前让内核读入开头的一部分
+        setResponseIov(nullptr, 0);
+        mFileOffset = start;
+        mFileRemain = length;
+        posix_fadvise(mFileFd, start, min(length, RANGE_READAHEAD), POSIX_FADV_WILLNEED);
+    }
+    else {
+        setResponseIov(mFileAddress + start, length);
+    }
+    return true;
+}
+
+bool HttpConn::addMultipartContent()
+{
+    // 分隔符不能出现在内容中，每个响应生成一个不同的
+    static std::atomic<unsigned long> boundaryCount(0);
+    char boundary[48];
+    snprintf(boundary, sizeof(boundary), "MyHTTPServer%08lx%08lx", (unsigned long)random(), boundaryCount++);
+
+    // 先算出响应体的长度
+    vector<string> partHeaders;
+    long total = 0;
+    for (const auto &range : mRanges) {
+        string header = string("\r\n--") + boundary + "\r\nContent-Type: " + mMimeType +
+                        "\r\nContent-Range: bytes " + to_string(range.first) + "-" + to_string(range.second) +
+                        "/" + to_string(mFileStat.st_size) + "\r\n\r\n";
+        total += header.size() + (range.second - range.first + 1);
+        partHeaders.push_back(header);
+    }
+    string tail = string("\r\n--") + boundary + "--\r\n";
+    total += tail.size();
+
+    addStatusLine(206, PARTIAL_206_TITLE);
+    addAcceptRanges();
+    addValidators();
+    mMimeType = string("multipart/byteranges; boundary=") + boundary;
+    addHeaders(total);
+    for (size_t i = 0; i < mRanges.size(); ++i) {
+        addResponse(partHeaders[i]);
+        off_t start = mRanges[i].first;
+        size_t length = mRanges[i].second - start + 1;
+        writeBuffer.ensureWriteable(length);
+        if (mFileAddress) {
+            memcpy(writeBuffer.beginWrite(), mFileAddress + start, length);
+        }
+        // sendfile模式下没有映射，从缓存的fd读；pread不改变共享fd的文件偏移
+        else if (pread(mFile->fd, writeBuffer.beginWrite(), length, start) != (ssize_t)length) {
+            return false;
+        }
+        writeBuffer.hasWritten(length);
+    }
+    addResponse(tail);
+    return true;
+}
+
 bool HttpConn::processWrite(HTTP_CODE ret)
 {
     mQueryString.clear();
+    // 写缓冲区中前面可能是同一批中已经生成的响应
+    mResponseStart = writeBuffer.readableBytes();
+    m_iv[0].iov_len = m_iv[1].iov_len = 0;
+    m_iv_Count = 0;
+
+    // 小文件和错误页面直接使用缓存中完整的响应，不需要拼接响应头
+    string cacheKey;
+    bool cacheable = responseCacheable(ret);
+    if (cacheable) {
+        cacheKey = responseCacheKey(ret);
+        mResponse = ResponseCache::getInstance()->lookup(cacheKey, ret == FILE_REQUEST ? mFile : nullptr);
+        if (mResponse) {
+            sendCachedResponse();
+            return true;
+        }
+    }
+
     switch (ret) {
         case INTERNAL_ERROR:
             mMimeType = SUFFIX_TYPE.find(".html")->second;
@@ -795,18 +1531,27 @@ bool HttpConn::processWrite(HTTP_CODE ret)
             addStatusLine(200, OK_200_TITLE);
             if (!mCookie.empty() && cgi)
                 addCookie();
+            if (mFileStat.st_size != 0) {
+                addAcceptRanges();
+                addValidators();
+            }
             if (mMethod == HEAD) {
                 addHeaders(mFileStat.st_size);
                 break;
             }
             else if (mFileStat.st_size != 0) {
                 addHeaders(mFileStat.st_size);
-                m_iv[0].iov_base = const_cast<char*>(writeBuffer.peek());
-                m_iv[0].iov_len = writeBuffer.readableBytes();
-                m_iv[1].iov_base = mFileAddress;
-                m_iv[1].iov_len = mFileStat.st_size;
-                m_iv_Count = 2;
-                mBytesToSend = writeBuffer.readableBytes() + mFileStat.st_size; // 响应头的大小+文件的大小
+                if (mFileFd != -1) {
+                    // 文件部分由sendfile发送，iovec中只有响应头
+                    setResponseIov(nullptr, 0);
+                    mFileRemain = mFileStat.st_size;
+                }
+                else {
+                    setResponseIov(mFileAddress, mFileStat.st_size);
+                }
+                if (cacheable) {
+                    cacheResponse(cacheKey, ret);
+                }
                 return true;
             }
             else {
@@ -817,13 +1562,54 @@ bool HttpConn::processWrite(HTTP_CODE ret)
                 }
                 break;
             }
-        case CGI_REQUEST:
+        case PARTIAL_CONTENT:
+            if (mRanges.size() == 1) {
+                return addRangeContent();
+            }
+            if (!addMultipartContent()) {
+                // 读文件失败，去掉已经生成的部分，改为返回500
+                writeBuffer.unwrite(writeBuffer.readableBytes() - mResponseStart);
+                return processWrite(INTERNAL_ERROR);
+            }
+            break;
+        case NOT_MODIFIED:
+            // 没有响应体，也不带Content-Length和Content-Type
+            addStatusLine(304, NOT_MODIFIED_304_TITLE);
+            addValidators();
+            addLinger();
+            addServerInfo();
+            addBlankLine();
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            mMimeType = SUFFIX_TYPE.find(".html")->second;
+            addStatusLine(416, ERROR_416_TITLE);
+            addResponse("Content-Range: bytes */" + to_string(mFileStat.st_size) + "\r\n");
+            addHeaders(strlen(ERROR_416_FORM));
+            if (!addContent(ERROR_416_FORM)) {
+                return false;
+            }
+            break;
+        case UPLOAD_REQUEST: {
+            string content = uploadResult();
+            mMimeType = SUFFIX_TYPE.find(".html")->second;
             addStatusLine(200, OK_200_TITLE);
+            addHeaders(content.size());
+            addResponse(content);
+            break;
+        }
+        case CGI_REQUEST:
+            addStatusLine(mCgiStatus, mCgiStatusTitle.c_str());
             if (!mCookie.empty() && cgi)
                 addCookie();
+            addResponse(mCgiHeaders);
             addHeaders(mCgiLen);
             if (mMethod == HEAD)
                 break;
+            if (mResponse) {
+                // CGI缓存中的输出不拷贝，和文件内容一样作为第二块发送
+                setResponseIov(mResponse->data(), mResponse->size());
+                return true;
+            }
             if (!addCgiContent())
                 return false;
             break;
@@ -831,232 +1617,469 @@ bool HttpConn::processWrite(HTTP_CODE ret)
             return false;
     }
 
-    m_iv[0].iov_base = const_cast<char*>(writeBuffer.peek());
-    m_iv[0].iov_len = writeBuffer.readableBytes();
-    m_iv[1].iov_len = 0;
-    m_iv_Count = 1;
-    mBytesToSend = writeBuffer.readableBytes();
+    setResponseIov(nullptr, 0);
+    if (cacheable) {
+        cacheResponse(cacheKey, ret);
+    }
     return true;
 }
 
 // 解析HTTP请求行，获得请求方法，目标URL，HTTP版本
-HttpConn::HTTP_CODE HttpConn::parseRequestLine(const std::string &text)
+HttpConn::HTTP_CODE HttpConn::parseRequestLine(const StrView &method, const StrView &uri, const StrView &version)
 {
-    // string str(text);
-    // std::cout << "parseRequestLine: " << text << std::endl;
-    // TODO: 用正则表达式会简单一些
     // 获取请求方法
-    istringstream is(text);
-    string temp;
-    int i = 0;
-    while (is >> temp) {
-        if (i == 0) { // 请求方法
-            if (temp == "GET") {
-                mMethod = GET;
-            } else if (temp == "POST") {
-                mMethod = POST;
-                cgi = 1;
-            }  else if (temp == "HEAD") {
-                mMethod = HEAD;
-            } else {
-                return BAD_REQUEST;
-            }
-        } else if (i == 1) { // url
-            mUrl = temp;
-            size_t index = mUrl.find("http://");
-            if (index != string::npos) {
-                if (index != 0)
-                    return BAD_REQUEST;
-                mUrl = mUrl.substr(mUrl.find("/", index));
-            }
-            size_t queryIndex = mUrl.find("?");
-            if (queryIndex != string::npos) { // url上有参数
-                mQueryString = mUrl.substr(queryIndex + 1);
-                mUrl = mUrl.substr(0, queryIndex);
-                cgi = 1;
-            }
-            if (mUrl.empty()) {
-                mUrl = "/index.html";
-            }
-            if (mUrl.back() == '/') {
-                mUrl += "index.html";
-            }
-            mUrl = urlDecode(mUrl);
-            // 解析mimetype
-            size_t dotIndex = mUrl.rfind(".");
-            if (dotIndex != string::npos) {
-                string type = mUrl.substr(dotIndex);
-                std::transform(type.begin(), type.end(), type.begin(), ::tolower);
-                auto it = SUFFIX_TYPE.find(type);
-                if (it != SUFFIX_TYPE.end()) {
-                    mMimeType = it->second;
-                }
-            }
-        } else if (i == 2) { // version
-            if (temp != "HTTP/1.1") {
-                return BAD_REQUEST;
-            }
-            mVersion = temp;
-        }
-        i++;
+    if (method.equals("GET")) {
+        mMethod = GET;
+    } else if (method.equals("POST")) {
+        mMethod = POST;
+        cgi = 1;
+    } else if (method.equals("HEAD")) {
+        mMethod = HEAD;
+    } else {
+        return BAD_REQUEST;
     }
 
-    if (i != 3) {
+    if (!version.equals("HTTP/1.1")) {
         return BAD_REQUEST;
     }
-
-    mCheckState = CHECK_STATE_HEADER; // 主状态机：检查状态变成检查请求头
+    mVersion.assign(version.data(), version.size());
+
+    // url
+    mUrl.assign(uri.data(), uri.size());
+    size_t index = mUrl.find("http://");
+    if (index != string::npos) {
+        if (index != 0)
+            return BAD_REQUEST;
+        mUrl = mUrl.substr(mUrl.find("/", index));
+    }
+    size_t queryIndex = mUrl.find("?");
+    if (queryIndex != string::npos) { // url上有参数
+        mQueryString = mUrl.substr(queryIndex + 1);
+        mUrl = mUrl.substr(0, queryIndex);
+        cgi = 1;
+    }
+    if (mUrl.empty()) {
+        mUrl = "/index.html";
+    }
+    if (mUrl.back() == '/') {
+        mUrl += "index.html";
+    }
+    mUrl = urlDecode(mUrl);
+    // 解析mimetype
+    size_t dotIndex = mUrl.rfind(".");
+    if (dotIndex != string::npos) {
+        string type = mUrl.substr(dotIndex);
+        std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+        auto it = SUFFIX_TYPE.find(type);
+        if (it != SUFFIX_TYPE.end()) {
+            mMimeType = it->second;
+        }
+    }
     return NO_REQUEST;
 }
 
-HttpConn::HTTP_CODE HttpConn::parseHeaders(const std::string &text)
+// 头部名称不区分大小写，只保存用到的头部；Content-Length由解析器处理
+void HttpConn::parseHeader(const StrView &name, const StrView &value)
 {
-    // 遇到空行，表示头部字段解析完毕
-    if(text.empty()) {
-        // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
-        // 状态机转移到CHECK_STATE_CONTENT状态
-        if (mContentLength != 0) { // 说明有请求体
-            mCheckState = CHECK_STATE_CONTENT;
-            return NO_REQUEST; // 还没开始解析请求体
+    if (name.iequals("Connection")) {
+        if (value.iequals("keep-alive")) {
+            mLinger = true; // 保持连接
         }
-        // 否则说明我们已经得到了一个完整的HTTP请求
-        return GET_REQUEST;
+    } else if (name.iequals("Content-Type")) {
+        mContentType = value.str();
+    } else if (name.iequals("Host")) {
+        mHost = value.str();
+    } else if (name.iequals("Range")) {
+        mRange = value.str();
+    } else if (name.iequals("If-Range")) {
+        mIfRange = value.str();
+    } else if (name.iequals("If-None-Match")) {
+        mIfNoneMatch = value.str();
+    } else if (name.iequals("If-Modified-Since")) {
+        mIfModifiedSince = value.str();
+    } else if (name.iequals("Cookie")) {
+        // 处理Cookie
+        mCookie = value.str();
+        cgi = 1;
     }
-    string str(text);
-    string temp, key, value;
-    size_t index = str.find(":");
-    if (index == string::npos) {
-        std::cout << "oop! unknown header " << text << std::endl;
-        return NO_REQUEST;
+}
+
+bool HttpConn::queueResponse()
+{
+    for (int i = 0; i < m_iv_Count; ++i) {
+        if (m_iv[i].iov_len == 0) {
+            continue;
+        }
+        struct iovec iov = m_iv[i];
+        if (i == 0) {
+            iov.iov_base = nullptr; // 写缓冲区中的部分，prepareSend时再填地址
+        }
+        mIov.push_back(iov);
+        mIovBytes += iov.iov_len;
     }
-    index++;
-    key = str.substr(0, index);
-    while (index != str.size() && (str[index] == ' ' || str[index] == '\t')) {
-        index++;
+    mBatchLinger = mLinger;
+    // 要关闭连接、用sendfile发送或者临时映射的文件，只能是这一批的最后一个响应
+    return mLinger && mFileFd == -1 && !(mFileAddress && mFileAddress != mFile->data);
+}
+
+void HttpConn::prepareSend()
+{
+    const char *p = writeBuffer.peek();
+    for (auto &iov : mIov) {
+        if (iov.iov_base == nullptr) {
+            iov.iov_base = const_cast<char*>(p);
+            p += iov.iov_len;
+        }
     }
-    value = str.substr(index);
+    mIovIndex = 0;
+    mBytesToSend = pendingBytes();
+}
 
-    if (key == "Connection:") {
-        // 处理Connection 头部字段  Connection: keep-alive
-        if (value == "keep-alive") {
-            mLinger = true; // 保持连接
+// 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
+// 读缓冲区中所有完整的请求（流水线）依次处理，响应按顺序放在同一批中发送
+void HttpConn::process()
+{
+    processRequests();
+    if (mCgiParked) {
+        mWorkerRef.fetch_or(PARKED);
+    }
+    leaveWorker();
+}
+
+void HttpConn::leaveWorker()
+{
+    // 交回之后连接随时可能被关闭、对象被新连接复用，需要的成员先取出来
+    ConnListener *listener = mListener;
+    uint32_t generation = mGeneration;
+    int ref = mWorkerRef.fetch_sub(1) - 1;
+    if (ref & REF_MASK) {
+        return;
+    }
+    if (ref & CLOSE_PENDING) {
+        listener->onRearm(this, generation, EV_CLOSE);
+    }
+    else if (ref & RESUME_PENDING) {
+        // 挂起之后、返回之前就已经被唤醒了
+        listener->onRearm(this, generation, EV_RESUME);
+    }
+}
+
+bool HttpConn::deferClose()
+{
+    int ref = mWorkerRef.load();
+    while ((ref & REF_MASK) > 0) {
+        if (mWorkerRef.compare_exchange_weak(ref, ref | CLOSE_PENDING)) {
+            return true;
         }
-    } else if (key == "Content-Length:") {
-        // 处理Content-Length头部字段
-        mContentLength = stol(value);
-    } else if (key == "Content-Type:") {
-        // 处理Content-Type头部字段
-        mContentType = value;
-    } else if (key == "Host:") {
-        // 处理Host头部字段
-        mHost = value;
-    } else if (key == "Cookie:") {
-        // 处理Cookie
-        mCookie = value;
-        cgi = 1;
-    } else {
-        std::cout << "oop! unknown header " << text << std::endl;
     }
-    return NO_REQUEST;
+    return false;
 }
 
-HttpConn::HTTP_CODE HttpConn::parseContent(const std::string &text)
+bool HttpConn::deferResume()
 {
-    // 数据是否被完整读入
-    if (text.size() >= mContentLength) {
-        mQueryString.append(text, 0, mContentLength);
-        return GET_REQUEST;
+    int ref = mWorkerRef.load();
+    while (true) {
+        if ((ref & REF_MASK) > 0) {
+            if (mWorkerRef.compare_exchange_weak(ref, ref | RESUME_PENDING)) {
+                return true;
+            }
+        }
+        else if (mWorkerRef.compare_exchange_weak(ref, ref & ~(RESUME_PENDING | PARKED))) {
+            return false;
+        }
     }
-    return NO_REQUEST;
 }
 
-// 解析一行，判断依据\r\n
-HttpConn::LINE_STATUS HttpConn::parseLine() {
-    if (mCheckState == CHECK_STATE_CONTENT) {
-        size_t restSize = mContentLength - currLine.size();
-        if (readBuffer.readableBytes() >= restSize) {
-            currLine.append(readBuffer.peek(), restSize);
-            readBuffer.retrieve(restSize);
+void HttpConn::processRequests()
+{
+    int responses = 0;
+    while (true) {
+        // 只有这一批的第一个请求可以挂起，否则前面的响应要等它
+        mCgiMayPark = responses == 0;
+        // 解析HTPP请求，被唤醒的请求已经解析过了，直接重新查找缓存
+        HTTP_CODE readRet;
+        if (mCgiParked) {
+            mCgiParked = false;
+            readRet = cgiRequest();
         }
         else {
-            currLine.append(readBuffer.peek(), readBuffer.readableBytes());
-            readBuffer.retrieveAll();
+            readRet = processRead(); // 解析一些请求有不同的情况
+        }
+        // 请求处理过程中获取的数据库连接，处理完就还给连接池
+        mysql.release();
+        redis.release();
+        if (readRet == NO_REQUEST) { // 请求不完整，要继续获取客户端数据
+            break;
+        }
+        if (readRet == CGI_STREAM || readRet == FCGI_REQUEST) {
+            // CGI的响应由Reactor在输出可读（或者FastCGI的结果返回）时生成，后面的请求等它发送完再处理
+            break;
+        }
+        if (readRet == CGI_WAIT) {
+            // 不等待读写，由CgiCache在结果出来之后通过Reactor唤醒（EV_RESUME）
+            mCgiParked = true;
+            return;
+        }
+        // 生成响应
+        processWrite(readRet);
+        responses++;
+        // 这一批已经足够大，或者这个响应之后不能再合并，剩下的请求等这一批发送完再处理
+        if (!queueResponse() || !hasBufferedRequest() || responses >= MAX_PIPELINE ||
+            writeBuffer.readableBytes() >= WRITE_BUFFER_SIZE) {
+            break;
+        }
+        // 后面的请求会覆盖当前文件和缓存的响应，转移到批次中，发送完再释放
+        if (mFile) {
+            mHeldFiles.push_back(std::move(mFile));
         }
-        if (currLine.size() == mContentLength) {
-            return LINE_OK;
+        if (mResponse) {
+            mHeldResponses.push_back(std::move(mResponse));
         }
-        return LINE_OPEN;
+        mFile.reset();
+        mResponse.reset();
+        mFileAddress = nullptr;
+        initInfos();
     }
-    char temp;
-    // 遍历一行数据
-    const char *p = readBuffer.peek();
-    for (; p != readBuffer.beginWriteConst(); ++p) {
-        temp = *p;
-        if (mCheckState == CHECK_STATE_CONTENT) {
-            currLine.push_back(temp);
-            continue;
+    if (mCgi.inputPending() && !mCgiRelayBody) {
+        // 请求体都在内存中，和输出一起等待
+        rearm(EV_CGI_INPUT);
+    }
+    if (responses == 0) {
+        // 前面没有要发送的响应时直接处理CGI，否则在这一批发送完之后
+        if (mFcgiPending) {
+            mListener->onRearm(this, mGeneration, EV_FCGI);
+        }
+        else if (mCgi.running()) {
+            continueCgi();
+        }
+        else {
+            rearm(EPOLLIN);
         }
-        if (temp == '\r') {
-            if (p + 1 == readBuffer.beginWriteConst()) {
-                readBuffer.retrieveUntil(p + 1);
-                return LINE_OPEN; // 这一行不完整
-            } else if (*(p + 1) == '\n') {
-                // 将\r\n消除掉
-                readBuffer.retrieveUntil(p + 2);
-                return LINE_OK; // 完整解析到了一行
+        return;
+    }
+    prepareSend();
+    rearm(EPOLLOUT);
+    if (mFcgiPending) {
+        // FastCGI请求和前面的响应同时进行，放在最后交给Reactor，它生成响应时这一批已经准备好了
+        mListener->onRearm(this, mGeneration, EV_FCGI);
+    }
+}
+
+int HttpConn::getUserCount()
+{
+    return mUserCount;
+}
+
+void HttpConn::decUserCount()
+{
+    mUserCount--;
+}
+
+void HttpConn::setDocRoot(const string &path)
+{
+    docRoot = path;
+}
+
+// 解析非负整数，不接受空串、符号和溢出
+static bool parseOffset(const string &text, off_t &value)
+{
+    if (text.empty() || text.size() > 18) {
+        return false;
+    }
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+// 解析Range请求头（只支持bytes），可以满足的范围按起点排序、合并重叠和相邻的之后放入ranges（闭区间）
+// 格式不合法时返回false，这时忽略Range返回整个文件；返回true但ranges为空表示没有可以满足的范围（416）
+static bool parseRanges(const string &value, off_t size, vector<pair<off_t, off_t>> &ranges)
+{
+    static const int MAX_RANGES = 32; // 防止用大量的小范围消耗服务器资源
+    ranges.clear();
+    if (value.compare(0, 6, "bytes=") != 0) {
+        return false;
+    }
+    int count = 0;
+    size_t pos = 6;
+    while (pos <= value.size()) {
+        size_t comma = value.find(',', pos);
+        if (comma == string::npos) {
+            comma = value.size();
+        }
+        string spec = value.substr(pos, comma - pos);
+        pos = comma + 1;
+        size_t begin = spec.find_first_not_of(" \t");
+        if (begin == string::npos) {
+            continue; // 允许空的元素，如 "0-1,,5-6"
+        }
+        spec = spec.substr(begin, spec.find_last_not_of(" \t") - begin + 1);
+        if (++count > MAX_RANGES) {
+            return false;
+        }
+        size_t dash = spec.find('-');
+        if (dash == string::npos) {
+            return false;
+        }
+        string first = spec.substr(0, dash), last = spec.substr(dash + 1);
+        off_t start, stop;
+        if (first.empty()) {
+            // -N：最后N个字节
+            off_t suffix;
+            if (!parseOffset(last, suffix)) {
+                return false;
+            }
+            if (suffix == 0) {
+                continue;
+            }
+            start = suffix >= size ? 0 : size - suffix;
+            stop = size - 1;
+        }
+        else {
+            if (!parseOffset(first, start)) {
+                return false;
+            }
+            if (last.empty()) {
+                stop = size - 1; // N-：从N到文件末尾
+            }
+            else {
+                if (!parseOffset(last, stop) || stop < start) {
+                    return false;
+                }
+                stop = min(stop, size - 1);
             }
-            readBuffer.retrieveUntil(p);
-            return LINE_BAD;
-        } else if (temp == '\n') {
-            // 判断前面一个字符是不是\r
-            if ((p != readBuffer.peek()) && (*(p - 1) == '\r')) {
-                // 将\r\n消除掉
-                readBuffer.retrieveUntil(p + 1);
-                return LINE_OK; // 完整解析到了一行
+            if (start >= size) {
+                continue;
             }
-            readBuffer.retrieveUntil(p);
-            return LINE_BAD;
         }
-        currLine.push_back(temp);
+        ranges.push_back(make_pair(start, stop));
     }
-    readBuffer.retrieveAll();
-    return LINE_OPEN;
+    if (count == 0) {
+        return false;
+    }
+
+    sort(ranges.begin(), ranges.end());
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].first <= ranges[merged].second + 1) {
+            ranges[merged].second = max(ranges[merged].second, ranges[i].second);
+        }
+        else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    if (!ranges.empty()) {
+        ranges.resize(merged + 1);
+    }
+    return true;
 }
 
-// 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
-void HttpConn::process()
+bool HttpConn::notModified() const
 {
-    // 解析HTPP请求
-    HTTP_CODE readRet = processRead(); // 解析一些请求有不同的情况
-    if (readRet == NO_REQUEST) { // 请求不完整，要继续获取客户端数据
-        modifyfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+    if ((mMethod != GET && mMethod != HEAD) || mFile->etag.empty()) {
+        return false;
+    }
+    // 两个都有时以If-None-Match为准
+    if (!mIfNoneMatch.empty()) {
+        size_t pos = 0;
+        while (pos < mIfNoneMatch.size()) {
+            size_t comma = mIfNoneMatch.find(',', pos);
+            if (comma == string::npos) {
+                comma = mIfNoneMatch.size();
+            }
+            string tag = mIfNoneMatch.substr(pos, comma - pos);
+            pos = comma + 1;
+            size_t begin = tag.find_first_not_of(" \t");
+            if (begin == string::npos) {
+                continue;
+            }
+            tag = tag.substr(begin, tag.find_last_not_of(" \t") - begin + 1);
+            // 弱比较，忽略W/前缀
+            if (tag.compare(0, 2, "W/") == 0) {
+                tag = tag.substr(2);
+            }
+            if (tag == "*" || tag == mFile->etag) {
+                return true;
+            }
+        }
+        return false;
+    }
+    time_t since;
+    if (!mIfModifiedSince.empty() && parseHttpDate(mIfModifiedSince, since)) {
+        return mFileStat.st_mtime <= since;
     }
-    // std::cout << "parse request, create response" << std::endl;
-    // 生成响应
-    bool writeRet = processWrite(readRet);
-    // if (!writeRet) {
-    //     closeConn();
-    // }
-    modifyfd(m_epollfd, m_sockfd, EPOLLOUT);
+    return false;
 }
 
-void HttpConn::setEpollfd(int fd)
+HttpConn::HTTP_CODE HttpConn::fileRequest()
 {
-    m_epollfd = fd;
+    // 客户端缓存的文件没有变化，不需要打开和发送文件；带Set-Cookie的响应（登录）总是完整返回
+    if (mFileStat.st_size != 0 && !(cgi && !mCookie.empty()) && notModified()) {
+        return NOT_MODIFIED;
+    }
+    if (!openFile()) {
+        return INTERNAL_ERROR;
+    }
+    // 只有GET请求的非空文件支持Range
+    if (mMethod != GET || mRange.empty() || mFileStat.st_size == 0) {
+        return FILE_REQUEST;
+    }
+    // If-Range是ETag（强比较）或Last-Modified，和当前的不一致说明客户端手里的版本已经不是当前的文件了，
+    // 拼起来的内容会错乱，返回整个文件
+    if (!mIfRange.empty() && mIfRange != (mIfRange[0] == '"' ? mFile->etag : mFile->lastModified)) {
+        return FILE_REQUEST;
+    }
+    if (!parseRanges(mRange, mFileStat.st_size, mRanges)) {
+        mRanges.clear();
+        return FILE_REQUEST;
+    }
+    if (mRanges.empty()) {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    if (mRanges.size() > 1) {
+        off_t total = 0;
+        for (const auto &range : mRanges) {
+            total += range.second - range.first + 1;
+        }
+        if (total > MAX_MULTIPART_SIZE) {
+            mRanges.clear();
+            return FILE_REQUEST;
+        }
+    }
+    return PARTIAL_CONTENT;
 }
 
-int HttpConn::getUserCount()
+const string &HttpConn::getDocRoot()
 {
-    return mUserCount;
+    return docRoot;
 }
 
-void HttpConn::decUserCount()
+string HttpConn::getMimeType(const string &path)
 {
-    mUserCount--;
+    size_t dotIndex = path.rfind(".");
+    if (dotIndex == string::npos || path.find("/", dotIndex) != string::npos) {
+        return TYPE_BIN;
+    }
+    string type = path.substr(dotIndex);
+    std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+    auto it = SUFFIX_TYPE.find(type);
+    return it != SUFFIX_TYPE.end() ? it->second : TYPE_BIN;
 }
 
-void HttpConn::setDocRoot(const string &path)
+void HttpConn::setCacheControl(const vector<pair<string, string>> &rules)
 {
-    docRoot = path;
+    cacheControl = rules;
+    // 最长的前缀优先匹配
+    stable_sort(cacheControl.begin(), cacheControl.end(),
+                [](const pair<string, string> &a, const pair<string, string> &b) { return a.first.size() > b.first.size(); });
+}
+
+void HttpConn::setSendfileThreshold(long threshold)
+{
+    sendfileThreshold = threshold;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include "../thread/locker.h"
 #include "../utils/utils.h"
 #include "../epoll/epoll.h"
@@ -15,31 +16,35 @@
 #include <cctype>
 #include <sys/wait.h>
 #include "../buffer/buffer.h"
+#include "../buffer/chain_buffer.h"
 #include "url.h"
+#include "http_parser.h"
+#include "multipart_upload.h"
 #include "cookie.h"
 #include "../redis/redis.h"
+#include "../cache/file_cache.h"
+#include "../cache/response_cache.h"
+#include "../cache/cgi_cache.h"
+#include "../fcgi/fcgi.h"
+#include "cgi_process.h"
+#include <atomic>
+#include <vector>
+
+class HttpConn;
+
+// 工作线程处理完请求后，连接需要重新等待读或写
+// epoll模式下直接修改epoll中的事件；io_uring模式下交给连接所属的Reactor，由它提交读写请求（提交队列只能在Reactor线程中使用）
+class ConnListener {
+public:
+    virtual ~ConnListener() {}
+    virtual void onRearm(HttpConn *conn, uint32_t generation, int ev) = 0;
+};
 
 class HttpConn {
 private:
     // HTTP请求方法
     enum METHOD { GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT };
 
-    /*
-        解析客户端请求时，主状态机的状态
-        CHECK_STATE_REQUESTLINE: 当前正在分析请求行
-        CHECK_STATE_HEADER: 当前正在分析头部字段
-        CHECK_STATE_CONTENT: 当前正在解析请求体
-    */
-    enum CHECK_STATE { CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT };
-
-    /*
-        从状态机的三种可能状态，即行的读取状态，分别表示：
-        1. 读取到一个完整的行
-        2. 行出错
-        3. 行数据尚且不完整
-    */
-    enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
-
     /*
         服务器处理HTTP请求的可能结果，报文解析的结果
         NO_REQUEST: 请求不完整，需要继续读取客户端
@@ -51,77 +56,177 @@ private:
         CGI_REQUEST: cgi请求成功
         INTERNAL_ERROR: 表示服务器内部错误
         CLOSED_CONNECTION: 表示客户端已经关闭连接了
+        PARTIAL_CONTENT: 文件请求，只返回Range指定的部分（mRanges）
+        RANGE_NOT_SATISFIABLE: Range指定的范围都超出了文件大小
+        NOT_MODIFIED: 客户端缓存的文件仍然有效（条件请求），返回没有响应体的304
+        UPLOAD_REQUEST: 文件上传完成，返回保存的文件
+        CGI_STREAM: CGI子进程已经启动，响应由Reactor在管道可读时生成（readCgiOutput）
+        CGI_WAIT: 同一个脚本的输出正在由其他请求生成，连接挂在CGI缓存上，结果出来后由Reactor重新交给工作线程
+        FCGI_REQUEST: 请求由Reactor转发给FastCGI工作进程，响应在结果返回后由Reactor生成（readFastCgiOutput）
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, CGI_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, CGI_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION,
+                     PARTIAL_CONTENT, RANGE_NOT_SATISFIABLE, NOT_MODIFIED, UPLOAD_REQUEST, CGI_STREAM, CGI_WAIT, FCGI_REQUEST };
 
     // 定义HTTP响应的一些状态信息
     static const char *OK_200_TITLE;
     static const char *OK_200_FORM;
+    static const char *PARTIAL_206_TITLE;
+    static const char *FOUND_302_TITLE;
+    static const char *NOT_MODIFIED_304_TITLE;
     static const char *ERROR_400_TITLE;
     static const char *ERROR_400_FORM;
     static const char *ERROR_403_TITLE;
     static const char *ERROR_403_FORM;
     static const char *ERROR_404_TITLE;
     static const char *ERROR_404_FORM;
+    static const char *ERROR_416_TITLE;
+    static const char *ERROR_416_FORM;
     static const char *ERROR_500_TITLE;
     static const char *ERROR_500_FORM;
+    static const char *UPLOAD_URL; // multipart/form-data的POST请求由服务器直接保存到资源目录下的upload/
 
     // mimetype
     static const char *TYPE_BIN;
     static const unordered_map<string, string> SUFFIX_TYPE;
 
-    static const int READ_BUFFER_SIZE = 65535;
+    static const int READ_BUFFER_SIZE = 65535; // 每次最多读入的字节数，上传大文件时读缓冲区不会随着上传增长
     static const int WRITE_BUFFER_SIZE = 65535;
     static const int FILENAME_LENGTH = 200; // 文件名的最大长度
+    static const size_t SHRINK_STRING_LIMIT = 256; // 连接空闲时保留的字符串容量，更大的释放
+    static const size_t SHRINK_VECTOR_LIMIT = 16; // 连接空闲时保留的数组容量（项数）
     static const int SESSION_EXPIRE = 3600; // session持续时长3600s
     static const int USER_INFO_EXPIRE = 7200; // session持续时长3600s
+    static const off_t MAX_MULTIPART_SIZE = 1024 * 1024; // 多个范围的响应体要拷贝到写缓冲区，超过这个大小时忽略Range，返回整个文件
+    static const off_t RANGE_READAHEAD = 2 * 1024 * 1024; // 单个范围用sendfile发送时，提前让内核读入的长度
+    static const int MAX_PIPELINE = 32; // 流水线请求一批最多合并的响应数
+    static const size_t CGI_HEADER_LIMIT = 8192; // CGI输出开头这么多字节中还没有找到响应头的结束就不再等待
 
 public:
+    // rearm的伪事件：等待CGI子进程的标准输入可写、标准输出可读
+    static const int EV_CGI_INPUT = -1;
+    static const int EV_CGI_OUTPUT = -2;
+    static const int EV_CLOSE = -3; // 最后一个工作线程交回连接时，通知Reactor执行被推迟的关闭
+    static const int EV_RESUME = -4; // 挂在CGI缓存上的连接等到了结果，重新交给工作线程
+    static const int EV_FCGI = -5; // 把请求交给Reactor转发给FastCGI工作进程
+
     HttpConn();
     ~HttpConn();
     void process(); // 处理客户端的请求
-    void init(int sockfd, const sockaddr_in &addr); // 初始化新接收的连接
-    void closeConn(); // 关闭连接
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, ConnListener *listener, bool uring); // 初始化新接收的连接
+    void closeConn(bool closeFd = true); // 关闭连接，closeFd为false表示socket已经关闭了（io_uring的close请求）
     bool read(); // 非阻塞的读
     bool write(); // 非阻塞的写
-    void setMySQL(MYSQL *conn) { this->mysql.setConn(conn); }
-    void setRedis(redisContext *conn) { this->redis.setConn(conn); }
+    // 以下由io_uring模式的Reactor使用，读写请求由内核完成，这里只维护缓冲区
+    void appendRead(const char *data, size_t len); // 收到的数据放入读缓冲区
+    const struct iovec *getIov() const { return mIov.data() + mIovIndex; }
+    int getIovCount() const { return mIov.size() - mIovIndex; }
+    size_t pendingBytes() const { return mIovBytes + mFileRemain + mSpliceRemain; }
+    bool onWritten(size_t bytes); // 已经发送了bytes字节，返回这一批响应是否全部发送完毕
+    bool finishResponse(); // 响应发送完毕后的清理，返回是否保持连接
+    // 读缓冲区中还有数据（流水线中没有处理的请求），发送完后直接交给工作线程，不用等待socket可读
+    bool hasBufferedRequest() const { return readBuffer.readableBytes() > 0; }
+    bool keepAlive() const { return mBatchLinger; }
+    int getLastWorker() const { return mLastWorker.load(std::memory_order_relaxed); }
+    void setLastWorker(int worker) { mLastWorker.store(worker, std::memory_order_relaxed); }
+    int getSockfd() const { return m_sockfd; }
+    uint32_t getGeneration() const { return mGeneration; }
+    // 以下由Reactor在自己的线程中调用：交给线程池之前记录工作线程持有连接，持有期间连接不能关闭，对象不能被复用；
+    // 要关闭时还有工作线程持有就只做标记（deferClose返回true），由最后一个交回连接的工作线程通知Reactor关闭
+    void enterWorker() { mWorkerRef.fetch_add(1); }
+    void leaveWorker(); // 工作线程交回连接（没能交给线程池时Reactor自己交回），是最后一个时处理被推迟的关闭和唤醒
+    bool inWorker() const { return (mWorkerRef.load() & REF_MASK) > 0; }
+    bool deferClose();
+    bool closePending() const { return mWorkerRef.load() & CLOSE_PENDING; }
+    // 挂起的连接被唤醒（EV_RESUME）时挂起它的工作线程还没有返回就只做标记（deferResume返回true），由它返回时再通知一次
+    bool deferResume();
+    bool parked() const { return mWorkerRef.load() & PARKED; } // 挂在CGI缓存上，不是空闲连接
+    // 以下由Reactor处理CGI管道的事件，只在连接所属的Reactor线程中调用
+    bool cgiRunning() const { return mCgi.running() || mFcgiPending; } // CGI（包括FastCGI）的响应还没有生成完
+    bool cgiRelayingBody() const { return mCgiRelayBody; } // socket上收到的是要转给CGI的请求体
+    uint32_t getCgiSerial() const { return mCgi.serial(); }
+    int getCgiFd(bool input) const { return input ? mCgi.inputFd() : mCgi.outputFd(); }
+    void writeCgiInput(); // 继续写请求体，没写完时重新等待管道可写或者socket可读
+    void readCgiOutput(); // 读出CGI的输出并生成要发送的数据（可能为空，比如响应头还不完整）
+    // 以下由Reactor转发FastCGI请求，只在连接所属的Reactor线程中调用
+    std::vector<std::pair<std::string, std::string>> cgiEnvironment(std::string &input) const; // CGI环境变量，input中是要写入标准输入的请求体
+    bool fastCgiPending() const { return mFcgiPending; }
+    bool fastCgiWaiting() const { return mFcgiPending && !mFcgiDone; } // 还在等待工作进程的结果
+    bool fastCgiReady() const { return mFcgiPending && mFcgiDone; } // 结果已经到了，等前面的响应发送完再生成响应
+    void setFastCgiOutput(bool ok, const std::string &output);
+    void readFastCgiOutput(); // 用FastCGI的结果生成完整的响应
     static void tick();
-    static void setEpollfd(int fd);
     static int getUserCount();
     static void decUserCount();
     static void setDocRoot(const std::string &path);
+    static const std::string &getDocRoot();
+    static std::string getMimeType(const std::string &path); // 按文件后缀得到MIME类型
+    static void setSendfileThreshold(long threshold);
+    // 按URL前缀（最长匹配）为静态文件的响应添加Cache-Control，规则为(前缀, 值)
+    static void setCacheControl(const std::vector<std::pair<std::string, std::string>> &rules);
     static void initMySQLResult();
 
 private:
     int m_sockfd; // 该HTTP连接的socket
+    int m_epollfd; // 该连接所属Reactor的epoll对象
+    uint32_t mGeneration; // 对象每被一个新连接使用一次加1，注册到epoll的数据中带上它
+    ConnListener *mListener; // 连接所属的Reactor，io_uring模式下重新等待读写时通知它
+    bool mUring; // 使用io_uring，读写请求由Reactor提交
+    // 交给工作线程还没有交回的次数（工作线程rearm之后、返回之前，Reactor可能已经把连接交给了另一个工作线程），
+    // 加上被推迟的关闭、唤醒和挂起的标记
+    std::atomic<int> mWorkerRef;
+    static const int CLOSE_PENDING = 1 << 30;
+    static const int RESUME_PENDING = 1 << 29;
+    static const int PARKED = 1 << 28;
+    static const int REF_MASK = PARKED - 1;
+    std::atomic<int> mLastWorker; // 上一次处理该连接的工作线程，-1表示还没有
     sockaddr_in m_address; // 通信的socket地址
     int mReadIndex; // 标识读缓冲区中以及读入的客户端数据的最后一个字节的下标（下一次从这里开始读）
 
-    int mCheckedIndex; // 当前正在分析的字符在读缓冲区的位置
-    int mStartLine; // 当前正在解析的行的起始位置
+    HttpParser mParser; // 在读缓冲区上增量解析，请求完整之前数据一直留在缓冲区中
     std::string mUrl; // 请求目标文件的文件名
     std::string mVersion; // 协议版本，只支持1.1
     METHOD mMethod; // 请求方法
     std::string mHost; // 主机名
     std::string mContentType;
     bool mLinger; // 是否保持连接（keep-alive）
+    // 批次中最后一个响应是否保持连接，发送完之后按它决定是否关闭
+    // 后面还没有收完的请求可能已经解析了头部（上传、转发请求体的CGI），mLinger是那个请求的
+    bool mBatchLinger;
     int mContentLength; // HTTP请求的消息总长度
     std::string mCookie;
-    std::string currLine;
+    std::string mRange; // Range请求头
+    std::string mIfRange; // If-Range请求头，和文件当前的验证器不一致时忽略Range
+    std::string mIfNoneMatch; // If-None-Match请求头，客户端缓存的ETag列表
+    std::string mIfModifiedSince; // If-Modified-Since请求头，没有If-None-Match时才使用
+    std::vector<std::pair<off_t, off_t>> mRanges; // 要返回的范围（闭区间），已排序合并
+    MultipartUpload mUpload; // 上传请求的请求体不等收完，收到一部分就写入文件
+    size_t mUploadRemain; // 上传请求的请求体还没有处理的字节数
 
-    Redis redis;
+    Redis redis; // 惰性句柄，doRequest第一次访问时才从连接池中获取连接
     MySQL mysql;
 
-    CHECK_STATE mCheckState; // 主状态机当前所处的状态
-
     char mRealFile[FILENAME_LENGTH]; // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
     int mWriteIndex; // 写缓冲区中待发送的字节数
-    char *mFileAddress; // 客户请求的目标文件被mmap到内存中的起始位置
+    std::shared_ptr<const CachedFile> mFile; // 目标文件的缓存条目，响应发送完之前一直持有
+    std::shared_ptr<const std::string> mResponse; // 正在发送的缓存中的完整响应
+    char *mFileAddress; // 客户请求的目标文件被mmap到内存中的起始位置（通常是缓存条目中的映射）
+    int mFileFd; // 使用sendfile发送时目标文件的fd（属于缓存条目），不使用时为-1
+    off_t mFileOffset; // sendfile下一次从文件的这个位置开始发送，EAGAIN之后从这里继续
+    size_t mFileRemain; // sendfile还没有发送的文件字节数
+    int mSpliceFd; // 用splice发送时CGI标准输出的管道，不使用时为-1
+    size_t mSpliceRemain; // 当前chunk中还没有从管道移到socket的字节数
     struct stat mFileStat; // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2]; // 要写的内存块，有两块：一块是空行前面的响应行（mWriteBuf），另一块是空行之后的文件缓冲区（mFileAddress）
+    struct iovec m_iv[2]; // 正在生成的响应要写的内存块，有两块：一块是写缓冲区中的响应头（mResponseStart之后），另一块是文件内容或缓存的响应
     int m_iv_Count; // 被写内存块的数量
-    Buffer readBuffer; // 可变的读缓冲区
+    size_t mResponseStart; // 正在生成的响应在写缓冲区中的起始位置，前面是同一批中已经生成的响应
+    // 流水线：读缓冲区中所有完整的请求依次处理，响应按顺序加入同一批，一次writev发送
+    // 批次中写缓冲区的部分iov_base为空，生成完之后才填上地址（生成过程中写缓冲区可能扩容）
+    std::vector<struct iovec> mIov;
+    size_t mIovIndex; // 第一个还没有发送完的内存块
+    size_t mIovBytes; // 批次中还没有发送的字节数（不含sendfile的部分）
+    std::vector<std::shared_ptr<const CachedFile>> mHeldFiles; // 批次中前面的响应引用的文件映射和缓存的响应，发送完后释放
+    std::vector<std::shared_ptr<const std::string>> mHeldResponses;
+    ChainBuffer readBuffer; // 由内存池中的块组成，数据取完后块立即归还
     Buffer writeBuffer;
     Buffer cgiBuffer;
 
@@ -130,29 +235,61 @@ private:
 
     int cgi;
     std::string mQueryString;
-    Locker mLock;
 
     std::string mMimeType;
     int mCgiLen;
+    CgiProcess mCgi; // fork+exec的CGI子进程，输出边读边用chunked编码发送
+    bool mCgiStarted; // 已经发送了CGI响应的响应头
+    bool mCgiRelayBody; // 请求体还没有收完就启动了CGI，剩下的部分从socket直接转给它，转完之后才读输出
+    bool mCgiChunkOpen; // 上一个chunk的数据用splice发送，结尾的CRLF还没有发送
+    std::string mCgiHeaders; // CGI输出中Content-Type以外的响应头，原样转发给客户端
+    int mCgiStatus; // CGI输出中Status指定的状态码，只有Location时为302，都没有时为200
+    std::string mCgiStatusTitle;
+    std::string mCgiCacheKey; // 这个请求负责执行脚本并把输出放入CGI缓存（CgiCache::MISS），否则为空
+    std::string mCgiCacheBody; // 要放入缓存的输出，边转发边收集
+    bool mCgiParked; // 挂在CGI缓存上等待其他请求的结果，被唤醒后不用重新解析请求，直接重新执行cgiRequest()
+    bool mCgiMayPark; // 这一批还没有生成响应时才能挂起，否则等待的请求直接执行脚本
+    bool mFcgiPending; // 请求已经交给FastCGI工作进程，响应还没有生成
+    bool mFcgiDone; // FastCGI的结果已经放入cgiBuffer
+    bool mFcgiOk;
 
-    static int m_epollfd; // 所有的socket上的事件都被注册到同一个epoll对象中
     static std::string docRoot;
-    static int mUserCount; // 统计用户的数量
+    static long sendfileThreshold; // 不小于该大小的文件使用sendfile，-1表示不使用
+    static std::vector<std::pair<std::string, std::string>> cacheControl; // 按前缀长度从长到短排列
+    static std::atomic<int> mUserCount; // 统计用户的数量，多个Reactor线程会同时修改
     static std::unordered_map<std::string, std::string> mUsers;
 
 private:
     void initInfos(); // 初始化连接的其余信息
+    // 连接空闲（没有正在处理的请求）时，写缓冲区和CGI缓冲区还给内存池，上一个请求留下的大字符串、数组也释放掉
+    // 空闲的连接只占用对象本身（连接表中的一项）和一个小的头部数组
+    void shrink();
+    void rearm(int ev); // 重新等待读（EPOLLIN）、写（EPOLLOUT）或CGI管道（EV_CGI_INPUT、EV_CGI_OUTPUT）
+    void processRequests(); // process()的主体，返回前一定已经rearm
 
     HTTP_CODE processRead(); // 解析HTTP请求，主状态机
     bool processWrite(HTTP_CODE ret);
-    HTTP_CODE parseRequestLine(const std::string &text); // 解析请求首行
-    HTTP_CODE parseHeaders(const std::string &text); // 解析请求头
-    HTTP_CODE parseContent(const std::string &text); // 解析请求体
+    void setResponseIov(const char *body, size_t len); // 当前响应：写缓冲区中的响应头加上body（可以为空）
+    bool queueResponse(); // 把生成的响应加入批次，返回后面的请求能否继续合并到这一批
+    void prepareSend(); // 批次生成完毕，填上指向写缓冲区的地址
+    bool responseCacheable(HTTP_CODE ret) const; // 响应是否只取决于文件内容和是否保持连接
+    std::string responseCacheKey(HTTP_CODE ret) const;
+    void cacheResponse(const std::string &key, HTTP_CODE ret); // 把刚生成的响应放入缓存
+    void sendCachedResponse(); // 准备发送mResponse
+    HTTP_CODE parseRequestLine(const StrView &method, const StrView &uri, const StrView &version); // 解析请求首行
+    void parseHeader(const StrView &name, const StrView &value); // 保存需要的请求头
+    HTTP_CODE beginUpload(); // 头部已经完整的上传请求，开始处理请求体
+    HTTP_CODE processUpload(); // 把读缓冲区中上传请求的请求体交给mUpload
+    std::string uploadResult() const; // 上传完成后返回的页面
 
     bool addStatusLine(int status, const char *title); // 生成响应首行
     bool addResponse(const string &str); // 往缓冲区中写入待发送的数据
-    void addHeaders(int contentLen); // 生成响应头
-    bool addContentLength(int contentLen);
+    void addHeaders(long contentLen); // 生成响应头
+    bool addContentLength(long contentLen);
+    bool addAcceptRanges();
+    bool addValidators(); // ETag、Last-Modified和按路径配置的Cache-Control
+    bool addRangeContent(); // 单个范围：响应体直接来自文件的一段
+    bool addMultipartContent(); // 多个范围：multipart/byteranges，各段内容拷贝到写缓冲区
     bool addServerInfo();
     bool addContentType();
     bool addLinger();
@@ -161,11 +298,23 @@ private:
     bool addCookie();
     bool addCgiContent();
 
-    LINE_STATUS parseLine();
-
     HTTP_CODE doRequest();
+    HTTP_CODE startCgi(); // fork+exec执行CGI脚本，输出由Reactor读取
+    bool cgiHeaderReady(bool eof) const; // cgiBuffer中的输出是否足够解析响应头
+    void parseCgiOutput(); // 取出CGI输出开头的响应头
+    void queueCgiResponse(HTTP_CODE ret); // CGI输出已经全部读完（或失败），生成带Content-Length的完整响应
+    bool relayCgiBody() const; // 头部已经完整、请求体还没有收完的POST请求，是否启动CGI边收边转发请求体
+    void continueCgi(); // 连接上的数据发送完了，继续转发请求体、等待CGI的输出或者用已经返回的FastCGI结果生成响应
+    HTTP_CODE cgiRequest(); // 可执行的脚本：使用缓存的输出，或者挂起等待其他请求的结果，或者执行脚本
+    CgiCache::Result lookupCgiCache(); // 在CGI缓存中查找GET/HEAD请求的输出，命中时输出在mResponse中
+    void fillCgiCache(const char *data, size_t len, bool done); // 收集要缓存的输出，done为true时放入缓存
+    void releaseCgiCache(bool closed); // 输出不放入缓存（执行失败或者连接关闭了），让等待的请求继续
 
-    void unmap(); // 解除对文件的内存映射
+    bool statFile(); // 从文件缓存中取得mRealFile的状态，文件不存在时返回false
+    bool openFile(); // 准备发送文件：大文件用缓存中的fd调用sendfile，其余的使用缓存中的映射
+    HTTP_CODE fileRequest(); // 准备发送文件，并根据条件请求头和Range决定返回304、整个文件、部分内容还是416
+    bool notModified() const; // 根据If-None-Match/If-Modified-Since判断客户端缓存的文件是否仍然有效
+    void unmap(); // 释放目标文件和批次中引用的文件（只有临时建立的映射需要解除）
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "http_parser.h"
+
+using namespace std;
+
+const size_t HttpParser::MAX_HEADER_SIZE;
+const size_t HttpParser::MAX_HEADERS;
+const size_t HttpParser::KEEP_HEADERS;
+const size_t HttpParser::MAX_CONTENT_LENGTH;
+
+static const CharSet NEWLINE("\n");
+static const CharSet HEADER_DELIMITERS(":\n");
+static const CharSet SPACE(" ");
+
+HttpParser::HttpParser()
+{
+    reset();
+}
+
+void HttpParser::reset()
+{
+    mBase = nullptr;
+    mState = STATE_REQUEST_LINE;
+    mScanned = 0;
+    mLineStart = 0;
+    mColon = 0;
+    mHeaderEnd = 0;
+    mContentLength = 0;
+    mMethod = mUri = mVersion = Span{0, 0};
+    mHeaders.clear();
+}
+
+void HttpParser::shrink()
+{
+    if (mHeaders.capacity() > KEEP_HEADERS) {
+        vector<Header>().swap(mHeaders);
+    }
+}
+
+HttpParser::Status HttpParser::parse(const char *data, size_t len)
+{
+    mBase = data;
+    const char *last = data + len;
+    while (mState == STATE_REQUEST_LINE || mState == STATE_HEADERS) {
+        const char *newline;
+        if (mState == STATE_HEADERS && mColon == 0) {
+            // 先找冒号或换行，遇到冒号后再从它后面找换行，整行只扫描一遍
+            newline = scanAny(data + mScanned, last, HEADER_DELIMITERS);
+            if (newline != last && *newline == ':') {
+                mColon = newline - data;
+                newline = scanAny(newline + 1, last, NEWLINE);
+            }
+        }
+        else {
+            newline = scanAny(data + mScanned, last, NEWLINE);
+        }
+        if (newline == last) {
+            mScanned = len;
+            // 迟迟收不到完整的头部，不再继续缓存
+            return len > MAX_HEADER_SIZE ? PARSE_ERROR : PARSE_AGAIN;
+        }
+        mScanned = newline - data + 1;
+        if (mScanned > MAX_HEADER_SIZE) {
+            return PARSE_ERROR;
+        }
+        // 行以\r\n结束，也接受单独的\n
+        size_t end = mScanned - 1;
+        if (end > mLineStart && data[end - 1] == '\r') {
+            end--;
+        }
+        bool ok = mState == STATE_REQUEST_LINE ? parseRequestLine(mLineStart, end) : parseHeaderLine(mLineStart, end, mColon);
+        if (!ok) {
+            return PARSE_ERROR;
+        }
+        mLineStart = mScanned;
+        mColon = 0;
+    }
+
+    if (mState == STATE_BODY) {
+        if (len - mHeaderEnd < mContentLength) {
+            return PARSE_AGAIN; // 请求体还没有收完
+        }
+        mState = STATE_DONE;
+    }
+    return PARSE_DONE;
+}
+
+// 请求行：方法 SP URI SP 版本
+bool HttpParser::parseRequestLine(size_t begin, size_t end)
+{
+    if (begin == end) {
+        return true; // 忽略请求前面多余的空行
+    }
+    const char *line = mBase + begin;
+    size_t len = end - begin;
+    const char *lineEnd = line + len;
+    const char *sp1 = scanAny(line, lineEnd, SPACE);
+    if (sp1 == lineEnd) {
+        return false;
+    }
+    const char *uri = sp1 + 1;
+    const char *sp2 = scanAny(uri, lineEnd, SPACE);
+    if (sp2 == lineEnd) {
+        return false;
+    }
+    const char *version = sp2 + 1;
+    if (sp1 == line || sp2 == uri || version == lineEnd || scanAny(version, lineEnd, SPACE) != lineEnd) {
+        return false;
+    }
+    mMethod = Span{begin, (size_t)(sp1 - line)};
+    mUri = Span{(size_t)(uri - mBase), (size_t)(sp2 - uri)};
+    mVersion = Span{(size_t)(version - mBase), (size_t)(lineEnd - version)};
+    mState = STATE_HEADERS;
+    return true;
+}
+
+// 头部：名称 ":" OWS 值 OWS，空行表示头部结束
+// colon为扫描时找到的冒号的偏移，0表示这一行没有冒号
+bool HttpParser::parseHeaderLine(size_t begin, size_t end, size_t colon)
+{
+    if (begin == end) {
+        mHeaderEnd = mScanned;
+        mState = mContentLength > 0 ? STATE_BODY : STATE_DONE;
+        return true;
+    }
+    const char *line = mBase + begin;
+    if (line[0] == ' ' || line[0] == '\t') {
+        return false; // 不支持已经废弃的折行
+    }
+    if (colon == 0 || colon == begin) {
+        return true; // 不是合法的头部，忽略
+    }
+    if (mHeaders.size() >= MAX_HEADERS) {
+        return false;
+    }
+    size_t valueBegin = colon + 1;
+    while (valueBegin < end && (mBase[valueBegin] == ' ' || mBase[valueBegin] == '\t')) {
+        valueBegin++;
+    }
+    while (end > valueBegin && (mBase[end - 1] == ' ' || mBase[end - 1] == '\t')) {
+        end--;
+    }
+    Header header;
+    header.name = Span{begin, colon - begin};
+    header.value = Span{valueBegin, end - valueBegin};
+    mHeaders.push_back(header);
+
+    // 请求体的长度决定请求在哪里结束，解析器自己处理
+    if (view(header.name).iequals("Content-Length")) {
+        StrView value = view(header.value);
+        if (value.empty() || value.size() > 10) {
+            return false;
+        }
+        size_t length = 0;
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] < '0' || value[i] > '9') {
+                return false;
+            }
+            length = length * 10 + (value[i] - '0');
+        }
+        if (length > MAX_CONTENT_LENGTH) {
+            return false;
+        }
+        mContentLength = length;
+    }
+    return true;
+}
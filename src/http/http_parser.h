@@ -0,0 +1,98 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <cstddef>
+#include <cstring>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include "simd_scan.h"
+
+// 指向缓冲区中一段数据的只读视图，不拷贝也不拥有数据（项目使用C++11，没有std::string_view）
+class StrView {
+public:
+    StrView() : mData(nullptr), mSize(0) {}
+    StrView(const char *data, size_t size) : mData(data), mSize(size) {}
+
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    char operator[](size_t i) const { return mData[i]; }
+    std::string str() const { return std::string(mData, mSize); }
+
+    bool equals(const char *s) const { return strlen(s) == mSize && memcmp(mData, s, mSize) == 0; }
+    // 不区分大小写，用于头部名称和Connection等取值
+    bool iequals(const char *s) const { return strlen(s) == mSize && strncasecmp(mData, s, mSize) == 0; }
+
+private:
+    const char *mData;
+    size_t mSize;
+};
+
+// 增量式HTTP请求解析器，直接在读缓冲区上扫描，请求行、头部和请求体都以视图的形式给出
+// 数据不完整时记住扫描到的位置，读到更多数据后从这里继续，每个字节只扫描一次
+// 分隔符用SIMD查找（simd_scan.h），头部行在同一遍扫描中找到冒号和行尾
+// 解析结果保存为相对于请求开头的偏移，取视图时才和最近一次parse()传入的地址组合，
+// 所以两次parse()之间缓冲区扩容或移动数据不影响已经解析的部分
+class HttpParser {
+public:
+    enum Status { PARSE_AGAIN, PARSE_DONE, PARSE_ERROR };
+
+    static const size_t MAX_HEADER_SIZE = 64 * 1024; // 请求行加头部的最大长度，超过时按错误处理
+    static const size_t MAX_HEADERS = 100;
+    static const size_t KEEP_HEADERS = 16; // 空闲连接保留的头部数组容量，够大多数浏览器的请求使用
+    static const size_t MAX_CONTENT_LENGTH = 0x7fffffff;
+
+    HttpParser();
+    void reset(); // 准备解析下一个请求
+    void shrink(); // 连接空闲时调用，头部数组的容量超过KEEP_HEADERS项时释放
+
+    // data指向缓冲区中请求的第一个字节，len为缓冲区中的可读字节数
+    // 同一个请求的多次调用之间只能在后面追加数据，不能取走前面的数据
+    Status parse(const char *data, size_t len);
+
+    // 以下在parse()返回PARSE_DONE之后、缓冲区被修改之前有效
+    StrView method() const { return view(mMethod); }
+    StrView uri() const { return view(mUri); }
+    StrView version() const { return view(mVersion); }
+    size_t headerCount() const { return mHeaders.size(); }
+    StrView headerName(size_t i) const { return view(mHeaders[i].name); }
+    StrView headerValue(size_t i) const { return view(mHeaders[i].value); }
+    size_t contentLength() const { return mContentLength; }
+    StrView body() const { return StrView(mBase + mHeaderEnd, mContentLength); }
+    size_t requestSize() const { return mHeaderEnd + mContentLength; } // 整个请求的字节数，处理完后从缓冲区取走
+
+    // 请求行和头部已经完整（请求体可能还没有收完），此时上面除了body()以外的结果都已经有效
+    // 上传等需要边收边处理请求体的请求，在这之后取走头部，请求体自己处理，不再调用parse()
+    bool headersDone() const { return mState == STATE_BODY || mState == STATE_DONE; }
+    size_t headerSize() const { return mHeaderEnd; }
+
+private:
+    enum State { STATE_REQUEST_LINE, STATE_HEADERS, STATE_BODY, STATE_DONE };
+    struct Span {
+        size_t offset;
+        size_t size;
+    };
+    struct Header {
+        Span name;
+        Span value;
+    };
+
+    StrView view(const Span &span) const { return StrView(mBase + span.offset, span.size); }
+    bool parseRequestLine(size_t begin, size_t end);
+    bool parseHeaderLine(size_t begin, size_t end, size_t colon);
+
+    const char *mBase; // 最近一次parse()时请求开头的地址
+    State mState;
+    size_t mScanned; // 已经扫描过的字节数，下一次从这里找换行
+    size_t mLineStart; // 当前行的起始偏移
+    size_t mColon; // 当前头部行中冒号的偏移，0表示还没有找到
+    size_t mHeaderEnd; // 头部结束（空行之后）的偏移，即请求体的起始偏移
+    size_t mContentLength;
+    Span mMethod;
+    Span mUri;
+    Span mVersion;
+    std::vector<Header> mHeaders; // reset()只清空不释放，保持连接的下一个请求不再分配内存
+};
+
+#endif
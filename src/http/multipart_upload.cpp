@@ -0,0 +1,308 @@
+#include "multipart_upload.h"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+const size_t MultipartUpload::MAX_PART_HEADER_SIZE;
+const size_t MultipartUpload::MAX_BOUNDARY_SIZE;
+
+MultipartUpload::MultipartUpload() : mState(STATE_IDLE), mStatus(UPLOAD_AGAIN), mFd(-1) {}
+
+MultipartUpload::~MultipartUpload()
+{
+    reset();
+}
+
+// 取出参数name的值，例如从 multipart/form-data; boundary="abc" 中取出abc
+// 参数名不区分大小写，值可以带引号
+static bool getParam(const string &header, const char *name, string &value)
+{
+    size_t nameLen = strlen(name);
+    size_t pos = 0;
+    while ((pos = header.find(';', pos)) != string::npos) {
+        pos++;
+        while (pos < header.size() && (header[pos] == ' ' || header[pos] == '\t')) {
+            pos++;
+        }
+        if (strncasecmp(header.c_str() + pos, name, nameLen) != 0 || pos + nameLen >= header.size() || header[pos + nameLen] != '=') {
+            continue;
+        }
+        pos += nameLen + 1;
+        if (pos < header.size() && header[pos] == '"') {
+            size_t end = header.find('"', pos + 1);
+            if (end == string::npos) {
+                return false;
+            }
+            value = header.substr(pos + 1, end - pos - 1);
+        }
+        else {
+            size_t end = header.find_first_of("; \t", pos);
+            value = header.substr(pos, end == string::npos ? string::npos : end - pos);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool MultipartUpload::begin(const string &contentType, const string &dir)
+{
+    reset();
+    string boundary;
+    if (strncasecmp(contentType.c_str(), "multipart/form-data", 19) != 0 || !getParam(contentType, "boundary", boundary) ||
+        boundary.empty() || boundary.size() > MAX_BOUNDARY_SIZE) {
+        return false;
+    }
+    mDelimiter = "\r\n--" + boundary;
+    mDir = dir;
+    mkdir(mDir.c_str(), 0755); // 上传目录不存在时创建
+    mState = STATE_PREAMBLE;
+    mStatus = UPLOAD_AGAIN;
+    return true;
+}
+
+size_t MultipartUpload::feed(const char *data, size_t len, bool last)
+{
+    size_t consumed = 0;
+    while (mStatus == UPLOAD_AGAIN && mState != STATE_EPILOGUE) {
+        size_t used = 0;
+        switch (mState) {
+            case STATE_PREAMBLE:
+                used = parsePreamble(data + consumed, len - consumed);
+                break;
+            case STATE_BOUNDARY_END:
+                used = parseBoundaryEnd(data + consumed, len - consumed);
+                break;
+            case STATE_PART_HEADER:
+                used = parsePartHeader(data + consumed, len - consumed);
+                break;
+            case STATE_PART_DATA:
+                used = parsePartData(data + consumed, len - consumed, last);
+                break;
+            default:
+                fail(UPLOAD_BAD_REQUEST);
+                break;
+        }
+        consumed += used;
+        if (used == 0) {
+            break; // 需要更多的数据才能继续，或者出错了
+        }
+    }
+    if (mStatus != UPLOAD_AGAIN) {
+        return consumed;
+    }
+    if (mState == STATE_EPILOGUE) {
+        // 结束分隔符之后的内容没有意义，直接丢弃
+        consumed = len;
+        if (last) {
+            mStatus = UPLOAD_DONE;
+        }
+    }
+    else if (last) {
+        fail(UPLOAD_BAD_REQUEST); // 请求体已经结束，上传不完整
+    }
+    return consumed;
+}
+
+// 第一个分隔符前面可以有任意内容，分隔符之前的\r\n可以省略（请求体通常直接以分隔符开头）
+size_t MultipartUpload::parsePreamble(const char *data, size_t len)
+{
+    const char *dash = mDelimiter.c_str() + 2;
+    size_t dashLen = mDelimiter.size() - 2;
+    const char *found = (const char*)memmem(data, len, dash, dashLen);
+    if (!found) {
+        // 保留可能是分隔符开头的部分
+        return len > dashLen ? len - dashLen : 0;
+    }
+    mState = STATE_BOUNDARY_END;
+    return found - data + dashLen;
+}
+
+// 分隔符后面是\r\n（下一个部分）或者--（最后一个分隔符）
+size_t MultipartUpload::parseBoundaryEnd(const char *data, size_t len)
+{
+    if (len < 2) {
+        return 0;
+    }
+    if (data[0] == '-' && data[1] == '-') {
+        mState = STATE_EPILOGUE;
+        return 2;
+    }
+    if (data[0] == '\r' && data[1] == '\n') {
+        mState = STATE_PART_HEADER;
+        return 2;
+    }
+    fail(UPLOAD_BAD_REQUEST);
+    return 0;
+}
+
+// 部分的头以空行结束，只关心Content-Disposition中的filename
+size_t MultipartUpload::parsePartHeader(const char *data, size_t len)
+{
+    if (len < 2) {
+        return 0;
+    }
+    if (data[0] == '\r' && data[1] == '\n') {
+        // 没有任何头，分隔符之后直接是空行
+        mState = STATE_PART_DATA;
+        return 2;
+    }
+    const char *end = (const char*)memmem(data, min(len, MAX_PART_HEADER_SIZE), "\r\n\r\n", 4);
+    if (!end) {
+        if (len >= MAX_PART_HEADER_SIZE) {
+            fail(UPLOAD_BAD_REQUEST);
+        }
+        return 0;
+    }
+    size_t headerLen = end - data;
+    string filename;
+    bool hasFile = false;
+    size_t lineStart = 0;
+    while (lineStart < headerLen) {
+        size_t lineEnd = lineStart;
+        while (lineEnd < headerLen && data[lineEnd] != '\r') {
+            lineEnd++;
+        }
+        string line(data + lineStart, lineEnd - lineStart);
+        if (strncasecmp(line.c_str(), "Content-Disposition:", 20) == 0) {
+            hasFile = getParam(line, "filename", filename);
+        }
+        lineStart = lineEnd + 2;
+    }
+    if (hasFile && !filename.empty()) {
+        if (!openPart(filename)) {
+            return 0;
+        }
+    }
+    mState = STATE_PART_DATA;
+    return headerLen + 4;
+}
+
+// 部分的内容一直到下一个分隔符为止，找不到分隔符时末尾可能是分隔符的开头，留到下一次
+size_t MultipartUpload::parsePartData(const char *data, size_t len, bool last)
+{
+    const char *found = (const char*)memmem(data, len, mDelimiter.data(), mDelimiter.size());
+    size_t dataLen;
+    if (found) {
+        dataLen = found - data;
+    }
+    else if (last) {
+        return 0; // 请求体结束了还没有遇到分隔符，上传不完整
+    }
+    else {
+        // 只保留末尾可能是分隔符开头的部分（读缓冲区是分块的，保留的部分要和下一块合并）
+        size_t keep = min(len, mDelimiter.size() - 1);
+        while (keep > 0 && memcmp(data + len - keep, mDelimiter.data(), keep) != 0) {
+            const char *cr = (const char*)memchr(data + len - keep + 1, '\r', keep - 1);
+            keep = cr ? data + len - cr : 0;
+        }
+        dataLen = len - keep;
+    }
+    if (dataLen > 0 && !writePart(data, dataLen)) {
+        return 0;
+    }
+    if (!found) {
+        return dataLen;
+    }
+    if (!finishPart()) {
+        return 0;
+    }
+    mState = STATE_BOUNDARY_END;
+    return dataLen + mDelimiter.size();
+}
+
+bool MultipartUpload::openPart(const string &filename)
+{
+    // 浏览器可能带上客户端的路径，只保留最后一部分，也防止写到上传目录之外
+    string name = filename;
+    for (char &c : name) {
+        if (c == '\\') {
+            c = '/';
+        }
+    }
+    name = name.substr(name.rfind('/') + 1);
+    if (name.empty() || name == "." || name == "..") {
+        fail(UPLOAD_BAD_REQUEST);
+        return false;
+    }
+    // 先写到临时文件，写完再改名
+    string tempPath = mDir + ".upload-XXXXXX";
+    int fd = mkostemp(&tempPath[0], O_CLOEXEC);
+    if (fd == -1) {
+        fail(UPLOAD_IO_ERROR);
+        return false;
+    }
+    fchmod(fd, 0644);
+    mFd = fd;
+    mTempPath = tempPath;
+    mFilename = name;
+    return true;
+}
+
+bool MultipartUpload::writePart(const char *data, size_t len)
+{
+    if (mFd == -1) {
+        return true; // 不保存的表单字段
+    }
+    while (len > 0) {
+        ssize_t n = ::write(mFd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail(UPLOAD_IO_ERROR);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool MultipartUpload::finishPart()
+{
+    if (mFd == -1) {
+        return true;
+    }
+    int ret = close(mFd);
+    mFd = -1;
+    if (ret == -1 || rename(mTempPath.c_str(), (mDir + mFilename).c_str()) == -1) {
+        unlink(mTempPath.c_str());
+        mTempPath.clear();
+        fail(UPLOAD_IO_ERROR);
+        return false;
+    }
+    mTempPath.clear();
+    mFiles.push_back(mFilename);
+    return true;
+}
+
+void MultipartUpload::fail(Status status)
+{
+    mStatus = status;
+    if (mFd != -1) {
+        close(mFd);
+        mFd = -1;
+        unlink(mTempPath.c_str());
+        mTempPath.clear();
+    }
+}
+
+void MultipartUpload::reset()
+{
+    if (mFd != -1) {
+        close(mFd);
+        mFd = -1;
+        unlink(mTempPath.c_str());
+    }
+    mTempPath.clear();
+    mFilename.clear();
+    mFiles.clear();
+    mState = STATE_IDLE;
+    mStatus = UPLOAD_AGAIN;
+}
@@ -0,0 +1,54 @@
+#ifndef MULTIPART_UPLOAD_H
+#define MULTIPART_UPLOAD_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// multipart/form-data请求体的增量解析器，收到一部分数据就处理一部分
+// 文件部分直接从读缓冲区写入上传目录下的临时文件，整个部分写完后再改名，没有写完的文件不会出现在上传目录中
+// 内存中只保留部分的头和可能是分隔符开头的几个字节（留在调用者的缓冲区中），占用的内存和上传的大小无关
+// 没有文件名的部分（普通的表单字段）直接丢弃
+class MultipartUpload {
+public:
+    enum Status { UPLOAD_AGAIN, UPLOAD_DONE, UPLOAD_BAD_REQUEST, UPLOAD_IO_ERROR };
+
+    static const size_t MAX_PART_HEADER_SIZE = 8 * 1024; // 每个部分的头的最大长度
+    static const size_t MAX_BOUNDARY_SIZE = 70; // RFC 2046规定的分隔符最大长度
+
+    MultipartUpload();
+    ~MultipartUpload();
+
+    // contentType为请求的Content-Type，dir为上传目录（以/结尾），不是multipart/form-data或者没有boundary时返回false
+    bool begin(const std::string &contentType, const std::string &dir);
+    // 处理请求体中接下来的len字节，last表示请求体到此结束
+    // 返回处理掉的字节数，剩下的字节（可能是分隔符的开头）下次和后面收到的数据一起传入
+    size_t feed(const char *data, size_t len, bool last);
+    Status status() const { return mStatus; }
+    bool active() const { return mState != STATE_IDLE && mStatus == UPLOAD_AGAIN; } // 上传还没有结束
+    const std::vector<std::string> &files() const { return mFiles; } // 已经保存的文件名
+    void reset(); // 结束这次上传，删除没有写完的临时文件
+
+private:
+    enum State { STATE_IDLE, STATE_PREAMBLE, STATE_BOUNDARY_END, STATE_PART_HEADER, STATE_PART_DATA, STATE_EPILOGUE };
+
+    size_t parsePreamble(const char *data, size_t len);
+    size_t parseBoundaryEnd(const char *data, size_t len);
+    size_t parsePartHeader(const char *data, size_t len);
+    size_t parsePartData(const char *data, size_t len, bool last);
+    bool openPart(const std::string &filename);
+    bool writePart(const char *data, size_t len);
+    bool finishPart();
+    void fail(Status status);
+
+    State mState;
+    Status mStatus;
+    std::string mDelimiter; // "\r\n--" + boundary，部分的内容到它为止
+    std::string mDir;
+    int mFd; // 正在写入的临时文件，-1表示当前部分不保存
+    std::string mTempPath;
+    std::string mFilename;
+    std::vector<std::string> mFiles;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "simd_scan.h"
+#include <cstring>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+CharSet::CharSet(const char *chars)
+{
+    memset(this->chars, 0, sizeof(this->chars));
+    memset(table, 0, sizeof(table));
+    count = 0;
+    for (const char *p = chars; *p && count < 16; ++p) {
+        this->chars[count++] = *p;
+        table[(unsigned char)*p] = true;
+    }
+}
+
+static const char *scanScalar(const char *begin, const char *end, const CharSet &set)
+{
+    for (const char *p = begin; p != end; ++p) {
+        if (set.table[(unsigned char)*p]) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+// 向量实现都从begin所在的对齐块开始，按对齐地址整块读取，再用掩码去掉begin之前和end之后的字节，
+// 短的查找（请求行中的空格、头部行、URL中的转义）不需要逐字节处理开头和结尾
+// 对齐的块不会跨页，只要块中有一个字节属于[begin, end)，读整块就不会访问到未映射的内存；
+// 块中超出范围的字节不影响结果，但AddressSanitizer会把它当作越界，所以不对这些函数做检查
+
+// 一次比较16字节，PCMPESTRM给出属于集合的字节的位掩码
+__attribute__((target("sse4.2"), no_sanitize_address))
+static const char *scanSse42(const char *begin, const char *end, const CharSet &set)
+{
+    if (begin == end) {
+        return end;
+    }
+    const __m128i needle = _mm_loadu_si128((const __m128i*)set.chars);
+    const char *p = (const char*)((uintptr_t)begin & ~(uintptr_t)15);
+    unsigned mask = _mm_cvtsi128_si32(_mm_cmpestrm(needle, set.count, _mm_load_si128((const __m128i*)p), 16,
+                                                   _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK));
+    mask &= ~0u << (begin - p);
+    while (true) {
+        if (mask) {
+            const char *found = p + __builtin_ctz(mask);
+            return found < end ? found : end;
+        }
+        p += 16;
+        if (p >= end) {
+            return end;
+        }
+        mask = _mm_cvtsi128_si32(_mm_cmpestrm(needle, set.count, _mm_load_si128((const __m128i*)p), 16,
+                                              _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK));
+    }
+}
+
+// 一次比较32字节，集合中的每个字符各比较一次后合并
+// 集合通常只有1到3个字符，按个数生成专门的版本，比较次数在编译时确定
+template <int N>
+__attribute__((target("avx2"), no_sanitize_address))
+static inline unsigned matchAvx2(const char *p, const __m256i *needles, int count)
+{
+    __m256i block = _mm256_load_si256((const __m256i*)p);
+    __m256i match = _mm256_cmpeq_epi8(block, needles[0]);
+    for (int i = 1; i < (N > 0 ? N : count); ++i) {
+        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(block, needles[i]));
+    }
+    return _mm256_movemask_epi8(match);
+}
+
+template <int N>
+__attribute__((target("avx2"), no_sanitize_address))
+static const char *scanAvx2N(const char *begin, const char *end, const CharSet &set)
+{
+    __m256i needles[N > 0 ? N : 16] = {}; // 个数确定时放在寄存器中
+    for (int i = 0; i < (N > 0 ? N : set.count); ++i) {
+        needles[i] = _mm256_set1_epi8(set.chars[i]);
+    }
+    const char *p = (const char*)((uintptr_t)begin & ~(uintptr_t)31);
+    unsigned mask = matchAvx2<N>(p, needles, set.count) & (~0u << (begin - p));
+    while (true) {
+        if (mask) {
+            const char *found = p + __builtin_ctz(mask);
+            return found < end ? found : end;
+        }
+        p += 32;
+        if (p >= end) {
+            return end;
+        }
+        mask = matchAvx2<N>(p, needles, set.count);
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *scanAvx2(const char *begin, const char *end, const CharSet &set)
+{
+    if (begin == end) {
+        return end;
+    }
+    switch (set.count) {
+        case 1:
+            return scanAvx2N<1>(begin, end, set);
+        case 2:
+            return scanAvx2N<2>(begin, end, set);
+        case 3:
+            return scanAvx2N<3>(begin, end, set);
+        default:
+            return scanAvx2N<0>(begin, end, set);
+    }
+}
+#endif
+
+typedef const char *(*ScanFunc)(const char *, const char *, const CharSet &);
+
+struct ScanImpl {
+    const char *name;
+    ScanFunc func;
+};
+
+static ScanImpl selectImpl()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return ScanImpl{"avx2", scanAvx2};
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ScanImpl{"sse4.2", scanSse42};
+    }
+#endif
+    return ScanImpl{"scalar", scanScalar};
+}
+
+static ScanImpl impl = selectImpl();
+
+const char *scanAny(const char *begin, const char *end, const CharSet &set)
+{
+    return impl.func(begin, end, set);
+}
+
+bool setScanImpl(const char *name)
+{
+    if (strcmp(name, "scalar") == 0) {
+        impl = ScanImpl{"scalar", scanScalar};
+        return true;
+    }
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2")) {
+        impl = ScanImpl{"sse4.2", scanSse42};
+        return true;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        impl = ScanImpl{"avx2", scanAvx2};
+        return true;
+    }
+#endif
+    return false;
+}
+
+const char *scanImplName()
+{
+    return impl.name;
+}
@@ -0,0 +1,25 @@
+#ifndef SIMD_SCAN_H
+#define SIMD_SCAN_H
+
+#include <cstddef>
+
+// 要查找的字符集合，最多16个字符，不能包含'\0'
+// 各个实现需要的形式（SSE4.2的16字节向量、标量的查找表）在构造时准备好，作为静态常量使用
+class CharSet {
+public:
+    explicit CharSet(const char *chars);
+
+    char chars[16]; // 不足16个的部分为0
+    int count;
+    bool table[256];
+};
+
+// 在[begin, end)中查找第一个属于set的字符，找不到时返回end
+// 启动时按CPU支持的指令集选择AVX2、SSE4.2或标量实现
+const char *scanAny(const char *begin, const char *end, const CharSet &set);
+
+// 强制使用某个实现（scalar、sse4.2、avx2），CPU不支持时返回false，用于基准测试
+bool setScanImpl(const char *name);
+const char *scanImplName();
+
+#endif
@@ -3,6 +3,8 @@
 #include<stdio.h>
 #include<assert.h>
 #include<fstream>
+#include "url.h"
+#include "simd_scan.h"
 using namespace std;
 
 unsigned char toHex(unsigned char x)
@@ -42,19 +44,34 @@ std::string urlEncode(const std::string &str)
     return strTemp;
 }
 
+// 用SIMD找到下一个'%'或'+'，中间的普通字符整段拷贝
+// 不完整或不是十六进制的转义原样保留（以前assert失败会让整个服务器退出）
 std::string urlDecode(const std::string &str)
 {
-    std::string strTemp = "";
-    size_t length = str.size();
-    for (size_t i = 0; i < length; i++) {
-        if (str[i] == '+') strTemp += ' ';
-        else if (str[i] == '%') {
-            assert(i + 2 < length);
-            unsigned char high = fromHex((unsigned char)str[++i]);
-            unsigned char low = fromHex((unsigned char)str[++i]);
-            strTemp += high * 16 + low;
+    static const CharSet SPECIAL("%+");
+    std::string strTemp;
+    strTemp.reserve(str.size());
+    const char *p = str.data();
+    const char *end = p + str.size();
+    while (p != end) {
+        const char *special = scanAny(p, end, SPECIAL);
+        strTemp.append(p, special);
+        if (special == end) {
+            break;
+        }
+        p = special + 1;
+        if (*special == '+') {
+            strTemp += ' ';
+        }
+        else if (end - p >= 2 && isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1])) {
+            unsigned char high = fromHex((unsigned char)p[0]);
+            unsigned char low = fromHex((unsigned char)p[1]);
+            strTemp += (char)(high * 16 + low);
+            p += 2;
+        }
+        else {
+            strTemp += '%';
         }
-        else strTemp += str[i];
     }
     return strTemp;
-}
\ No newline at end of file
+}
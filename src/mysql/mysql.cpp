@@ -5,10 +5,11 @@
 #include <pthread.h>
 #include <iostream>
 #include "mysql.h"
+#include <chrono>
 
 using namespace std;
 
-MySQLConnectionPool::MySQLConnectionPool() : mCurConn(0), mFreeConn(0) {}
+MySQLConnectionPool::MySQLConnectionPool() : mMaxConn(0), mCurConn(0), mFreeConn(0), mAcquireCount(0), mWaitCount(0), mWaitTime(0) {}
 
 MySQLConnectionPool *MySQLConnectionPool::getInstance()
 {
@@ -53,10 +54,18 @@ unique_ptr<MYSQL, function<void(MYSQL *)>> MySQLConnectionPool::getConnection()
 {
     MYSQL *con = nullptr;
 
-    if (0 == connList.size())
+    // 连接池没有初始化时直接返回，否则只由信号量决定是否要等待空闲连接
+    if (0 == mMaxConn)
         return nullptr;
 
-    reserve.wait();
+    ++mAcquireCount;
+    if (!reserve.trywait()) {
+        // 没有空闲连接，记录一次争用和等待的时长
+        ++mWaitCount;
+        auto begin = chrono::steady_clock::now();
+        reserve.wait();
+        mWaitTime += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+    }
 
     lock.lock();
 
@@ -118,8 +127,22 @@ MySQLConnectionPool::~MySQLConnectionPool()
     destroyPool();
 }
 
+MYSQL *MySQL::getConn()
+{
+    if (!conn) {
+        conn = MySQLConnectionPool::getInstance()->getConnection();
+    }
+    return conn.get();
+}
+
 string MySQL::findUser(const string &user)
 {
+    MYSQL *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No MySQL connection available");
+        return "";
+    }
+
     char sql[1024] = {0};
     sprintf(sql, "SELECT username, password FROM user where username = '%s'", user.c_str());
 
@@ -140,6 +163,12 @@ string MySQL::findUser(const string &user)
 
 bool MySQL::insertUser(const string &user, const string &pwd)
 {
+    MYSQL *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No MySQL connection available");
+        return false;
+    }
+
     char sql[1024] = {0};
     sprintf(sql, "INSERT INTO user(username, password) VALUES('%s', '%s')", user.c_str(), pwd.c_str());
 
@@ -13,6 +13,7 @@
 #include "../common.h"
 #include <memory>
 #include <functional>
+#include <atomic>
 
 using namespace std;
 
@@ -23,6 +24,11 @@ public:
     int getFreeConn(); // 获取连接
     void destroyPool(); // 销毁所有连接
 
+    // 连接池争用情况的统计
+    long getAcquireCount() const { return mAcquireCount; } // 获取连接的总次数
+    long getWaitCount() const { return mWaitCount; } // 没有空闲连接、需要阻塞等待的次数
+    long getWaitTime() const { return mWaitTime; } // 阻塞等待的总时长（微秒）
+
     static MySQLConnectionPool *getInstance();
 
     void init(const string &url, const string &user, const string &passWord, const string &databaseName, int port, int maxConn);
@@ -37,6 +43,9 @@ private:
     Locker lock;
     list<MYSQL *> connList; // 连接池
     Semaphore reserve;
+    std::atomic<long> mAcquireCount;
+    std::atomic<long> mWaitCount;
+    std::atomic<long> mWaitTime;
 
 public:
     string mUrl; // 主机地址
@@ -46,6 +55,8 @@ public:
     string mDatabaseName; // 使用数据库名
 };
 
+// 数据库连接的惰性句柄：第一次执行查询时才从连接池中获取连接，release()或析构时归还
+// 不需要访问数据库的请求（如静态文件）不会占用连接池
 class MySQL {
 public:
     MySQL() {}
@@ -55,10 +66,12 @@ public:
 
     string findUser(const string &user);
 
-    void setConn(MYSQL *conn) { this->conn = conn; }
+    void release() { conn.reset(); } // 把连接还给连接池
 
 private:
-    MYSQL *conn;
+    MYSQL *getConn(); // 没有连接时从连接池中获取
+
+    unique_ptr<MYSQL, function<void(MYSQL *)>> conn;
 };
 
 #endif
\ No newline at end of file
@@ -1,8 +1,9 @@
 #include "redis.h"
 #include <iostream>
+#include <chrono>
 using namespace std;
 
-RedisConnectionPool::RedisConnectionPool() : mCurConn(0), mFreeConn(0) {}
+RedisConnectionPool::RedisConnectionPool() : mMaxConn(0), mCurConn(0), mFreeConn(0), mAcquireCount(0), mWaitCount(0), mWaitTime(0) {}
 
 RedisConnectionPool *RedisConnectionPool::getInstance()
 {
@@ -36,10 +37,18 @@ unique_ptr<redisContext, function<void(redisContext *)>> RedisConnectionPool::ge
 {
     redisContext *con = nullptr;
 
-    if (0 == connList.size())
+    // 连接池没有初始化时直接返回，否则只由信号量决定是否要等待空闲连接
+    if (0 == mMaxConn)
         return nullptr;
 
-    reserve.wait();
+    ++mAcquireCount;
+    if (!reserve.trywait()) {
+        // 没有空闲连接，记录一次争用和等待的时长
+        ++mWaitCount;
+        auto begin = chrono::steady_clock::now();
+        reserve.wait();
+        mWaitTime += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+    }
 
     lock.lock();
 
@@ -101,8 +110,22 @@ RedisConnectionPool::~RedisConnectionPool()
     destroyPool();
 }
 
+redisContext *Redis::getConn()
+{
+    if (!conn) {
+        conn = RedisConnectionPool::getInstance()->getConnection();
+    }
+    return conn.get();
+}
+
 bool Redis::setTTL(const string &key, int expires)
 {
+    redisContext *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No Redis connection available");
+        return false;
+    }
+
     redisReply *reply = (redisReply *)redisCommand(conn, "EXPIRE %s %d", key.c_str(), expires);
     if (nullptr == reply) {
         LOG_ERROR("EXPIRE command failed!");
@@ -118,6 +141,12 @@ bool Redis::setTTL(const string &key, int expires)
 
 bool Redis::setStrValue(const string &key, const string &value, int expires)
 {
+    redisContext *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No Redis connection available");
+        return false;
+    }
+
     redisReply *reply = nullptr;
     if (expires > 0)
         reply = (redisReply *)redisCommand(conn, "SET %s %s EX %d", key.c_str(), value.c_str(), expires);
@@ -137,6 +166,12 @@ bool Redis::setStrValue(const string &key, const string &value, int expires)
 
 string Redis::getStrValue(const string &key)
 {
+    redisContext *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No Redis connection available");
+        return "";
+    }
+
     redisReply *reply = (redisReply *)redisCommand(conn, "GET %s", key.c_str());
     if (nullptr == reply) {
         LOG_ERROR("GET command failed!");
@@ -154,6 +189,12 @@ string Redis::getStrValue(const string &key)
 
 bool Redis::setAnyHashValue(const string &key, const unordered_map<string, string>& values, int expires)
 {
+    redisContext *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No Redis connection available");
+        return false;
+    }
+
     std::vector<const char *> argv(values.size() * 2 + 2);
     std::vector<size_t> argvlen(values.size() * 2 + 2);
 
@@ -208,6 +249,12 @@ bool Redis::setAnyHashValue(const string &key, const unordered_map<string, strin
 unordered_map<string, string> Redis::getHashAllValue(const std::string& key)
 {
     unordered_map<string, string> valueMap;
+    redisContext *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No Redis connection available");
+        return valueMap;
+    }
+
 	string strField;
 	redisReply *reply = (redisReply *)redisCommand(conn, "HGETALL %s", key.c_str());
     if (reply) {
@@ -236,6 +283,12 @@ unordered_map<string, string> Redis::getHashAllValue(const std::string& key)
 
 bool Redis::beginTransaction()
 {
+    redisContext *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No Redis connection available");
+        return false;
+    }
+
     redisReply *reply = (redisReply *)redisCommand(conn, "MULTI");
     if (reply) {
         if (reply->type == REDIS_REPLY_STATUS && strcasecmp(reply->str, "OK") == 0) {
@@ -252,6 +305,12 @@ bool Redis::beginTransaction()
 
 redisReply *Redis::endTransaction()
 {
+    redisContext *conn = getConn();
+    if (conn == nullptr) {
+        LOG_ERROR("No Redis connection available");
+        return nullptr;
+    }
+
     redisReply *reply = (redisReply *)redisCommand(conn, "EXEC");
     if (reply) {
         return reply;
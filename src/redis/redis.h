@@ -11,6 +11,7 @@
 #include "../log/log.h"
 #include <unordered_map>
 #include <memory>
+#include <atomic>
 using namespace std;
 
 // Redis配置信息
@@ -24,6 +25,11 @@ public:
     int getFreeConn(); // 获取连接
     void destroyPool(); // 销毁所有连接
 
+    // 连接池争用情况的统计
+    long getAcquireCount() const { return mAcquireCount; } // 获取连接的总次数
+    long getWaitCount() const { return mWaitCount; } // 没有空闲连接、需要阻塞等待的次数
+    long getWaitTime() const { return mWaitTime; } // 阻塞等待的总时长（微秒）
+
     static RedisConnectionPool *getInstance();
 
     void init(const string &url, int port, int maxConn);
@@ -38,12 +44,16 @@ private:
     Locker lock;
     list<redisContext *> connList; // 连接池
     Semaphore reserve;
+    std::atomic<long> mAcquireCount;
+    std::atomic<long> mWaitCount;
+    std::atomic<long> mWaitTime;
 
 public:
     string mUrl; // 主机地址
     int mPort; // 数据库端口号
 };
 
+// Redis连接的惰性句柄：第一次执行命令时才从连接池中获取连接，release()或析构时归还
 class Redis {
 public:
     Redis() {}
@@ -63,10 +73,12 @@ public:
 
     redisReply *endTransaction();
 
-    void setConn(redisContext *conn) { this->conn = conn; }
+    void release() { conn.reset(); } // 把连接还给连接池
 
 private:
-    redisContext *conn;
+    redisContext *getConn(); // 没有连接时从连接池中获取
+
+    unique_ptr<redisContext, function<void(redisContext *)>> conn;
 };
 
 #endif
\ No newline at end of file
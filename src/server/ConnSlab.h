@@ -0,0 +1,55 @@
+#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+
+#include "../http/http_conn.h"
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+// 按socket下标存放连接对象的数组，代替unordered_map<int, shared_ptr<HttpConn>>
+// 内核总是分配最小的可用文件描述符，所以fd本身就是紧凑的下标；
+// 数组按块分配，用到哪一块才分配哪一块，最多到maxFd，已经分配的块不会移动，工作线程持有的指针一直有效。
+// 连接关闭后对象留在原位，下一个得到同一个fd的连接直接复用，accept时不再分配内存。
+class ConnSlab {
+public:
+    static const int CHUNK_SIZE = 256; // 每块的连接数
+
+    explicit ConnSlab(int maxFd)
+        : mMaxFd(maxFd), mChunks((maxFd + CHUNK_SIZE - 1) / CHUNK_SIZE) {}
+
+    // 取出fd对应的连接对象，所在的块还没有分配时分配它，fd超出范围返回nullptr
+    HttpConn *acquire(int fd) {
+        if (fd < 0 || fd >= mMaxFd) {
+            return nullptr;
+        }
+        std::unique_ptr<HttpConn[]> &chunk = mChunks[fd / CHUNK_SIZE];
+        if (!chunk) {
+            chunk.reset(new HttpConn[CHUNK_SIZE]);
+        }
+        return &chunk[fd % CHUNK_SIZE];
+    }
+
+    // 查找fd对应的连接对象，没有分配过返回nullptr
+    HttpConn *get(int fd) const {
+        if (fd < 0 || fd >= mMaxFd) {
+            return nullptr;
+        }
+        HttpConn *chunk = mChunks[fd / CHUNK_SIZE].get();
+        return chunk ? &chunk[fd % CHUNK_SIZE] : nullptr;
+    }
+
+    // 查找epoll事件对应的连接，连接已经关闭或者fd已经被新连接复用（代数不同）时返回nullptr
+    HttpConn *get(int fd, uint32_t generation) const {
+        HttpConn *conn = get(fd);
+        if (!conn || conn->getSockfd() != fd || conn->getGeneration() != generation) {
+            return nullptr;
+        }
+        return conn;
+    }
+
+private:
+    int mMaxFd;
+    std::vector<std::unique_ptr<HttpConn[]>> mChunks;
+};
+
+#endif
@@ -0,0 +1,595 @@
+#include "Reactor.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+using namespace std;
+
+Reactor::Reactor(int id, int port, bool reusePort, shared_ptr<ThreadPool<HttpConn>> pool, TimerType timerType, IoBackend backend):
+    mId(id),
+    port(port),
+    mReusePort(reusePort),
+    epollfd(-1),
+    listenfd(-1),
+    signalfd(-1),
+    wakeupfd(-1),
+    timerfd(-1),
+    conns(MAX_FD),
+    pool(pool),
+    events(MAX_EVENT_NUM),
+    timer(createTimerQueue(timerType)),
+    nowMs(0),
+    nextTick(0),
+    armedExpire(-1),
+    mStop(false),
+    mBackend(backend)
+{
+    timer->setTimeoutCallback(bind(&Reactor::onTimeout, this, placeholders::_1));
+    if (FastCgiPool::getInstance()->enabled()) {
+        fcgi.reset(new FastCgiClient(this));
+    }
+}
+
+Reactor::~Reactor()
+{
+    if (epollfd != -1)
+        close(epollfd);
+    if (listenfd != -1)
+        close(listenfd);
+    if (wakeupfd != -1)
+        close(wakeupfd);
+    if (timerfd != -1)
+        close(timerfd);
+}
+
+void Reactor::timerHandler()
+{
+    uint64_t expirations = 0;
+    ::read(timerfd, &expirations, sizeof(expirations));
+    armedExpire = -1;
+
+    // 定时处理任务，实际上就是调用tick()函数
+    timer->tick(nowMs);
+    if (nowMs >= nextTick) {
+        if (tickCallback) {
+            tickCallback();
+        }
+        if (signalfd != -1) {
+            // 工作进程的SIGCHLD由主Reactor处理，推迟的重新启动也由它完成
+            FastCgiPool::getInstance()->respawnWorkers();
+        }
+        if (fcgi) {
+            fcgi->checkWorkers();
+        }
+        nextTick = nowMs + TICK_INTERVAL_MS;
+    }
+}
+
+void Reactor::armTimer()
+{
+    int64_t expire = timer->nextExpire();
+    if (expire < 0 || expire > nextTick) {
+        expire = nextTick;
+    }
+    // 已经设置的时间不晚于需要的时间就不用修改，提前醒来只是多执行一次tick()
+    if (armedExpire != -1 && armedExpire <= expire) {
+        return;
+    }
+    if (expire < 1) {
+        expire = 1; // 全0的it_value表示取消定时器
+    }
+    struct itimerspec ts;
+    memset(&ts, 0, sizeof(ts));
+    ts.it_value.tv_sec = expire / 1000;
+    ts.it_value.tv_nsec = (expire % 1000) * 1000000;
+    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &ts, nullptr) == -1) {
+        LOG_ERROR("%s", "Set timerfd failed.");
+        return;
+    }
+    armedExpire = expire;
+}
+
+void Reactor::onTimeout(int sockfd)
+{
+    // 工作线程还在处理这个连接（比如比空闲超时还长的FastCGI请求），或者它在等待其他请求生成的CGI输出，
+    // 它不是空闲连接，重新计时
+    HttpConn *conn = conns.get(sockfd);
+    if (conn && (conn->inWorker() || conn->parked())) {
+        timer->addTimer(sockfd, nowMs + CONN_TIMEOUT_MS);
+        return;
+    }
+    if (conn && conn->fastCgiWaiting()) {
+        // 等待FastCGI的结果时按请求的超时时间计时，超时的请求返回500
+        int64_t deadline = fcgi->deadline(conn);
+        if (deadline > nowMs) {
+            timer->addTimer(sockfd, deadline);
+            return;
+        }
+        LOG_ERROR("FastCGI request on connection %d timed out.", sockfd);
+        fcgi->cancel(conn);
+        timer->addTimer(sockfd, nowMs + CONN_TIMEOUT_MS);
+        string output;
+        onFastCgiDone(conn, conn->getGeneration(), false, output);
+        return;
+    }
+    closeConn(sockfd);
+}
+
+void Reactor::closeConn(int sockfd)
+{
+    // 工作线程返回之前关闭的话，对象可能被同一个fd上的新连接复用，只做标记，由它交回连接时关闭
+    HttpConn *conn = conns.get(sockfd);
+    if (conn && conn->deferClose()) {
+        return;
+    }
+    if (conn && conn->fastCgiWaiting()) {
+        fcgi->cancel(conn);
+    }
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING) {
+        closeConnUring(sockfd);
+        return;
+    }
+#endif
+    if (conn) {
+        conn->closeConn();
+    }
+}
+
+void Reactor::addClientInfo(int connfd, struct sockaddr_in client_address)
+{
+    // 复用这个fd上一个连接留下的对象，第一次用到这一块时才分配
+    conns.acquire(connfd)->init(connfd, client_address, epollfd, this, mBackend == IO_BACKEND_URING);
+
+    timer->addTimer(connfd, nowMs + CONN_TIMEOUT_MS);
+}
+
+bool Reactor::doClientData()
+{
+    sockaddr_in client_address;
+    socklen_t client_addrlen = sizeof(client_address);
+    int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlen);
+    if (connfd == -1) {
+        // 多个Reactor监听同一端口时，连接可能已经被其他Reactor取走
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("accept");
+            LOG_ERROR("%s", "accept failed.");
+        }
+        return false;
+    }
+
+    char ip[16] = {0};
+    inet_ntop(AF_INET, &client_address.sin_addr ,ip, sizeof(ip));
+    int port = ntohs(client_address.sin_port);
+
+    if (HttpConn::getUserCount() >= MAX_FD || connfd >= MAX_FD) {
+        // 目前连接数满了
+        // 服务器内部正忙
+        close(connfd);
+        LOG_ERROR("Cannot establish with %s", ip);
+        return false;
+    }
+
+    LOG_INFO("client(%s:%d) is connected to reactor %d", ip, port, mId);
+
+    // 将新的客户端数据初始化，放到数组中
+    addClientInfo(connfd, client_address);
+    return true;
+}
+
+bool Reactor::doSignal(bool &stopServer)
+{
+    struct signalfd_siginfo signals[16];
+    int ret = ::read(signalfd, signals, sizeof(signals));
+    if (ret <= 0) {
+        return false;
+    }
+    int num = ret / sizeof(signals[0]);
+    for (int i = 0; i < num; ++i) {
+        switch (signals[i].ssi_signo)  {
+            case SIGTERM:
+            case SIGINT:
+            {
+                stopServer = true;
+                break;
+            }
+            case SIGCHLD:
+            {
+                // CGI子进程退出了，回收它们；FastCGI工作进程退出了，重新启动
+                CgiProcess::reapChildren();
+                FastCgiPool::getInstance()->reapWorkers();
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+void Reactor::doWakeup()
+{
+    uint64_t one = 0;
+    ::read(wakeupfd, &one, sizeof(one));
+}
+
+void Reactor::doTimer(int sockfd)
+{
+    timer->delTimer(sockfd);
+    closeConn(sockfd);
+}
+
+void Reactor::adjustTimer(int sockfd, int64_t expire)
+{
+    // 推迟关闭的连接已经没有定时器了，等工作线程交回后关闭
+    HttpConn *conn = conns.get(sockfd);
+    if (conn && conn->closePending()) {
+        return;
+    }
+    timer->adjustTimer(sockfd, expire);
+}
+
+bool Reactor::dispatch(HttpConn *conn)
+{
+    conn->enterWorker();
+    if (pool->append(conn)) {
+        return true;
+    }
+    // 请求队列满了（服务器过载），交回连接后关闭，否则连接一直被当作在工作线程中，永远不会超时关闭
+    LOG_WARN("Task queue is full, close connection %d.", conn->getSockfd());
+    conn->leaveWorker();
+    doTimer(conn->getSockfd());
+    return false;
+}
+
+void Reactor::doRead(HttpConn *conn)
+{
+    int sockfd = conn->getSockfd();
+    if (conn->cgiRelayingBody()) {
+        // 收到的是CGI请求的请求体，直接转给CGI的标准输入
+        adjustTimer(sockfd, nowMs + CONN_TIMEOUT_MS);
+        conn->writeCgiInput();
+        return;
+    }
+    if (conn->read()) {
+        // 一次性把所有数据都读完
+        if (dispatch(conn)) {
+            adjustTimer(sockfd, nowMs + CONN_TIMEOUT_MS);
+        }
+    } else {
+        doTimer(sockfd);
+    }
+}
+
+void Reactor::doWrite(HttpConn *conn)
+{
+    int sockfd = conn->getSockfd();
+    // 一次性把所有数据都写完
+    if (conn->write()) {
+        adjustTimer(sockfd, nowMs + CONN_TIMEOUT_MS);
+        if (conn->pendingBytes() == 0 && conn->hasBufferedRequest() && !conn->cgiRunning()) {
+            // 流水线中还有已经收到的请求，write()没有重新等待读，直接交给工作线程
+            dispatch(conn);
+        }
+    }
+    else {
+        doTimer(sockfd);
+    }
+}
+
+void Reactor::doCgi(int sockfd, uint32_t serial, bool input)
+{
+    // 连接已经关闭、子进程已经结束或者已经换了一个子进程，忽略遗留的事件
+    HttpConn *conn = conns.get(sockfd);
+    if (!conn || conn->getSockfd() != sockfd || serial == 0 || conn->getCgiSerial() != serial) {
+        return;
+    }
+    adjustTimer(sockfd, nowMs + CONN_TIMEOUT_MS);
+    if (input) {
+        conn->writeCgiInput();
+        return;
+    }
+    // 读到的输出生成要发送的数据，发送完之后再继续读
+    conn->readCgiOutput();
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING) {
+        submitSend(conn);
+        return;
+    }
+#endif
+    doWrite(conn);
+}
+
+void Reactor::submitFastCgi(HttpConn *conn)
+{
+    // 工作线程还没有返回时连接已经决定关闭
+    if (conn->closePending() || !conn->fastCgiWaiting()) {
+        return;
+    }
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING && uringState(conn->getSockfd()).closing) {
+        return;
+    }
+#endif
+    string input;
+    vector<pair<string, string>> params = conn->cgiEnvironment(input);
+    fcgi->submit(conn, conn->getGeneration(), params, input, nowMs);
+}
+
+void Reactor::onFastCgiDone(HttpConn *conn, uint32_t generation, bool ok, string &output)
+{
+    // 等待结果期间连接可能已经关闭，甚至对象已经被新连接复用
+    int sockfd = conn->getSockfd();
+    if (sockfd == -1 || conn->getGeneration() != generation || !conn->fastCgiWaiting()) {
+        return;
+    }
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING && uringState(sockfd).closing) {
+        return;
+    }
+#endif
+    conn->setFastCgiOutput(ok, output);
+    if (conn->pendingBytes() > 0) {
+        // 前面的响应还在发送，发送完之后再生成这个响应
+        return;
+    }
+    adjustTimer(sockfd, nowMs + CONN_TIMEOUT_MS);
+    conn->readFastCgiOutput();
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING) {
+        submitSend(conn);
+        return;
+    }
+#endif
+    doWrite(conn);
+}
+
+void Reactor::watchFastCgi(int fd, uint32_t serial, bool add, bool writable)
+{
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING) {
+        armFastCgi(fd, serial, add, writable);
+        return;
+    }
+#endif
+    // 水平触发，一直等待可读，有没写完的记录时同时等待可写
+    epoll_event event;
+    event.data.u64 = makeEpollData(fd, serial, EPOLL_SOURCE_FCGI);
+    event.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    epoll_ctl(epollfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+}
+
+void Reactor::unwatchFastCgi(int fd, uint32_t serial)
+{
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING) {
+        cancelFastCgi(fd, serial);
+        return;
+    }
+#endif
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Reactor::stop()
+{
+    mStop = true;
+    uint64_t one = 1;
+    ::write(wakeupfd, &one, sizeof(one));
+}
+
+void Reactor::setSignalFd(int fd)
+{
+    signalfd = fd;
+    if (mBackend == IO_BACKEND_EPOLL) {
+        addfd(epollfd, signalfd, false, false);
+    }
+}
+
+void Reactor::onRearm(HttpConn *conn, uint32_t generation, int ev)
+{
+    rearmLock.lock();
+    bool wasEmpty = rearmTasks.empty();
+    rearmTasks.push_back({conn, generation, ev});
+    rearmLock.unlock();
+    // 队列原来不为空时Reactor已经被唤醒过了，还没来得及处理
+    if (wasEmpty) {
+        uint64_t one = 1;
+        ::write(wakeupfd, &one, sizeof(one));
+    }
+}
+
+void Reactor::doRearmTasks()
+{
+    // 先读eventfd再取任务，取走任务之后新加入的任务一定会再写一次eventfd
+    doWakeup();
+    rearmLock.lock();
+    rearmBatch.swap(rearmTasks);
+    rearmLock.unlock();
+    for (const RearmTask &task : rearmBatch) {
+        HttpConn *conn = task.conn;
+        // 工作线程处理期间连接可能已经超时关闭，甚至fd已经被新连接复用
+        if (conn->getSockfd() == -1 || conn->getGeneration() != task.generation) {
+            continue;
+        }
+        if (task.ev == HttpConn::EV_CLOSE) {
+            doTimer(conn->getSockfd());
+            continue;
+        }
+        if (task.ev == HttpConn::EV_FCGI) {
+            submitFastCgi(conn);
+            continue;
+        }
+        if (task.ev == HttpConn::EV_RESUME) {
+            // 挂起它的工作线程还没有返回时，由它返回时再通知
+            if (!conn->deferResume()) {
+                dispatch(conn);
+            }
+            continue;
+        }
+#ifdef WITH_IO_URING
+        rearmUring(conn, task.ev);
+#endif
+    }
+    rearmBatch.clear();
+}
+
+void Reactor::eventLoop()
+{
+#ifdef WITH_IO_URING
+    if (mBackend == IO_BACKEND_URING) {
+        eventLoopUring();
+        return;
+    }
+#endif
+
+    bool stopServer = false;
+    bool timeout = false;
+    nowMs = currentTimeMs();
+    nextTick = nowMs + TICK_INTERVAL_MS;
+    while (!stopServer && !mStop) {
+        // 每个Reactor有自己的timerfd，设置为最早的定时器到期时间，和I/O事件一起等待
+        armTimer();
+        int num = epoll_wait(epollfd, &events[0], MAX_EVENT_NUM, -1);
+        if (num < 0 && errno != EINTR) {
+            LOG_ERROR("%s", "Epoll failed.");
+            break;
+        }
+        nowMs = currentTimeMs();
+
+        // 循环遍历事件数组
+        for (int i = 0; i < num; ++i) {
+            int sockfd = epollDataFd(events[i].data.u64);
+            if (sockfd == listenfd) {
+                // 有客户端连接进来
+                if (!doClientData())
+                    continue;
+            }
+            else if (sockfd == wakeupfd) {
+                doRearmTasks();
+            }
+            else if (sockfd == timerfd) {
+                timeout = true;
+            }
+            else if ((sockfd == signalfd) && (events[i].events & EPOLLIN)) {
+                // 说明有信号到来，要处理信号
+                doSignal(stopServer);
+            }
+            else if (epollDataSource(events[i].data.u64) == EPOLL_SOURCE_FCGI) {
+                fcgi->onEvent(sockfd, epollDataGeneration(events[i].data.u64),
+                              events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR), events[i].events & EPOLLOUT);
+            }
+            else if (epollDataSource(events[i].data.u64) != EPOLL_SOURCE_SOCKET) {
+                // CGI管道的事件，管道关闭（EPOLLHUP、EPOLLERR）时读写会得到结果，和可读可写一样处理
+                doCgi(sockfd, epollDataGeneration(events[i].data.u64), epollDataSource(events[i].data.u64) == EPOLL_SOURCE_CGI_INPUT);
+            }
+            else {
+                // 连接在本轮前面的事件中已经关闭，或者fd已经被新连接复用，忽略旧连接的事件
+                HttpConn *conn = conns.get(sockfd, epollDataGeneration(events[i].data.u64));
+                if (!conn) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    // 对方异常端口或者错误等事件
+                    // 关闭连接
+                    doTimer(sockfd);
+                }
+                else if (events[i].events & EPOLLIN) {
+                    doRead(conn);
+                }
+                else if (events[i].events & EPOLLOUT) {
+                    doWrite(conn);
+                }
+            }
+        }
+
+        // 最后处理定时事件，因为I/O事件有更高的优先级。当然，这样做将导致定时任务不能精准的按照预定的时间执行。
+        if (timeout) {
+            timerHandler();
+            timeout = false;
+        }
+    }
+}
+
+void Reactor::eventListen()
+{
+    // 创建监听的套接字
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd == -1) {
+        perror("socket");
+        LOG_ERROR("%s", "Create socket failed.");
+        exit(CREATE_SOCKET_ERROR);
+    }
+
+    struct linger tmp = {1, 1};
+    setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+
+    // 设置端口复用
+    // 端口复用一定要在绑定前设置
+    int reuse = 1;
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) {
+        perror("setsockopt");
+        LOG_ERROR("%s", "Set reuse port failed.");
+        exit(SET_REUSE_PORT_ERROR);
+    }
+    // 多个Reactor各自创建监听socket绑定到同一端口，由内核在它们之间分发新连接
+    if (mReusePort && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+        perror("setsockopt");
+        LOG_ERROR("%s", "Set reuse port failed.");
+        exit(SET_REUSE_PORT_ERROR);
+    }
+
+    // 绑定
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(listenfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("bind");
+        LOG_ERROR("%s", "bind failed.");
+        exit(BIND_ERROR);
+    }
+
+    // 监听
+    if (listen(listenfd, 100) == -1) {
+        perror("listen");
+        LOG_ERROR("%s", "listen failed.");
+        exit(LISTEN_ERROR);
+    }
+
+    wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupfd == -1) {
+        perror("eventfd");
+        LOG_ERROR("%s", "Create eventfd failed.");
+        exit(CREATE_EPOLL_ERROR);
+    }
+
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd == -1) {
+        perror("timerfd_create");
+        LOG_ERROR("%s", "Create timerfd failed.");
+        exit(CREATE_TIMERFD_ERROR);
+    }
+
+    if (mBackend == IO_BACKEND_URING) {
+#ifdef WITH_IO_URING
+        if (initUring()) {
+            // 监听socket、eventfd、timerfd都由io_uring等待，不需要epoll
+            return;
+        }
+#else
+        LOG_WARN("%s", "io_uring backend is not compiled in, fall back to epoll.");
+#endif
+        mBackend = IO_BACKEND_EPOLL;
+    }
+
+    // 创建epoll对象，事件数组，添加
+    epollfd = epoll_create(5);
+    if (epollfd == -1) {
+        perror("epoll_create");
+        LOG_ERROR("%s", "Create epoll failed.");
+        exit(CREATE_EPOLL_ERROR);
+    }
+
+    // 将监听的文件描述符添加到epoll对象中，监听socket设为非阻塞，避免多个Reactor抢同一个连接时阻塞在accept上
+    addfd(epollfd, listenfd, false, false);
+    addfd(epollfd, wakeupfd, false, false);
+    addfd(epollfd, timerfd, false, false);
+}
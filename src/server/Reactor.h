@@ -0,0 +1,144 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "../common.h"
+#include "../http/http_conn.h"
+#include "../thread/threadpool.h"
+#include "../utils/utils.h"
+#include "../epoll/epoll.h"
+#include "../log/log.h"
+#include "../timer/Timer.h"
+#include "../thread/locker.h"
+#include "../uring/uring.h"
+#include "ConnSlab.h"
+#include <atomic>
+
+// 一个Reactor对应一个事件循环（one loop per thread）
+// 每个Reactor拥有自己的epoll对象、监听socket（多Reactor时使用SO_REUSEPORT）、连接表和定时器
+// accept、读写以及定时器都在Reactor所在的线程中完成，工作线程只负责解析请求和生成响应
+// 网络I/O可以使用epoll（就绪通知）或io_uring（完成通知，见ReactorUring.cpp）
+class Reactor : public ConnListener, public FastCgiListener {
+public:
+    static const int MAX_FD = 1 << 20; // 连接表按块分配，只有用到的部分占用内存
+    static const int MAX_EVENT_NUM = 10000;
+    static const int CONN_TIMEOUT_MS = 15000; // 连接空闲超过15s就关闭
+    static const int TICK_INTERVAL_MS = 5000; // 每隔5s执行一次tickCallback
+
+public:
+    Reactor(int id, int port, bool reusePort, std::shared_ptr<ThreadPool<HttpConn>> pool,
+            TimerType timerType = TIMER_HEAP, IoBackend backend = IO_BACKEND_EPOLL);
+    ~Reactor();
+
+    void eventListen(); // 创建监听socket和epoll对象
+    void eventLoop(); // 事件循环，直到stop()被调用或收到终止信号
+    void stop(); // 可以在其他线程中调用，唤醒事件循环并退出
+    void setSignalFd(int fd); // 由主Reactor监听signalfd
+    void setTickCallback(const std::function<void()> &cb) { tickCallback = cb; } // 每隔TICK_INTERVAL_MS额外执行的任务
+
+    int getId() const { return mId; }
+
+    // 工作线程调用，把连接交回Reactor线程：io_uring模式下提交读写请求，两种模式下都用来执行被推迟的关闭（EV_CLOSE），
+    // 以及重新处理挂在CGI缓存上的请求（EV_RESUME，由生成结果的线程调用）、转发FastCGI请求（EV_FCGI）
+    void onRearm(HttpConn *conn, uint32_t generation, int ev) override;
+
+    // FastCgiClient在Reactor线程中调用：等待到工作进程的连接上的事件，以及请求结束时生成响应
+    void watchFastCgi(int fd, uint32_t serial, bool add, bool writable) override;
+    void unwatchFastCgi(int fd, uint32_t serial) override;
+    void onFastCgiDone(HttpConn *conn, uint32_t generation, bool ok, std::string &output) override;
+
+private:
+    struct RearmTask {
+        HttpConn *conn;
+        uint32_t generation;
+        int ev;
+    };
+
+    bool dispatch(HttpConn *conn); // 把连接交给线程池处理，请求队列满了时关闭连接并返回false
+    void doRearmTasks(); // 处理工作线程交回的连接
+    void doWrite(HttpConn *conn);
+    void doRead(HttpConn *conn);
+    void doCgi(int sockfd, uint32_t serial, bool input); // CGI子进程的标准输入可写或者标准输出可读
+    void submitFastCgi(HttpConn *conn); // 把工作线程交回的FastCGI请求发给工作进程
+    bool doClientData();
+    bool doSignal(bool &stopServer);
+    void doWakeup();
+    void addClientInfo(int connfd, struct sockaddr_in client_address);
+    void doTimer(int sockfd); // 主动关闭连接（出错、不保持连接），删除它的定时器
+    void adjustTimer(int sockfd, int64_t expire);
+    void onTimeout(int sockfd); // 定时器到期
+    void closeConn(int sockfd);
+    void timerHandler();
+    void armTimer(); // 按最早的到期时间设置timerfd
+
+#ifdef WITH_IO_URING
+    // io_uring请求的user_data：高8位是请求类型，中间24位是连接的代数，低32位是fd
+    // CGI管道的poll请求中代数换成CGI子进程的序号，不计入inflight（管道不是连接的socket）
+    // FastCGI连接的poll请求中fd是到工作进程的socket，代数换成连接的序号
+    enum UringOp { URING_ACCEPT = 1, URING_WAKEUP, URING_TIMER, URING_SIGNAL, URING_RECV, URING_SEND, URING_CLOSE,
+                   URING_CGI_INPUT, URING_CGI_OUTPUT, URING_CANCEL, URING_FCGI_READ, URING_FCGI_WRITE };
+
+    // 每个连接在io_uring中的状态，只在Reactor线程中访问
+    struct UringConnState {
+        int inflight = 0; // 已经提交还没有完成的请求数，为0之前不能关闭socket（fd可能被新连接复用）
+        bool sending = false; // 有writev请求在执行
+        bool closeLinked = false; // writev后面链接了close请求
+        bool closing = false; // 已经决定关闭，等所有请求完成后再关闭
+        size_t received = 0; // 上次交给工作线程之后收到的字节数
+    };
+
+    static const unsigned URING_ENTRIES = 4096;
+    static const unsigned URING_BUF_COUNT = 1024; // 接收缓冲区的数量，所有连接共用
+    static const unsigned URING_BUF_SIZE = 4096;
+    static const uint16_t URING_BUF_GROUP = 0;
+    static const size_t URING_RECV_BATCH = 65536; // socket中还有数据时最多连续接收这么多就交给工作线程，上传大文件时读缓冲区不会随着上传增长
+
+    bool initUring();
+    void eventLoopUring();
+    void handleCqe(const io_uring_cqe &cqe, bool &stopServer, bool &timeout);
+    void acceptUring(int connfd);
+    void submitRecv(HttpConn *conn);
+    void submitSend(HttpConn *conn);
+    void nextRequest(HttpConn *conn); // 响应发送完毕，继续等待CGI的输出、处理流水线中剩下的请求或者继续接收
+    void armCgi(HttpConn *conn, int ev); // 等待CGI管道可写（EV_CGI_INPUT）或可读（EV_CGI_OUTPUT）
+    void armFastCgi(int fd, uint32_t serial, bool add, bool writable);
+    void cancelFastCgi(int fd, uint32_t serial);
+    void onRecv(HttpConn *conn, const io_uring_cqe &cqe);
+    void onSend(HttpConn *conn, const io_uring_cqe &cqe);
+    void onClose(HttpConn *conn, const io_uring_cqe &cqe);
+    void rearmUring(HttpConn *conn, int ev);
+    void closeConnUring(int sockfd);
+    void finishClose(int sockfd, bool closeFd);
+    UringConnState &uringState(int fd);
+#endif
+
+private:
+    int mId;
+    int port;
+    bool mReusePort;
+    int epollfd;
+    int listenfd;
+    int signalfd; // signalfd，只有主Reactor设置
+    int wakeupfd; // eventfd，用于其他线程唤醒本事件循环
+    int timerfd; // 定时器到期时可读，和I/O事件一起由epoll等待
+    sockaddr_in address;
+    ConnSlab conns; // 按socket下标存放的连接对象
+    std::shared_ptr<ThreadPool<HttpConn>> pool; // 所有Reactor共享的线程池
+    std::vector<epoll_event> events;
+    std::unique_ptr<TimerQueue> timer; // 管理非活跃连接的定时器（最小堆或时间轮）
+    int64_t nowMs; // 每轮循环在epoll_wait返回后读一次时钟，本轮的定时器操作都使用这个时间
+    int64_t nextTick; // 下一次执行tickCallback的时间
+    int64_t armedExpire; // timerfd当前设置的到期时间，-1表示没有设置
+    std::function<void()> tickCallback;
+    std::atomic<bool> mStop;
+    IoBackend mBackend;
+    std::vector<RearmTask> rearmTasks; // 工作线程交回的连接
+    std::vector<RearmTask> rearmBatch;
+    Locker rearmLock;
+    std::unique_ptr<FastCgiClient> fcgi; // 到FastCGI工作进程的连接，没有使用FastCGI时为空
+#ifdef WITH_IO_URING
+    std::unique_ptr<IoUring> ring;
+    std::vector<UringConnState> uringStates; // 按socket下标
+#endif
+};
+
+#endif
@@ -0,0 +1,430 @@
+#include "Reactor.h"
+
+#ifdef WITH_IO_URING
+
+#include <poll.h>
+#include <sys/socket.h>
+
+// io_uring模式的事件循环
+// epoll模式下每个请求至少需要：epoll_wait、读到EAGAIN为止的readv、工作线程中的epoll_ctl、
+// epoll_wait、writev、再一次epoll_ctl。io_uring模式下accept是多次触发的（一次提交，每个新连接一个完成事件），
+// recv由内核从注册的缓冲区组中挑选缓冲区，不再需要为每个连接预留接收缓冲区，
+// 不保持连接的响应把writev和close链接在一起提交；所有请求在每轮循环中用一次io_uring_enter批量提交并等待完成。
+// 工作线程不能使用提交队列，处理完请求后把连接放入rearmTasks并通过eventfd唤醒Reactor，由Reactor提交后续的读写。
+
+static uint64_t uringData(int op, int fd, uint32_t generation)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(generation & 0xffffff) << 32) | (uint32_t)fd;
+}
+
+static int uringDataOp(uint64_t data)
+{
+    return (int)(data >> 56);
+}
+
+static int uringDataFd(uint64_t data)
+{
+    return (int)(uint32_t)data;
+}
+
+static uint32_t uringDataGeneration(uint64_t data)
+{
+    return (uint32_t)(data >> 32) & 0xffffff;
+}
+
+bool Reactor::initUring()
+{
+    ring.reset(new IoUring());
+    if (!ring->init(URING_ENTRIES)) {
+        perror("io_uring_setup");
+        LOG_WARN("%s", "Create io_uring failed, fall back to epoll.");
+        ring.reset();
+        return false;
+    }
+    if (!ring->provideBuffers(URING_BUF_COUNT, URING_BUF_SIZE, URING_BUF_GROUP)) {
+        perror("io_uring provide buffers");
+        LOG_WARN("%s", "Provide io_uring buffers failed, fall back to epoll.");
+        ring.reset();
+        return false;
+    }
+    return true;
+}
+
+Reactor::UringConnState &Reactor::uringState(int fd)
+{
+    if (fd >= (int)uringStates.size()) {
+        uringStates.resize(std::max(fd + 1, (int)uringStates.size() * 2));
+    }
+    return uringStates[fd];
+}
+
+void Reactor::rearmUring(HttpConn *conn, int ev)
+{
+    if (uringState(conn->getSockfd()).closing) {
+        return;
+    }
+    if (ev == HttpConn::EV_CGI_INPUT || ev == HttpConn::EV_CGI_OUTPUT) {
+        armCgi(conn, ev);
+    }
+    else if (ev == EPOLLIN) {
+        submitRecv(conn);
+    }
+    else {
+        submitSend(conn);
+    }
+}
+
+void Reactor::acceptUring(int connfd)
+{
+    if (HttpConn::getUserCount() >= MAX_FD || connfd >= MAX_FD) {
+        close(connfd);
+        LOG_ERROR("Cannot establish connection %d", connfd);
+        return;
+    }
+
+    // 多次触发的accept不返回对端地址，为了省掉一次getpeername，这里只记录fd
+    LOG_INFO("client(fd %d) is connected to reactor %d", connfd, mId);
+
+    struct sockaddr_in client_address;
+    memset(&client_address, 0, sizeof(client_address));
+    addClientInfo(connfd, client_address);
+    uringState(connfd) = UringConnState();
+    submitRecv(conns.get(connfd));
+}
+
+void Reactor::submitRecv(HttpConn *conn)
+{
+    int fd = conn->getSockfd();
+    uringState(fd).inflight++;
+    ring->prepRecv(fd, URING_BUF_GROUP, uringData(URING_RECV, fd, conn->getGeneration()));
+}
+
+void Reactor::submitSend(HttpConn *conn)
+{
+    int fd = conn->getSockfd();
+    UringConnState &state = uringState(fd);
+    if (conn->pendingBytes() == 0) {
+        if (conn->finishResponse()) {
+            nextRequest(conn);
+        }
+        else {
+            doTimer(fd);
+        }
+        return;
+    }
+
+    state.inflight++;
+    state.sending = true;
+    io_uring_sqe *sqe = ring->prepWritev(fd, conn->getIov(), conn->getIovCount(), uringData(URING_SEND, fd, conn->getGeneration()));
+    if (!conn->keepAlive() && !state.closeLinked && !conn->cgiRunning() && !conn->inWorker()) {
+        // 不保持连接：writev完整写完后由内核接着关闭socket，省掉一次系统调用；
+        // 写了一部分时链接的close会被取消（-ECANCELED），继续发送剩下的数据
+        // 工作线程还没有返回时不链接：内核关闭之后fd马上可能被新连接复用，由onSend关闭时可以等它返回
+        sqe->flags |= IOSQE_IO_LINK;
+        state.inflight++;
+        state.closeLinked = true;
+        ring->prepClose(fd, uringData(URING_CLOSE, fd, conn->getGeneration()));
+    }
+}
+
+void Reactor::nextRequest(HttpConn *conn)
+{
+    if (conn->fastCgiPending()) {
+        // FastCGI的结果已经到了就生成响应，否则由onFastCgiDone生成
+        if (conn->fastCgiReady()) {
+            conn->readFastCgiOutput();
+            submitSend(conn);
+        }
+    }
+    else if (conn->cgiRunning()) {
+        // CGI的输出还没有读完，发送完这一块再继续读
+        armCgi(conn, HttpConn::EV_CGI_OUTPUT);
+    }
+    else if (conn->hasBufferedRequest()) {
+        // 流水线中还有已经收到的请求，不用等待新的数据
+        dispatch(conn);
+    }
+    else {
+        submitRecv(conn);
+    }
+}
+
+void Reactor::armCgi(HttpConn *conn, int ev)
+{
+    bool input = ev == HttpConn::EV_CGI_INPUT;
+    int fd = conn->getCgiFd(input);
+    if (fd == -1) {
+        return;
+    }
+    ring->prepPoll(fd, input ? POLLOUT : POLLIN,
+                   uringData(input ? URING_CGI_INPUT : URING_CGI_OUTPUT, conn->getSockfd(), conn->getCgiSerial()));
+}
+
+void Reactor::armFastCgi(int fd, uint32_t serial, bool add, bool writable)
+{
+    // 可读用多次触发的poll，新连接时提交一次；可写只在记录没有写完时等待一次
+    if (add) {
+        ring->prepPollMultishot(fd, POLLIN, uringData(URING_FCGI_READ, fd, serial));
+    }
+    if (writable) {
+        ring->prepPoll(fd, POLLOUT, uringData(URING_FCGI_WRITE, fd, serial));
+    }
+}
+
+void Reactor::cancelFastCgi(int fd, uint32_t serial)
+{
+    // 请求不存在时取消失败，不影响；取消后的完成事件因为序号不同被忽略
+    ring->prepCancel(uringData(URING_FCGI_READ, fd, serial), uringData(URING_CANCEL, fd, 0));
+    ring->prepCancel(uringData(URING_FCGI_WRITE, fd, serial), uringData(URING_CANCEL, fd, 0));
+}
+
+void Reactor::onRecv(HttpConn *conn, const io_uring_cqe &cqe)
+{
+    int fd = conn->getSockfd();
+    UringConnState &state = uringState(fd);
+    state.inflight--;
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe.res > 0 && !state.closing) {
+            conn->appendRead(ring->getBuffer(bid), cqe.res);
+            state.received += cqe.res;
+        }
+        ring->recycleBuffer(bid);
+    }
+
+    if (state.closing) {
+        finishClose(fd, true);
+    }
+    else if (cqe.res == -ENOBUFS) {
+        // 缓冲区暂时都在使用中，本轮处理完的缓冲区已经还回去了，重新提交
+        submitRecv(conn);
+    }
+    else if (cqe.res <= 0) {
+        // 对方关闭连接或者出错
+        doTimer(fd);
+    }
+    else if ((cqe.flags & IORING_CQE_F_SOCK_NONEMPTY) && state.received < URING_RECV_BATCH) {
+        // socket中还有数据，读完再交给工作线程
+        submitRecv(conn);
+    }
+    else {
+        state.received = 0;
+        if (dispatch(conn)) {
+            adjustTimer(fd, nowMs + CONN_TIMEOUT_MS);
+        }
+    }
+}
+
+void Reactor::onSend(HttpConn *conn, const io_uring_cqe &cqe)
+{
+    int fd = conn->getSockfd();
+    UringConnState &state = uringState(fd);
+    state.inflight--;
+    state.sending = false;
+
+    if (state.closing) {
+        finishClose(fd, true);
+    }
+    else if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+        submitSend(conn);
+    }
+    else if (cqe.res < 0) {
+        doTimer(fd);
+    }
+    else if (conn->onWritten(cqe.res)) {
+        adjustTimer(fd, nowMs + CONN_TIMEOUT_MS);
+        if (conn->finishResponse()) {
+            nextRequest(conn);
+        }
+        else if (!state.closeLinked) {
+            doTimer(fd);
+        }
+        // 否则等待链接的close完成
+    }
+    else {
+        adjustTimer(fd, nowMs + CONN_TIMEOUT_MS);
+        submitSend(conn);
+    }
+}
+
+void Reactor::onClose(HttpConn *conn, const io_uring_cqe &cqe)
+{
+    int fd = conn->getSockfd();
+    UringConnState &state = uringState(fd);
+    state.inflight--;
+    state.closeLinked = false;
+
+    if (cqe.res == 0) {
+        // socket已经由内核关闭，只需要清理连接
+        timer->delTimer(fd);
+        finishClose(fd, false);
+    }
+    else if (state.closing) {
+        finishClose(fd, true);
+    }
+    else if (!state.sending && conn->pendingBytes() == 0) {
+        // writev写了一部分，剩下的数据已经发送完了，在这里关闭
+        doTimer(fd);
+    }
+}
+
+void Reactor::closeConnUring(int sockfd)
+{
+    HttpConn *conn = conns.get(sockfd);
+    if (!conn || conn->getSockfd() == -1) {
+        return;
+    }
+    UringConnState &state = uringState(sockfd);
+    if (state.inflight > 0) {
+        // 内核还在使用这个fd，先让进行中的请求尽快结束，全部完成后再关闭，避免fd被复用后关错连接
+        if (!state.closing) {
+            state.closing = true;
+            shutdown(sockfd, SHUT_RDWR);
+        }
+        return;
+    }
+    finishClose(sockfd, true);
+}
+
+void Reactor::finishClose(int sockfd, bool closeFd)
+{
+    UringConnState &state = uringState(sockfd);
+    if (state.inflight > 0) {
+        return;
+    }
+    HttpConn *conn = conns.get(sockfd);
+    if (conn && conn->cgiRunning()) {
+        // 等待CGI管道的poll请求还引用着管道，取消掉；请求不存在时取消失败，不影响
+        uint32_t serial = conn->getCgiSerial();
+        ring->prepCancel(uringData(URING_CGI_INPUT, sockfd, serial), uringData(URING_CANCEL, sockfd, 0));
+        ring->prepCancel(uringData(URING_CGI_OUTPUT, sockfd, serial), uringData(URING_CANCEL, sockfd, 0));
+    }
+    if (conn) {
+        conn->closeConn(closeFd);
+    }
+    state = UringConnState();
+}
+
+void Reactor::handleCqe(const io_uring_cqe &cqe, bool &stopServer, bool &timeout)
+{
+    int op = uringDataOp(cqe.user_data);
+    int fd = uringDataFd(cqe.user_data);
+    bool more = cqe.flags & IORING_CQE_F_MORE; // 多次触发的请求是否还会继续产生完成事件
+
+    switch (op) {
+        case URING_ACCEPT:
+            if (cqe.res >= 0) {
+                acceptUring(cqe.res);
+            }
+            else if (cqe.res != -EAGAIN && cqe.res != -ECONNABORTED) {
+                LOG_ERROR("accept failed: %s", strerror(-cqe.res));
+            }
+            if (!more) {
+                ring->prepAcceptMultishot(listenfd, uringData(URING_ACCEPT, listenfd, 0));
+            }
+            break;
+        case URING_WAKEUP:
+            doRearmTasks();
+            if (!more) {
+                ring->prepPollMultishot(wakeupfd, POLLIN, uringData(URING_WAKEUP, wakeupfd, 0));
+            }
+            break;
+        case URING_TIMER:
+            timeout = true;
+            if (!more) {
+                ring->prepPollMultishot(timerfd, POLLIN, uringData(URING_TIMER, timerfd, 0));
+            }
+            break;
+        case URING_SIGNAL:
+            doSignal(stopServer);
+            if (!more) {
+                ring->prepPollMultishot(signalfd, POLLIN, uringData(URING_SIGNAL, signalfd, 0));
+            }
+            break;
+        case URING_CGI_INPUT:
+        case URING_CGI_OUTPUT:
+            // 连接可能正在关闭，这时不再处理CGI的事件
+            if (fd < (int)uringStates.size() && uringStates[fd].closing) {
+                break;
+            }
+            doCgi(fd, uringDataGeneration(cqe.user_data), op == URING_CGI_INPUT);
+            break;
+        case URING_FCGI_READ:
+        case URING_FCGI_WRITE:
+        {
+            if (cqe.res < 0) {
+                // 连接关闭时取消的poll请求
+                break;
+            }
+            uint32_t serial = uringDataGeneration(cqe.user_data);
+            bool open = fcgi->onEvent(fd, serial, cqe.res & (POLLIN | POLLHUP | POLLERR), cqe.res & POLLOUT);
+            if (op == URING_FCGI_READ && !more && open) {
+                ring->prepPollMultishot(fd, POLLIN, uringData(URING_FCGI_READ, fd, serial));
+            }
+            break;
+        }
+        case URING_RECV:
+        case URING_SEND:
+        case URING_CLOSE:
+        {
+            // 关闭要等到连接的请求全部完成，所以完成事件到达时fd一定还属于这个连接
+            HttpConn *conn = conns.get(fd);
+            if (!conn || conn->getSockfd() != fd) {
+                LOG_ERROR("io_uring completion for closed connection %d", fd);
+                break;
+            }
+            if (op == URING_RECV) {
+                onRecv(conn, cqe);
+            }
+            else if (op == URING_SEND) {
+                onSend(conn, cqe);
+            }
+            else {
+                onClose(conn, cqe);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void Reactor::eventLoopUring()
+{
+    bool stopServer = false;
+    bool timeout = false;
+    nowMs = currentTimeMs();
+    nextTick = nowMs + TICK_INTERVAL_MS;
+
+    ring->prepAcceptMultishot(listenfd, uringData(URING_ACCEPT, listenfd, 0));
+    ring->prepPollMultishot(wakeupfd, POLLIN, uringData(URING_WAKEUP, wakeupfd, 0));
+    ring->prepPollMultishot(timerfd, POLLIN, uringData(URING_TIMER, timerfd, 0));
+    if (signalfd != -1) {
+        ring->prepPollMultishot(signalfd, POLLIN, uringData(URING_SIGNAL, signalfd, 0));
+    }
+
+    while (!stopServer && !mStop) {
+        armTimer();
+        // 提交本轮产生的所有请求，并等待至少一个完成事件
+        int ret = ring->submitAndWait(1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+            LOG_ERROR("io_uring_enter failed: %s", strerror(-ret));
+            break;
+        }
+        nowMs = currentTimeMs();
+
+        io_uring_cqe cqe;
+        while (ring->peekCqe(cqe)) {
+            handleCqe(cqe, stopServer, timeout);
+        }
+
+        // 最后处理定时事件，因为I/O事件有更高的优先级
+        if (timeout) {
+            timerHandler();
+            timeout = false;
+        }
+    }
+}
+
+#endif
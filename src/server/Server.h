@@ -11,26 +11,34 @@
 #include "../timer/Timer.h"
 #include "../mysql/mysql.h"
 #include "../config/config.h"
+#include "../cache/file_cache.h"
+#include "../cache/response_cache.h"
+#include "../cache/cgi_cache.h"
+#include "../fcgi/fcgi.h"
+#include "Reactor.h"
 
 class WebServer {
-private:
-    static const int MAX_FD = 65536;
-    static const int MAX_EVENT_NUM = 10000;
-
 private:
     int port;
-    int epollfd;
-    int listenfd;
-    sockaddr_in address;
-    std::unordered_map<int, std::shared_ptr<HttpConn>> usersConn;
     std::shared_ptr<ThreadPool<HttpConn>> pool; // 线程池
-    static int pipefd[2];
-    epoll_event events[MAX_EVENT_NUM];
-    static const int TIMESLOT = 5; // 每隔5s的定时，检测有没有任务超时
-    static TimerHeap timerHeap;
+    int mSignalFd = -1; // 终止信号通过signalfd交给主Reactor处理
+    std::vector<std::unique_ptr<Reactor>> reactors; // reactors[0]运行在主线程中，其余的各自运行在一个线程中
+    std::vector<pthread_t> reactorThreads;
 
     int mThreadPoolSize = 8;
+    int mReactorNum = 1;
+    TaskQueueType mTaskQueue = TASK_QUEUE_LIST;
+    TimerType mTimer = TIMER_HEAP;
+    IoBackend mIoBackend = IO_BACKEND_EPOLL;
+    long mSendfileThreshold = 65536;
+    int mFileCacheSize = 512;
+    long mResponseCacheSize = 16 * 1024 * 1024;
     int mConnectionPoolSize = 8;
+    int mCgiWorkers = 0;
+    std::string mCgiAdapter;
+    long mCgiCacheSize = 0;
+    int mCgiCacheTtl = 10;
+    int mCgiCacheStale = 10;
     bool mCloseLog = false;
     bool mDaemonProcess = false;
 
@@ -43,28 +51,25 @@ private:
     std::string mRedisIP = "127.0.0.1";
     int mRedisPort = 6379;
 
+    long mLastMySQLWaits = 0; // 上一次输出统计时的连接池等待次数
+    long mLastRedisWaits = 0;
+
     void logWrite();
     void threadPool();
     void connectionPool();
+    void fileCache();
+    void cgiPool();
+    void logPoolStats(); // 连接池出现争用时输出统计信息
     void eventListen();
     void eventLoop();
-    void doWrite(int sockfd);
-    void doRead(int sockfd);
-    bool doClientData();
-    bool doSignal(bool &timeout, bool &stopServer);
-    void addClientInfo(int connfd, struct sockaddr_in client_address);
-    void doTimer(int sockfd);
-    void adjustTimer(int sockfd, time_t expire);
-    void closeConn(int sockfd);
     void setDaemon();
+    void blockSignals();
+    static void *reactorWorker(void *arg);
 
 public:
     WebServer(const Config &config);
     ~WebServer();
     int start();
-
-    static void sigHandler(int sig);
-    static void timerHandler();
 };
 
 #endif
\ No newline at end of file
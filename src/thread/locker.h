@@ -92,6 +92,11 @@ public:
         return sem_wait(&m_sem) == 0;
     }
 
+    // 不阻塞地等待信号量，信号量为0时直接返回false
+    bool trywait() {
+        return sem_trywait(&m_sem) == 0;
+    }
+
     // 增加信号量
     bool post() {
         return sem_post(&m_sem) == 0;
@@ -0,0 +1,330 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <list>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+#include "locker.h"
+
+// 线程池的请求队列，可以在启动时选择不同的实现
+enum TaskQueueType {
+    TASK_QUEUE_LIST = 0, // std::list + 互斥锁 + 信号量
+    TASK_QUEUE_LOCKFREE, // 有界无锁环形队列（Vyukov MPMC）
+    TASK_QUEUE_STEALING // 每个工作线程一个队列，空闲的线程从其他线程的队列中窃取任务
+};
+
+// 自旋等待时提示CPU降低功耗，让出流水线给同一物理核上的另一个超线程
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// 请求队列接口，生产者是Reactor线程，消费者是工作线程
+template <typename T>
+class TaskQueue {
+public:
+    virtual ~TaskQueue() {}
+    // 添加任务，队列满了返回false，不会阻塞
+    // hint是希望处理这个任务的工作线程编号（-1表示没有偏好），只有按线程划分的队列会用到
+    virtual bool push(const T &item, int hint = -1) = 0;
+    // 取出任务，没有任务时阻塞，worker是调用者的工作线程编号
+    virtual bool pop(T &item, int worker = 0) = 0;
+};
+
+// 原来线程池中使用的队列：每个任务一次堆分配、一次加锁、一次sem_post
+template <typename T>
+class ListTaskQueue : public TaskQueue<T> {
+public:
+    explicit ListTaskQueue(size_t maxSize) : mMaxSize(maxSize) {}
+
+    bool push(const T &item, int = -1) override {
+        mLocker.lock();
+        if (mQueue.size() >= mMaxSize) {
+            mLocker.unlock();
+            return false;
+        }
+        mQueue.push_back(item);
+        mLocker.unlock();
+        mStat.post(); // 增加信号量
+        return true;
+    }
+
+    bool pop(T &item, int = 0) override {
+        mStat.wait(); // 判断有没有任务，没有就阻塞
+        mLocker.lock();
+        if (mQueue.empty()) {
+            mLocker.unlock();
+            return false;
+        }
+        item = mQueue.front(); // 获取第一个任务
+        mQueue.pop_front();
+        mLocker.unlock();
+        return true;
+    }
+
+private:
+    size_t mMaxSize;
+    std::list<T> mQueue;
+    Locker mLocker;
+    Semaphore mStat;
+};
+
+// 有界无锁MPMC环形队列（Dmitry Vyukov的算法）
+// 每个槽位带一个序号，生产者和消费者各自用CAS推进自己的位置，不需要互斥锁，也没有堆分配
+// 空闲时先自旋一段时间再睡眠：信号量只统计可取的任务数，sem_trywait/sem_post在没有线程睡眠时不会陷入内核
+template <typename T>
+class LockFreeTaskQueue : public TaskQueue<T> {
+public:
+    static const int SPIN_COUNT = 256; // 睡眠前自旋尝试的次数
+
+    explicit LockFreeTaskQueue(size_t maxSize) : mEnqueuePos(0), mDequeuePos(0) {
+        // 单核机器上自旋只会占住生产者需要的CPU，直接睡眠
+        mSpinCount = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+        // 容量取不小于maxSize的2的幂，用位与代替取模
+        size_t capacity = 2;
+        while (capacity < maxSize)
+            capacity <<= 1;
+        mMask = capacity - 1;
+        mCells = std::vector<Cell>(capacity);
+        for (size_t i = 0; i < capacity; ++i) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const T &item, int = -1) override {
+        if (!enqueue(item)) {
+            return false;
+        }
+        mStat.post();
+        return true;
+    }
+
+    bool pop(T &item, int = 0) override {
+        // 先自旋，期间有任务到来就不用睡眠
+        bool got = false;
+        for (int i = 0; i < mSpinCount; ++i) {
+            if (mStat.trywait()) {
+                got = true;
+                break;
+            }
+            cpuRelax();
+        }
+        if (!got && !mStat.wait()) {
+            return false;
+        }
+        // 拿到信号量说明至少有一个任务已经或即将写入完成（生产者先写槽位再post），
+        // 但它的位置可能排在一个尚未写完的槽位之后，所以这里需要重试
+        while (!dequeue(item)) {
+            cpuRelax();
+        }
+        return true;
+    }
+
+private:
+    struct Cell {
+        Cell() : sequence(0) {}
+        Cell(const Cell &) : sequence(0) {}
+        Cell &operator=(const Cell &) { return *this; }
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    bool enqueue(const T &item) {
+        Cell *cell;
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &mCells[pos & mMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                return false; // 队列满了
+            }
+            else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool dequeue(T &item) {
+        Cell *cell;
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &mCells[pos & mMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                return false; // 队列为空
+            }
+            else {
+                pos = mDequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        cell->data = T();
+        cell->sequence.store(pos + mMask + 1, std::memory_order_release);
+        return true;
+    }
+
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    // 生产者和消费者的位置用填充隔开，放在不同的缓存行，避免伪共享
+    char mPad0[CACHE_LINE_SIZE];
+    std::atomic<size_t> mEnqueuePos;
+    char mPad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> mDequeuePos;
+    char mPad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    size_t mMask;
+    std::vector<Cell> mCells;
+    int mSpinCount;
+    Semaphore mStat;
+};
+
+// 工作窃取队列：每个工作线程有自己的双端队列
+// Reactor把连接的请求放到上一次处理这个连接的线程的队列里，让这个连接的读写缓冲区留在同一个核的缓存中；
+// 线程优先处理自己队列中的任务，自己的队列空了才去其他线程的队列中窃取。
+// 每个队列各有一把锁，平时只有队列的主人和Reactor会去加锁，不再所有线程争抢同一把锁。
+// 队列内部按FIFO处理，窃取时也取最早的任务，避免请求等待太久。
+template <typename T>
+class StealingTaskQueue : public TaskQueue<T> {
+public:
+    static const int SPIN_COUNT = 256;
+
+    StealingTaskQueue(size_t maxSize, int workers)
+        : mMaxSize(maxSize), mSize(0), mNext(0), mQueues(workers > 0 ? workers : 1) {
+        mSpinCount = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+    }
+
+    bool push(const T &item, int hint = -1) override {
+        if (mSize.load(std::memory_order_relaxed) >= mMaxSize) {
+            return false;
+        }
+        int n = mQueues.size();
+        int target = (hint >= 0 && hint < n) ? hint : mNext.fetch_add(1, std::memory_order_relaxed) % n;
+        WorkerQueue &q = mQueues[target];
+        q.lock.lock();
+        q.tasks.push_back(item);
+        q.lock.unlock();
+        mSize.fetch_add(1, std::memory_order_relaxed);
+        mStat.post();
+        return true;
+    }
+
+    bool pop(T &item, int worker = 0) override {
+        bool got = false;
+        for (int i = 0; i < mSpinCount; ++i) {
+            if (mStat.trywait()) {
+                got = true;
+                break;
+            }
+            cpuRelax();
+        }
+        if (!got && !mStat.wait()) {
+            return false;
+        }
+        // 信号量保证至少有一个任务还没有被取走，先看自己的队列，再依次窃取其他线程的
+        int n = mQueues.size();
+        int self = (worker >= 0 && worker < n) ? worker : 0;
+        while (true) {
+            for (int i = 0; i < n; ++i) {
+                if (takeFrom(mQueues[(self + i) % n], item)) {
+                    mSize.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+    }
+
+private:
+    struct WorkerQueue {
+        WorkerQueue() {}
+        WorkerQueue(const WorkerQueue &) {}
+        Locker lock;
+        std::deque<T> tasks;
+        char pad[64]; // 各个队列的锁不放在同一个缓存行
+    };
+
+    bool takeFrom(WorkerQueue &q, T &item) {
+        q.lock.lock();
+        if (q.tasks.empty()) {
+            q.lock.unlock();
+            return false;
+        }
+        item = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        q.lock.unlock();
+        return true;
+    }
+
+    size_t mMaxSize;
+    std::atomic<size_t> mSize;
+    std::atomic<unsigned> mNext; // 没有偏好的任务轮流分配
+    std::vector<WorkerQueue> mQueues;
+    int mSpinCount;
+    Semaphore mStat;
+};
+
+template <typename T>
+std::unique_ptr<TaskQueue<T>> createTaskQueue(TaskQueueType type, size_t maxSize, int workers = 1)
+{
+    switch (type) {
+        case TASK_QUEUE_STEALING:
+            return std::unique_ptr<TaskQueue<T>>(new StealingTaskQueue<T>(maxSize, workers));
+        case TASK_QUEUE_LOCKFREE:
+            return std::unique_ptr<TaskQueue<T>>(new LockFreeTaskQueue<T>(maxSize));
+        case TASK_QUEUE_LIST:
+        default:
+            return std::unique_ptr<TaskQueue<T>>(new ListTaskQueue<T>(maxSize));
+    }
+}
+
+// 队列类型和配置项中的名字互相转换，名字不合法时返回false
+inline bool parseTaskQueueType(const std::string &name, TaskQueueType &type)
+{
+    if (name == "list") {
+        type = TASK_QUEUE_LIST;
+    }
+    else if (name == "lockfree") {
+        type = TASK_QUEUE_LOCKFREE;
+    }
+    else if (name == "stealing") {
+        type = TASK_QUEUE_STEALING;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+inline const char *taskQueueTypeName(TaskQueueType type)
+{
+    switch (type) {
+        case TASK_QUEUE_LOCKFREE:
+            return "lockfree";
+        case TASK_QUEUE_STEALING:
+            return "stealing";
+        case TASK_QUEUE_LIST:
+        default:
+            return "list";
+    }
+}
+
+#endif
@@ -2,13 +2,12 @@
 #define THREADPOOL_H
 
 #include <pthread.h>
-#include <list>
 #include <iostream>
 #include <memory>
 #include <vector>
+#include <atomic>
 #include "locker.h"
-#include "../mysql/mysql.h"
-#include "../redis/redis.h"
+#include "task_queue.h"
 
 // 线程池类，定义成模板类是为了代码复用，T是任务类
 // 线程池的本质是一个生产者消费者模型
@@ -16,12 +15,13 @@
 // 互斥锁解决互斥问题，信号量解决同步问题
 // 互斥：对请求队列的操作，需要用互斥锁
 // 同步：如果请求队列中没有任务，主线程必须先加入新的任务，其他线程才能处理任务
+// 请求队列的实现可以在启动时选择（见task_queue.h）
 template<typename T>
 class ThreadPool {
 public:
-    ThreadPool(int thread_number = 8, int max_requests = 10000);
+    ThreadPool(int thread_number = 8, int max_requests = 10000, TaskQueueType queue_type = TASK_QUEUE_LIST);
     ~ThreadPool();
-    bool append(std::shared_ptr<T> request);
+    bool append(T *request); // 任务对象由调用者管理，线程池只保存指针
 
 private:
     static void *worker(void *arg);
@@ -37,28 +37,27 @@ private:
     // 请求队列中最多允许的，等待处理的请求数量
     int m_max_requests;
 
-    // 请求队列（所有线程共享的）
-    std::list<std::shared_ptr<T>> m_workqueue;
-
-    // 互斥锁
-    Locker m_queuelocker;
-
-    // 信号量，判断是否有任务需要处理
-    Semaphore m_queuestat;
+    // 请求队列（所有线程共享的），内部负责互斥和同步
+    std::unique_ptr<TaskQueue<T*>> m_workqueue;
 
     // 是否结束线程
     bool m_stop;
+
+    // 给工作线程分配编号，工作窃取队列按编号划分
+    std::atomic<int> m_next_worker;
 };
 
 template <typename T>
-ThreadPool<T>::ThreadPool(int thread_number, int max_requests):
-    m_thread_number(thread_number), m_max_requests(max_requests),
-    m_stop(false), m_threads(thread_number)
+ThreadPool<T>::ThreadPool(int thread_number, int max_requests, TaskQueueType queue_type):
+    m_thread_number(thread_number), m_threads(thread_number),
+    m_max_requests(max_requests), m_stop(false), m_next_worker(0)
 {
     if ((m_thread_number <= 0) || (m_max_requests <= 0)) {
         throw std::exception();
     }
 
+    m_workqueue = createTaskQueue<T*>(queue_type, m_max_requests, m_thread_number);
+
     // 创建thread_number个线程，并将它们设置为线程脱离
     for (int i = 0; i < thread_number; ++i) {
         std::cout << "create the " << i << "th thread" << std::endl;
@@ -82,18 +81,10 @@ ThreadPool<T>::~ThreadPool()
 }
 
 template <typename T>
-bool ThreadPool<T>::append(std::shared_ptr<T> request)
+bool ThreadPool<T>::append(T *request)
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests) {
-        m_queuelocker.unlock();
-        return false;
-    }
-
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post(); // 增加信号量
-    return true;
+    // 优先交给上一次处理这个连接的工作线程，它的缓存里还有这个连接的数据
+    return m_workqueue->push(request, request->getLastWorker());
 }
 
 template <typename T>
@@ -109,32 +100,22 @@ void *ThreadPool<T>::worker(void *arg)
 template <typename T>
 void ThreadPool<T>::run()
 {
+    int id = m_next_worker++;
+
     // 一旦一个对象析构，stop设置为true
     // 所有子线程的循环都要结束
     while (!m_stop) {
-        m_queuestat.wait(); // 判断有没有任务，没有就阻塞
-        m_queuelocker.lock();
-        if (m_workqueue.empty()) {
-            m_queuelocker.unlock();
+        T *request = nullptr;
+        if (!m_workqueue->pop(request, id)) { // 没有任务就阻塞
             continue;
         }
 
-        std::shared_ptr<T> request = m_workqueue.front(); // 获取第一个任务
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
-
         if (!request) { // 没有获取到任务（任务可能被其他线程抢走），也可以去掉
             continue;
         }
+        request->setLastWorker(id);
 
-        MySQLConnectionPool *mysqlConnPool = MySQLConnectionPool::getInstance();
-        auto mysqlRAII = mysqlConnPool->getConnection();
-        request->setMySQL(mysqlRAII.get());
-
-        RedisConnectionPool *redisConnPool = RedisConnectionPool::getInstance();
-        auto redisRAII = redisConnPool->getConnection();
-        request->setRedis(redisRAII.get());
-
+        // 数据库连接由任务在真正需要时自己获取，静态文件请求不会占用连接池
         request->process(); // 处理任务
     }
 }
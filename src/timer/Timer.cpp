@@ -1,50 +1,78 @@
 #include "Timer.h"
+#include <cstring>
 
-bool operator<(shared_ptr<TimerNode> a, shared_ptr<TimerNode> b)
+bool operator<(const shared_ptr<TimerNode> &a, const shared_ptr<TimerNode> &b)
 {
     return a->getExpire() < b->getExpire();
 }
 
-bool TimerNode::isValid(time_t cur) const
+bool TimerNode::isValid(int64_t cur) const
 {
     return cur < this->expire;
 }
 
-void TimerHeap::addTimer(int id, sockaddr_in addr, time_t expire, function<void()> callback)
+unique_ptr<TimerQueue> createTimerQueue(TimerType type)
+{
+    switch (type) {
+        case TIMER_WHEEL:
+            return unique_ptr<TimerQueue>(new TimerWheel());
+        case TIMER_HEAP:
+        default:
+            return unique_ptr<TimerQueue>(new TimerHeap());
+    }
+}
+
+bool parseTimerType(const std::string &name, TimerType &type)
+{
+    if (name == "heap") {
+        type = TIMER_HEAP;
+    }
+    else if (name == "wheel") {
+        type = TIMER_WHEEL;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+const char *timerTypeName(TimerType type)
+{
+    return type == TIMER_WHEEL ? "wheel" : "heap";
+}
+
+void TimerHeap::addTimer(int id, int64_t expire)
 {
     assert(id >= 0);
     int i;
     if (ref.find(id) == ref.end()) {
         i = heap.size();
         ref[id] = i;
-        shared_ptr<TimerNode> timer = make_shared<TimerNode>(id, addr, expire, callback);
+        shared_ptr<TimerNode> timer = make_shared<TimerNode>(id, expire);
         heap.push_back(timer);
         siftup(i);
     }
     else {
         i = ref[id];
-        heap[i]->setCallback(callback);
         heap[i]->setExpire(expire);
-        heap[i]->setAddr(addr);
         if (!siftdown(i, heap.size())) {
             siftup(i);
         }
     }
 }
 
-void TimerHeap::adjustTimer(int id, time_t expire)
+void TimerHeap::adjustTimer(int id, int64_t expire)
 {
     assert(!heap.empty() && ref.count(id) > 0);
     heap[ref[id]]->setExpire(expire);
     siftdown(ref[id], heap.size());
 }
 
-void TimerHeap::tick()
+void TimerHeap::tick(int64_t cur)
 {
     if (heap.empty()) {
         return;
     }
-    time_t cur = time(nullptr);  // 获取当前系统时间
     // 从头节点开始依次处理每个定时器，直到遇到一个尚未到期的定时器
     while (!heap.empty()) {
         shared_ptr<TimerNode> temp = heap.front();
@@ -52,8 +80,9 @@ void TimerHeap::tick()
         /* 因为每个定时器都使用绝对时间作为超时值，所以可以把定时器的超时值和系统当前时间，
         比较以判断定时器是否到期*/
         if (!temp->isValid(cur)) {
-            temp->getCallback()();
+            // 先删除再回调，回调中可以重新添加这个id
             pop();
+            timeoutCallback(temp->getSockfd());
         }
         else
             break;
@@ -65,9 +94,22 @@ void TimerHeap::doTimer(int id)
     if (heap.empty() || ref.find(id) == ref.end()) {
         return;
     }
-    int i = ref[id];
-    heap[i]->getCallback()();
-    del(i);
+    del(ref[id]);
+    timeoutCallback(id);
+}
+
+int64_t TimerHeap::nextExpire() const
+{
+    return heap.empty() ? -1 : heap.front()->getExpire();
+}
+
+void TimerHeap::delTimer(int id)
+{
+    auto it = ref.find(id);
+    if (it == ref.end()) {
+        return;
+    }
+    del(it->second);
 }
 
 void TimerHeap::clear()
@@ -140,4 +182,186 @@ void TimerHeap::pop()
 {
     assert(!heap.empty());
     del(0);
-}
\ No newline at end of file
+}
+
+TimerWheel::TimerWheel() : slots(WHEEL_SIZE, -1), current(-1), count(0)
+{
+    memset(occupied, 0, sizeof(occupied));
+}
+
+int TimerWheel::slotOf(int64_t expire) const
+{
+    // 向上取整，保证处理到这个槽的时候定时器已经到期
+    int64_t tickNo = (expire + TICK_MS - 1) / TICK_MS;
+    // 已经过期的定时器放到下一个要处理的槽里
+    if (current >= 0 && tickNo <= current) {
+        tickNo = current + 1;
+    }
+    return tickNo & (WHEEL_SIZE - 1);
+}
+
+void TimerWheel::link(int id, int slot)
+{
+    WheelNode &node = nodes[id];
+    node.slot = slot;
+    node.prev = -1;
+    node.next = slots[slot];
+    if (node.next != -1) {
+        nodes[node.next].prev = id;
+    }
+    slots[slot] = id;
+    occupied[slot / 64] |= 1ULL << (slot % 64);
+}
+
+void TimerWheel::unlink(int id)
+{
+    WheelNode &node = nodes[id];
+    if (node.prev != -1) {
+        nodes[node.prev].next = node.next;
+    }
+    else {
+        slots[node.slot] = node.next;
+        if (node.next == -1) {
+            occupied[node.slot / 64] &= ~(1ULL << (node.slot % 64));
+        }
+    }
+    if (node.next != -1) {
+        nodes[node.next].prev = node.prev;
+    }
+    node.slot = -1;
+}
+
+void TimerWheel::addTimer(int id, int64_t expire)
+{
+    assert(id >= 0);
+    if (id >= (int)nodes.size()) {
+        // 按需扩容，id就是socket，数组不会太稀疏
+        size_t n = nodes.empty() ? 1024 : nodes.size();
+        while (n <= (size_t)id)
+            n <<= 1;
+        WheelNode unused = {0, -1, -1, -1};
+        nodes.resize(n, unused);
+    }
+    if (nodes[id].slot != -1) {
+        adjustTimer(id, expire);
+        return;
+    }
+    nodes[id].expire = expire;
+    link(id, slotOf(expire));
+    ++count;
+}
+
+void TimerWheel::adjustTimer(int id, int64_t expire)
+{
+    assert(id >= 0 && id < (int)nodes.size() && nodes[id].slot != -1);
+    WheelNode &node = nodes[id];
+    node.expire = expire;
+    int slot = slotOf(expire);
+    if (slot != node.slot) {
+        unlink(id);
+        link(id, slot);
+    }
+}
+
+void TimerWheel::doTimer(int id)
+{
+    if (id < 0 || id >= (int)nodes.size() || nodes[id].slot == -1) {
+        return;
+    }
+    delTimer(id);
+    timeoutCallback(id);
+}
+
+void TimerWheel::delTimer(int id)
+{
+    if (id < 0 || id >= (int)nodes.size() || nodes[id].slot == -1) {
+        return;
+    }
+    unlink(id);
+    --count;
+}
+
+void TimerWheel::expireSlot(int slot, int64_t now)
+{
+    int id = slots[slot];
+    while (id != -1) {
+        int next = nodes[id].next;
+        // 超时时间还要再转几圈的节点留在槽里
+        if (nodes[id].expire <= now) {
+            // 先摘下节点再回调，回调中可以安全地重新添加这个id
+            unlink(id);
+            --count;
+            timeoutCallback(id);
+            // 回调中删除了下一个节点时，从槽的头部重新开始
+            if (next != -1 && nodes[next].slot != slot) {
+                next = slots[slot];
+            }
+        }
+        id = next;
+    }
+}
+
+void TimerWheel::tick(int64_t now)
+{
+    int64_t nowTick = now / TICK_MS;
+    if (current < 0) {
+        // 第一次tick之前添加的定时器按绝对时间散列，直接检查所有槽
+        current = nowTick;
+        for (int i = 0; i < WHEEL_SIZE; ++i) {
+            expireSlot(i, now);
+        }
+        return;
+    }
+    if (nowTick <= current) {
+        return;
+    }
+    // 把从上次tick到现在经过的每个槽都处理一遍，超过一圈时每个槽只需要处理一次
+    int64_t steps = nowTick - current;
+    if (steps > WHEEL_SIZE) {
+        steps = WHEEL_SIZE;
+    }
+    for (int64_t t = nowTick - steps + 1; t <= nowTick; ++t) {
+        expireSlot(t & (WHEEL_SIZE - 1), now);
+    }
+    current = nowTick;
+}
+
+int64_t TimerWheel::nextExpire() const
+{
+    if (count == 0) {
+        return -1;
+    }
+    if (current < 0) {
+        return 0;
+    }
+    // 下一个非空槽对应的时间是最早到期时间的下界，槽中的节点也可能要再转几圈，那样只是多醒来一次
+    int64_t nextTick = current + 1;
+    int from = nextTick & (WHEEL_SIZE - 1);
+    int slot = nextOccupied(from);
+    return (nextTick + ((slot - from) & (WHEEL_SIZE - 1))) * TICK_MS;
+}
+
+int TimerWheel::nextOccupied(int from) const
+{
+    // 从from开始按位图环形查找第一个非空槽，调用前保证至少有一个定时器
+    const int WORDS = WHEEL_SIZE / 64;
+    int word = from / 64;
+    uint64_t bits = occupied[word] & (~0ULL << (from % 64));
+    for (int i = 0; i <= WORDS; ++i) {
+        if (bits) {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+        word = (word + 1) % WORDS;
+        bits = occupied[word];
+    }
+    assert(false);
+    return from;
+}
+
+void TimerWheel::clear()
+{
+    nodes.clear();
+    slots.assign(WHEEL_SIZE, -1);
+    memset(occupied, 0, sizeof(occupied));
+    count = 0;
+}
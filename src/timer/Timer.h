@@ -1,67 +1,114 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include "../http/http_conn.h"
 #include "../base/priority_queue.h"
-#include "../epoll/epoll.h"
+#include <ctime>
 #include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 #include <unordered_map>
 #include <cassert>
+#include <cstdint>
 using namespace std;
 
+// 定时器的实现，在启动时选择
+enum TimerType {
+    TIMER_HEAP = 0, // 最小堆
+    TIMER_WHEEL // 时间轮
+};
+
+// 定时器接口，id是连接的socket，同一个id最多只有一个定时器
+// 超时回调对所有定时器都一样，在构造后设置一次，不再为每个定时器保存一个std::function
+// 时间都是单调时钟的毫秒数，由调用者传入（事件循环每轮只读一次时钟）
+class TimerQueue {
+public:
+    typedef function<void(int)> TimeoutCallback;
+
+    virtual ~TimerQueue() {}
+
+    void setTimeoutCallback(const TimeoutCallback &cb) { timeoutCallback = cb; }
+
+    // 添加定时器，id已经有定时器时更新它的超时时间
+    virtual void addTimer(int id, int64_t expire) = 0;
+
+    // 更新定时器的超时时间（刷新）
+    virtual void adjustTimer(int id, int64_t expire) = 0;
+
+    // 立即删除定时器并触发回调，回调中可以重新添加这个id
+    virtual void doTimer(int id) = 0;
+
+    // 删除定时器，不触发回调
+    virtual void delTimer(int id) = 0;
+
+    // 处理now时刻之前到期的所有定时器
+    virtual void tick(int64_t now) = 0;
+
+    // 下一次需要调用tick()的时间，没有定时器时返回-1
+    virtual int64_t nextExpire() const = 0;
+
+    virtual void clear() = 0;
+
+    virtual size_t size() const = 0;
+
+protected:
+    TimeoutCallback timeoutCallback;
+};
+
+unique_ptr<TimerQueue> createTimerQueue(TimerType type);
+
+// 定时器的实现和配置项中的名字互相转换，名字不合法时返回false
+bool parseTimerType(const std::string &name, TimerType &type);
+const char *timerTypeName(TimerType type);
+
 // 定时器类
 class TimerNode {
 public:
-    TimerNode(int sockfd, sockaddr_in addr, time_t expire, function<void()> callback)
-        : address(addr), sockfd(sockfd), callback(callback), expire(expire) {}
-    void setExpire(time_t expire) {
+    TimerNode(int sockfd, int64_t expire)
+        : expire(expire), sockfd(sockfd) {}
+    void setExpire(int64_t expire) {
         this->expire = expire;
     }
-    time_t getExpire() const {
+    int64_t getExpire() const {
         return this->expire;
     }
-    void setCallback(function<void()> callback) {
-        this->callback = callback;
-    }
-    function<void()> getCallback() const {
-        return callback;
-    }
     int getSockfd() const {
         return sockfd;
     }
-    void setAddr(sockaddr_in addr) {
-        this->address = addr;
-    }
-    bool isValid(time_t cur) const;
+    bool isValid(int64_t cur) const;
 private:
-    time_t expire;   // 任务超时时间，这里使用绝对时间
-    function<void()> callback;
-    sockaddr_in address;
+    int64_t expire;   // 任务超时时间，这里使用绝对时间（毫秒）
     int sockfd;
 };
 
-class TimerHeap {
+// 基于最小堆的定时器，添加和刷新都是O(log n)，另外每次操作都要查一次哈希表
+class TimerHeap : public TimerQueue {
 public:
     TimerHeap() {}
     ~TimerHeap() {}
 
-    void addTimer(int id, sockaddr_in addr, time_t expire, function<void()> callback);
+    void addTimer(int id, int64_t expire) override;
 
-    void adjustTimer(int id, time_t expire);
+    void adjustTimer(int id, int64_t expire) override;
 
-    void doTimer(int id);
+    void doTimer(int id) override;
 
-    /* SIGALRM 信号每次被触发就在其信号处理函数中执行一次 tick() 函数，以处理到期任务。*/
-    void tick();
+    void delTimer(int id) override;
 
-    void clear();
+    /* 每次定时器到期时执行一次 tick() 函数，以处理到期任务。*/
+    void tick(int64_t now) override;
+
+    int64_t nextExpire() const override;
+
+    void clear() override;
+
+    size_t size() const override { return heap.size(); }
 
     void pop();
 
 private:
     void del(int i);
-    
+
     void siftup(int i);
 
     bool siftdown(int index, int n);
@@ -72,4 +119,53 @@ private:
     std::unordered_map<int, int> ref;
 };
 
-#endif
\ No newline at end of file
+// 哈希时间轮：超时时间按TICK_MS的精度散列到固定数量的槽中，每个槽是一个侵入式双向链表
+// 节点按id（socket）存放在连续的数组中，不需要为每个定时器单独分配内存，也不需要哈希表；
+// 添加、刷新和删除都是O(1)，刷新时如果还落在同一个槽里只需要修改超时时间。
+// 超时时间超过一圈的节点留在槽中，转到它的时候比较超时时间，没到期就继续留着。
+class TimerWheel : public TimerQueue {
+public:
+    static const int TICK_MS = 100; // 每个槽对应的时长
+    static const int WHEEL_SIZE = 256; // 槽的数量，必须是2的幂，一圈（25.6s）大于连接的超时时长就不会有节点需要转好几圈
+
+    TimerWheel();
+    ~TimerWheel() {}
+
+    void addTimer(int id, int64_t expire) override;
+
+    void adjustTimer(int id, int64_t expire) override;
+
+    void doTimer(int id) override;
+
+    void delTimer(int id) override;
+
+    void tick(int64_t now) override;
+
+    int64_t nextExpire() const override;
+
+    void clear() override;
+
+    size_t size() const override { return count; }
+
+private:
+    struct WheelNode {
+        int64_t expire;
+        int prev; // 同一个槽中的前一个节点，-1表示没有
+        int next;
+        int slot; // 所在的槽，-1表示节点没有在使用
+    };
+
+    int slotOf(int64_t expire) const;
+    void link(int id, int slot);
+    void unlink(int id);
+    void expireSlot(int slot, int64_t now);
+    int nextOccupied(int from) const;
+
+    std::vector<WheelNode> nodes; // 按id下标存放的节点，按需扩容
+    std::vector<int> slots; // 每个槽的链表头
+    uint64_t occupied[WHEEL_SIZE / 64]; // 非空槽的位图，用来找下一个要处理的非空槽
+    int64_t current; // 已经处理到的槽的序号（时间/TICK_MS），-1表示还没有tick过
+    size_t count;
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include "uring.h"
+
+bool parseIoBackend(const std::string &name, IoBackend &backend)
+{
+    if (name == "epoll") {
+        backend = IO_BACKEND_EPOLL;
+    }
+    else if (name == "io_uring") {
+        backend = IO_BACKEND_URING;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+const char *ioBackendName(IoBackend backend)
+{
+    switch (backend) {
+        case IO_BACKEND_URING:
+            return "io_uring";
+        case IO_BACKEND_EPOLL:
+        default:
+            return "epoll";
+    }
+}
+
+#ifdef WITH_IO_URING
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+static int sysIoUringSetup(unsigned entries, io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysIoUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+IoUring::IoUring() :
+    mRingFd(-1),
+    mSqRing(MAP_FAILED),
+    mCqRing(MAP_FAILED),
+    mSqRingSize(0),
+    mCqRingSize(0),
+    mSqes((io_uring_sqe*)MAP_FAILED),
+    mSqesSize(0),
+    mSqLocalTail(0),
+    mToSubmit(0),
+    mBufCount(0),
+    mBufferSize(0),
+    mBufGroup(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    if (mSqes != MAP_FAILED)
+        munmap(mSqes, mSqesSize);
+    if (mCqRing != MAP_FAILED && mCqRing != mSqRing)
+        munmap(mCqRing, mCqRingSize);
+    if (mSqRing != MAP_FAILED)
+        munmap(mSqRing, mSqRingSize);
+    if (mRingFd != -1)
+        close(mRingFd);
+}
+
+bool IoUring::init(unsigned entries)
+{
+    // 完成队列开大一些，多次accept/recv的完成事件比提交的请求多
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    mRingFd = sysIoUringSetup(entries, &params);
+    if (mRingFd < 0 && errno == EINVAL) {
+        // 旧内核不支持后两个标志
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        mRingFd = sysIoUringSetup(entries, &params);
+    }
+    if (mRingFd < 0) {
+        return false;
+    }
+
+    mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        // 提交队列和完成队列在同一块内存中
+        mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+    }
+    mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+    if (mSqRing == MAP_FAILED) {
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        mCqRing = mSqRing;
+    }
+    else {
+        mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+        if (mCqRing == MAP_FAILED) {
+            return false;
+        }
+    }
+    mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    mSqes = (io_uring_sqe*)mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+    if (mSqes == MAP_FAILED) {
+        return false;
+    }
+
+    char *sq = (char*)mSqRing;
+    mSqHead = (unsigned*)(sq + params.sq_off.head);
+    mSqTail = (unsigned*)(sq + params.sq_off.tail);
+    mSqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    mSqEntries = *(unsigned*)(sq + params.sq_off.ring_entries);
+    mSqLocalTail = *mSqTail;
+    // 提交队列的下标数组固定为一一对应，sqe按顺序使用
+    unsigned *array = (unsigned*)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < mSqEntries; ++i) {
+        array[i] = i;
+    }
+
+    char *cq = (char*)mCqRing;
+    mCqHead = (unsigned*)(cq + params.cq_off.head);
+    mCqTail = (unsigned*)(cq + params.cq_off.tail);
+    mCqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    mCqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool IoUring::provideBuffers(unsigned count, unsigned size, uint16_t group)
+{
+    mBufCount = count;
+    mBufferSize = size;
+    mBufGroup = group;
+    mBuffers.resize((size_t)count * size);
+
+    // 一次把所有缓冲区交给内核，等待这个请求完成
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)(uintptr_t)mBuffers.data();
+    sqe->len = size;
+    sqe->buf_group = group;
+    sqe->off = 0;
+    sqe->user_data = 0;
+    if (submitAndWait(1) < 0) {
+        return false;
+    }
+    io_uring_cqe cqe;
+    if (!peekCqe(cqe)) {
+        return false;
+    }
+    if (cqe.res < 0) {
+        errno = -cqe.res;
+        return false;
+    }
+    return true;
+}
+
+void IoUring::recycleBuffer(uint16_t bid)
+{
+    // 成功时不产生完成事件，失败时产生user_data为0的完成事件
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uint64_t)(uintptr_t)getBuffer(bid);
+    sqe->len = mBufferSize;
+    sqe->buf_group = mBufGroup;
+    sqe->off = bid;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = 0;
+}
+
+io_uring_sqe *IoUring::getSqe()
+{
+    unsigned head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+    if (mSqLocalTail - head >= mSqEntries) {
+        // 没有使用SQPOLL，io_uring_enter返回时内核已经取走了提交的请求
+        submitAndWait(0);
+    }
+    io_uring_sqe *sqe = &mSqes[mSqLocalTail & mSqMask];
+    mSqLocalTail++;
+    mToSubmit++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+io_uring_sqe *IoUring::prepPollMultishot(int fd, uint32_t events, uint64_t data)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = data;
+    return sqe;
+}
+
+io_uring_sqe *IoUring::prepPoll(int fd, uint32_t events, uint64_t data)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = data;
+    return sqe;
+}
+
+io_uring_sqe *IoUring::prepAcceptMultishot(int fd, uint64_t data)
+{
+    // 一次提交，每来一个连接产生一个完成事件，直到出错或被取消
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = data;
+    return sqe;
+}
+
+io_uring_sqe *IoUring::prepRecv(int fd, uint16_t group, uint64_t data)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = data;
+    return sqe;
+}
+
+io_uring_sqe *IoUring::prepWritev(int fd, const struct iovec *iov, int count, uint64_t data)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = count;
+    sqe->user_data = data;
+    return sqe;
+}
+
+io_uring_sqe *IoUring::prepClose(int fd, uint64_t data)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = data;
+    return sqe;
+}
+
+io_uring_sqe *IoUring::prepCancel(uint64_t target, uint64_t data)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = data;
+    return sqe;
+}
+
+int IoUring::submitAndWait(unsigned waitNr)
+{
+    if (mToSubmit == 0 && waitNr == 0) {
+        return 0;
+    }
+    __atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+    int ret = sysIoUringEnter(mRingFd, mToSubmit, waitNr, waitNr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0) {
+        return -errno;
+    }
+    mToSubmit -= std::min((unsigned)ret, mToSubmit);
+    return ret;
+}
+
+bool IoUring::peekCqe(io_uring_cqe &cqe)
+{
+    unsigned head = *mCqHead;
+    if (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = mCqes[head & mCqMask];
+    __atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef URING_H
+#define URING_H
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+
+// 网络I/O的实现，在启动时选择
+enum IoBackend {
+    IO_BACKEND_EPOLL = 0, // 就绪通知：epoll_wait + readv/writev + epoll_ctl
+    IO_BACKEND_URING // 完成通知：io_uring提交读写请求，内核完成后通知
+};
+
+// I/O实现和配置项中的名字互相转换，名字不合法时返回false
+bool parseIoBackend(const std::string &name, IoBackend &backend);
+const char *ioBackendName(IoBackend backend);
+
+#ifdef WITH_IO_URING
+
+#include <linux/io_uring.h>
+
+// io_uring的简单封装，直接使用系统调用，不依赖liburing
+// 提交队列和完成队列都只在创建它的线程（Reactor线程）中使用，内部不加锁
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    // 创建io_uring，失败返回false（内核不支持或被禁用），errno中是失败原因
+    bool init(unsigned entries);
+
+    // 向内核提供一组接收缓冲区（provided buffers），失败返回false
+    // recv请求不再预先指定缓冲区，数据到达时内核从这组缓冲区中取一块，完成事件中带回缓冲区的编号
+    bool provideBuffers(unsigned count, unsigned size, uint16_t group);
+    const char *getBuffer(uint16_t bid) const { return &mBuffers[(size_t)bid * mBufferSize]; }
+    void recycleBuffer(uint16_t bid); // 缓冲区中的数据用完后还给内核，随下一次提交一起生效
+
+    // 准备各种请求，返回的sqe可以再设置flags（比如IOSQE_IO_LINK）
+    io_uring_sqe *prepPollMultishot(int fd, uint32_t events, uint64_t data);
+    io_uring_sqe *prepPoll(int fd, uint32_t events, uint64_t data); // 单次的poll，事件发生一次就结束
+    io_uring_sqe *prepAcceptMultishot(int fd, uint64_t data);
+    io_uring_sqe *prepRecv(int fd, uint16_t group, uint64_t data);
+    io_uring_sqe *prepWritev(int fd, const struct iovec *iov, int count, uint64_t data);
+    io_uring_sqe *prepClose(int fd, uint64_t data);
+    io_uring_sqe *prepCancel(uint64_t target, uint64_t data); // 取消user_data为target的请求
+
+    // 提交所有准备好的请求，并至少等待waitNr个完成事件，返回-errno表示失败
+    int submitAndWait(unsigned waitNr);
+
+    // 取出一个完成事件，没有时返回false
+    bool peekCqe(io_uring_cqe &cqe);
+
+private:
+    io_uring_sqe *getSqe(); // 提交队列满了时先提交已经准备好的请求
+
+    int mRingFd;
+    void *mSqRing;
+    void *mCqRing;
+    size_t mSqRingSize;
+    size_t mCqRingSize;
+    io_uring_sqe *mSqes;
+    size_t mSqesSize;
+
+    unsigned *mSqHead;
+    unsigned *mSqTail;
+    unsigned mSqMask;
+    unsigned mSqEntries;
+    unsigned mSqLocalTail; // 已经准备好但还没有发布给内核的位置
+    unsigned mToSubmit;
+
+    unsigned *mCqHead;
+    unsigned *mCqTail;
+    unsigned mCqMask;
+    io_uring_cqe *mCqes;
+
+    unsigned mBufCount;
+    unsigned mBufferSize;
+    uint16_t mBufGroup;
+    std::vector<char> mBuffers;
+};
+
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include <ctime>
 
 void addsig(int sig, void (*handler)(int))
 {
@@ -73,4 +74,46 @@ std::string getPath(const std::string &path)
     }
     std::string result = buf;
     return result + "/" + path;
-}
\ No newline at end of file
+}
+
+std::string httpDate(time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+bool parseHttpDate(const std::string &text, time_t &t)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') {
+        return false;
+    }
+    t = timegm(&tm);
+    return true;
+}
+
+int64_t currentTimeMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+std::string htmlEscape(const std::string &text)
+{
+    std::string escaped;
+    for (char c : text) {
+        switch (c) {
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '&': escaped += "&amp;"; break;
+            case '"': escaped += "&quot;"; break;
+            default: escaped += c; break;
+        }
+    }
+    return escaped;
+}
@@ -11,11 +11,16 @@
 #include <unistd.h>
 #include "../common.h"
 #include <string>
+#include <cstdint>
 
 void addsig(int sig, void (*handler)(int));
 int setnonblocking(int fd);
 void createDir(const char *path);
 void daemon();
 std::string getPath(const std::string &path);
+int64_t currentTimeMs(); // 单调时钟的毫秒数，不受系统时间调整的影响
+std::string httpDate(time_t t); // HTTP头部使用的GMT时间格式，如 Sun, 06 Nov 1994 08:49:37 GMT
+bool parseHttpDate(const std::string &text, time_t &t); // httpDate的逆操作，格式不对时返回false
+std::string htmlEscape(const std::string &text); // 转义&<>"，用于把文件名等放进生成的页面
 
 #endif
\ No newline at end of file
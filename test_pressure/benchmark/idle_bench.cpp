@@ -0,0 +1,202 @@
+// 空闲的保持连接占用的服务器内存：建立大量连接，每个连接先完成一个请求，然后保持空闲
+// 用法：./idle_bench ip port 服务器pid [路径] [连接数...]，默认 /index.html 1万 10万个连接
+// 服务器和测试程序要在同一台机器上运行（从/proc/<pid>/status读服务器的VmRSS），
+// 两边的RLIMIT_NOFILE硬限制都要大于连接数（ulimit -Hn），程序会把自己的软限制提高到硬限制
+// 目标是127.x.x.x时本地端口不够用（每个源地址约2.8万个），连接轮流从127.0.0.1、127.0.0.2...发起
+// 服务器关闭空闲超过15s的连接，建立全部连接要在这之前完成
+// 输出每一档连接数下服务器的常驻内存、平均每个连接的增量，以及内核中TCP缓冲区占用的内存（/proc/net/sockstat）
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+static const int BATCH = 100; // 每批先建立这么多连接（不超过服务器的listen队列），再一起发送请求、读取响应
+static const int PORTS_PER_SOURCE = 20000; // 每个源地址发起的连接数
+
+// /proc/<pid>/status中的一项（kB）
+static long procStatus(int pid, const char *name)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    char line[256];
+    long value = -1;
+    size_t len = strlen(name);
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, name, len) == 0 && line[len] == ':') {
+            value = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+// 内核中所有TCP socket占用的内存（kB）
+static long tcpMemory()
+{
+    FILE *fp = fopen("/proc/net/sockstat", "r");
+    if (!fp) {
+        return -1;
+    }
+    char line[256];
+    long pages = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        const char *mem = strstr(line, " mem ");
+        if (strncmp(line, "TCP:", 4) == 0 && mem) {
+            pages = atol(mem + 5);
+            break;
+        }
+    }
+    fclose(fp);
+    return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int connectTo(const sockaddr_in &addr, int index)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((ntohl(addr.sin_addr.s_addr) >> 24) == 127) {
+        // 换一个源地址，端口在connect时才分配，不同的源地址可以使用相同的端口
+        int one = 1;
+        setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(0x7f000001 + index / PORTS_PER_SOURCE);
+        if (bind(fd, (const sockaddr*)&local, sizeof(local)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// 读完一个响应（按Content-Length判断），出错返回false
+static bool readResponse(int fd)
+{
+    string in;
+    char buf[16384];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return false;
+        }
+        in.append(buf, n);
+        size_t end = in.find("\r\n\r\n");
+        if (end == string::npos) {
+            continue;
+        }
+        size_t pos = in.find("Content-Length:");
+        size_t length = pos != string::npos && pos < end ? strtoul(in.c_str() + pos + 15, nullptr, 10) : 0;
+        if (in.size() >= end + 4 + length) {
+            return true;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        printf("usage: %s ip port pid [path] [connections...]\n", argv[0]);
+        return 1;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &addr.sin_addr);
+    int pid = atoi(argv[3]);
+    string path = argc > 4 ? argv[4] : "/index.html";
+    vector<int> counts;
+    for (int i = 5; i < argc; ++i) {
+        counts.push_back(atoi(argv[i]));
+    }
+    if (counts.empty()) {
+        counts = { 10000, 100000 };
+    }
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    string request = "GET " + path + " HTTP/1.1\r\nHost: " + argv[1] + "\r\nConnection: keep-alive\r\n\r\n";
+    long baseRss = procStatus(pid, "VmRSS");
+    long baseTcp = tcpMemory();
+    if (baseRss < 0) {
+        printf("cannot read /proc/%d/status\n", pid);
+        return 1;
+    }
+    printf("server pid %d, baseline RSS %ld kB, request %s\n", pid, baseRss, path.c_str());
+    printf("%12s %12s %14s %14s %12s\n", "connections", "RSS(kB)", "RSS/conn(B)", "TCP mem(kB)", "seconds");
+
+    vector<int> fds;
+    bool failed = false;
+    for (int target : counts) {
+        auto begin = chrono::steady_clock::now();
+        while (!failed && (int)fds.size() < target) {
+            // 一批连接先全部建立，再发送请求，让服务器同时处理多个连接
+            size_t first = fds.size();
+            int batch = min(BATCH, target - (int)fds.size());
+            for (int i = 0; i < batch; ++i) {
+                int fd = connectTo(addr, fds.size());
+                if (fd < 0) {
+                    perror("connect");
+                    failed = true;
+                    break;
+                }
+                fds.push_back(fd);
+            }
+            for (size_t i = first; i < fds.size(); ++i) {
+                if (write(fds[i], request.data(), request.size()) != (ssize_t)request.size()) {
+                    perror("write");
+                    return 1;
+                }
+            }
+            for (size_t i = first; i < fds.size(); ++i) {
+                if (!readResponse(fds[i])) {
+                    printf("connection %zu: no response\n", i);
+                    return 1;
+                }
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        // 等服务器处理完最后一批的收尾工作
+        this_thread::sleep_for(chrono::seconds(1));
+        long rss = procStatus(pid, "VmRSS");
+        long tcp = tcpMemory();
+        printf("%12zu %12ld %14.0f %14ld %12.1f\n", fds.size(), rss, (rss - baseRss) * 1024.0 / fds.size(),
+               tcp - baseTcp, seconds);
+        if (failed) {
+            break;
+        }
+    }
+    for (int fd : fds) {
+        close(fd);
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+// 保持连接的压力测试（webbench每个请求都会新建连接，测不到keep-alive的情况）
+// 用法：./keepalive_bench ip port [路径] [连接数] [秒数] [流水线深度]，默认 / 100个连接 10秒 深度1
+// 每个连接在收到完整响应（按Content-Length判断）后立刻在同一连接上发送下一个请求，
+// 用于比较epoll和io_uring两种I/O实现在长连接下的吞吐量
+// 流水线深度大于1时一次发送多个请求，全部响应收到后再发送下一批
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+struct Client {
+    int fd = -1;
+    string in; // 当前响应已经收到的数据
+    size_t sent = 0; // 当前请求已经发送的字节数
+    int waiting = 0; // 这一批请求还没有收到的响应数
+};
+
+static string request; // 一批请求（流水线深度个）
+static int depth = 1;
+static long responses = 0;
+static long errors = 0;
+
+static int connectTo(const sockaddr_in &addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// 发送请求中剩下的部分，出错返回false
+static bool sendRequest(Client &c)
+{
+    while (c.sent < request.size()) {
+        ssize_t n = write(c.fd, request.data() + c.sent, request.size() - c.sent);
+        if (n < 0) {
+            return errno == EAGAIN;
+        }
+        c.sent += n;
+    }
+    return true;
+}
+
+// 响应完整时返回true，并去掉已经处理的部分
+static bool takeResponse(Client &c)
+{
+    size_t end = c.in.find("\r\n\r\n");
+    if (end == string::npos) {
+        return false;
+    }
+    size_t length = 0;
+    size_t pos = c.in.find("Content-Length:");
+    if (pos == string::npos) {
+        pos = c.in.find("content-length:");
+    }
+    if (pos != string::npos && pos < end) {
+        length = strtoul(c.in.c_str() + pos + 15, nullptr, 10);
+    }
+    if (c.in.size() < end + 4 + length) {
+        return false;
+    }
+    c.in.erase(0, end + 4 + length);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        printf("usage: %s ip port [path] [connections] [seconds] [pipeline depth]\n", argv[0]);
+        return 1;
+    }
+    const char *path = argc > 3 ? argv[3] : "/";
+    int connections = argc > 4 ? atoi(argv[4]) : 100;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+    depth = argc > 6 ? max(atoi(argv[6]), 1) : 1;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &addr.sin_addr);
+    string single = string("GET ") + path + " HTTP/1.1\r\nHost: " + argv[1] + "\r\nConnection: keep-alive\r\n\r\n";
+    for (int i = 0; i < depth; ++i) {
+        request += single;
+    }
+
+    int epfd = epoll_create1(0);
+    vector<Client> clients(connections);
+    for (int i = 0; i < connections; ++i) {
+        clients[i].fd = connectTo(addr);
+        if (clients[i].fd < 0) {
+            perror("connect");
+            return 1;
+        }
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+        clients[i].waiting = depth;
+        sendRequest(clients[i]);
+    }
+
+    auto begin = chrono::steady_clock::now();
+    auto deadline = begin + chrono::seconds(seconds);
+    vector<epoll_event> events(connections);
+    char buf[65536];
+    int alive = connections;
+    while (alive > 0 && chrono::steady_clock::now() < deadline) {
+        int n = epoll_wait(epfd, events.data(), connections, 100);
+        for (int i = 0; i < n; ++i) {
+            Client &c = clients[events[i].data.u32];
+            ssize_t len;
+            while ((len = read(c.fd, buf, sizeof(buf))) > 0) {
+                c.in.append(buf, len);
+            }
+            if (len == 0 || (len < 0 && errno != EAGAIN)) {
+                // 服务器关闭了连接，不再使用这个连接
+                errors++;
+                alive--;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+                close(c.fd);
+                c.fd = -1;
+                continue;
+            }
+            while (takeResponse(c)) {
+                responses++;
+                if (--c.waiting == 0) {
+                    c.waiting = depth;
+                    c.sent = 0;
+                    sendRequest(c);
+                }
+            }
+        }
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    printf("%d connections, depth %d, %.1fs: %ld responses, %.0f req/s, %ld connections closed by server\n",
+           connections, depth, elapsed, responses, responses / elapsed, errors);
+    for (Client &c : clients) {
+        if (c.fd != -1) {
+            close(c.fd);
+        }
+    }
+    close(epfd);
+    return 0;
+}
@@ -0,0 +1,211 @@
+// 比较逐字节拷贝的行解析（原来的parseLine+istringstream+substr）和在缓冲区上原地扫描的HttpParser
+// 用法：./parser_bench [每种请求的解析次数]，默认100万次
+// 每种请求分别测试一次收完和分成多段到达（每段64字节，模拟慢速客户端的部分读）两种情况
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include "http/http_parser.h"
+
+using namespace std;
+
+static const char *SIMPLE_REQUEST =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+// 浏览器的典型请求，带Cookie，约700字节
+static const char *BROWSER_REQUEST =
+    "GET /images/image1.jpg HTTP/1.1\r\n"
+    "Host: www.example.com:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://www.example.com:10000/picture.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: sessionid=9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08; "
+    "theme=dark; _ga=GA1.1.1234567890.1700000000; _gid=GA1.1.987654321.1700000000\r\n"
+    "If-None-Match: \"ce80af-106f1-18df8e5648a7e60d\"\r\n"
+    "If-Modified-Since: Sun, 18 Oct 2026 07:14:37 GMT\r\n"
+    "\r\n";
+
+static const char *POST_REQUEST =
+    "POST /login/2 HTTP/1.1\r\n"
+    "Host: www.example.com:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 27\r\n"
+    "\r\n"
+    "user=example&password=12345";
+
+// 原来的实现：逐字节拷贝到currLine，请求行用istringstream分割，头部用substr取出名称和值
+class LegacyParser {
+public:
+    void reset()
+    {
+        state = 0;
+        line.clear();
+        contentLength = 0;
+        body.clear();
+    }
+
+    // 返回是否解析完一个请求，data被消费掉
+    bool parse(string &data)
+    {
+        size_t pos = 0;
+        while (true) {
+            if (state == 2) {
+                size_t rest = contentLength - body.size();
+                size_t n = min(rest, data.size() - pos);
+                body.append(data, pos, n);
+                pos += n;
+                data.erase(0, pos);
+                return body.size() == (size_t)contentLength;
+            }
+            bool complete = false;
+            for (; pos < data.size(); ++pos) {
+                char c = data[pos];
+                if (c == '\r') {
+                    continue;
+                }
+                if (c == '\n') {
+                    ++pos;
+                    complete = true;
+                    break;
+                }
+                line.push_back(c);
+            }
+            if (!complete) {
+                data.clear();
+                return false;
+            }
+            if (state == 0) {
+                istringstream is(line);
+                string temp;
+                int i = 0;
+                while (is >> temp) {
+                    if (i == 0) method = temp;
+                    else if (i == 1) url = temp;
+                    else if (i == 2) version = temp;
+                    i++;
+                }
+                state = 1;
+            }
+            else if (line.empty()) {
+                if (contentLength == 0) {
+                    data.erase(0, pos);
+                    return true;
+                }
+                state = 2;
+            }
+            else {
+                string str(line);
+                size_t index = str.find(":");
+                if (index != string::npos) {
+                    index++;
+                    string key = str.substr(0, index);
+                    while (index != str.size() && str[index] == ' ') {
+                        index++;
+                    }
+                    string value = str.substr(index);
+                    if (key == "Content-Length:") {
+                        contentLength = stol(value);
+                    }
+                    else if (key == "Connection:") {
+                        keepAlive = value;
+                    }
+                    else if (key == "Cookie:") {
+                        cookie = value;
+                    }
+                }
+            }
+            line.clear();
+        }
+    }
+
+private:
+    int state;
+    string line;
+    string method, url, version, keepAlive, cookie;
+    long contentLength;
+    string body;
+};
+
+static double elapsedNs(chrono::steady_clock::time_point begin, long ops)
+{
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / ops;
+}
+
+static volatile size_t sink;
+
+static double benchLegacy(const string &request, size_t chunk, long n)
+{
+    LegacyParser parser;
+    string data;
+    auto begin = chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i) {
+        parser.reset();
+        for (size_t off = 0; off < request.size(); off += chunk) {
+            data.append(request, off, chunk);
+            if (parser.parse(data)) {
+                sink += 1;
+            }
+        }
+    }
+    return elapsedNs(begin, n);
+}
+
+// 和HttpConn一样：数据追加到缓冲区，每次从缓冲区开头重新调用parse()，解析器从保存的位置继续
+static double benchInPlace(const string &request, size_t chunk, long n)
+{
+    HttpParser parser;
+    string buffer;
+    buffer.reserve(request.size());
+    auto begin = chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i) {
+        parser.reset();
+        buffer.clear();
+        for (size_t off = 0; off < request.size(); off += chunk) {
+            buffer.append(request, off, chunk);
+            if (parser.parse(buffer.data(), buffer.size()) == HttpParser::PARSE_DONE) {
+                // 只取出HttpConn关心的几个头部，按名称比较
+                for (size_t h = 0; h < parser.headerCount(); ++h) {
+                    StrView name = parser.headerName(h);
+                    if (name.iequals("Connection") || name.iequals("Cookie")) {
+                        sink += parser.headerValue(h).size();
+                    }
+                }
+                sink += parser.uri().size() + parser.body().size();
+            }
+        }
+    }
+    return elapsedNs(begin, n);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    struct {
+        const char *name;
+        const char *request;
+    } cases[] = {
+        {"simple GET", SIMPLE_REQUEST},
+        {"browser GET", BROWSER_REQUEST},
+        {"form POST", POST_REQUEST},
+    };
+
+    printf("%-12s %6s %8s %14s %14s %8s\n", "request", "bytes", "chunk", "legacy(ns)", "in-place(ns)", "speedup");
+    for (const auto &c : cases) {
+        string request(c.request);
+        for (size_t chunk : {request.size(), (size_t)64}) {
+            double legacy = benchLegacy(request, chunk, n);
+            double inPlace = benchInPlace(request, chunk, n);
+            printf("%-12s %6zu %8zu %14.1f %14.1f %7.2fx\n", c.name, request.size(), chunk, legacy, inPlace, legacy / inPlace);
+        }
+    }
+    return 0;
+}
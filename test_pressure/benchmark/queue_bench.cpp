@@ -0,0 +1,117 @@
+// 比较线程池几种请求队列的吞吐量：list+互斥锁、无锁环形队列和工作窃取队列
+// 用法：./queue_bench [每个生产者的任务数] [生产者数量]
+// 生产者模拟Reactor线程，消费者模拟工作线程，分别测试8/16/32个工作线程
+// 每个任务模拟一个连接，带上"上次处理它的工作线程"作为提示，只有工作窃取队列会用到
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <pthread.h>
+#include "thread/task_queue.h"
+
+using namespace std;
+
+struct Task {
+    int id;
+};
+
+struct BenchContext {
+    TaskQueue<shared_ptr<Task>> *queue;
+    long tasksPerProducer;
+    int workers;
+    atomic<int> nextWorker;
+    atomic<long> consumed;
+    long total;
+};
+
+static void *producer(void *arg)
+{
+    BenchContext *ctx = static_cast<BenchContext*>(arg);
+    shared_ptr<Task> task = make_shared<Task>();
+    for (long i = 0; i < ctx->tasksPerProducer; ++i) {
+        // 队列满了就重试，和Reactor一样不阻塞
+        while (!ctx->queue->push(task, i % ctx->workers)) {
+            sched_yield();
+        }
+    }
+    return nullptr;
+}
+
+static void *consumer(void *arg)
+{
+    BenchContext *ctx = static_cast<BenchContext*>(arg);
+    int id = ctx->nextWorker++;
+    shared_ptr<Task> task;
+    while (true) {
+        if (!ctx->queue->pop(task, id)) {
+            continue;
+        }
+        // 空任务作为结束标记
+        if (!task) {
+            break;
+        }
+        ctx->consumed++;
+    }
+    return nullptr;
+}
+
+static double runOnce(TaskQueueType type, int workers, int producers, long tasksPerProducer)
+{
+    unique_ptr<TaskQueue<shared_ptr<Task>>> queue = createTaskQueue<shared_ptr<Task>>(type, 10000, workers);
+    BenchContext ctx;
+    ctx.queue = queue.get();
+    ctx.tasksPerProducer = tasksPerProducer;
+    ctx.workers = workers;
+    ctx.nextWorker = 0;
+    ctx.consumed = 0;
+    ctx.total = tasksPerProducer * producers;
+
+    vector<pthread_t> consumers(workers), prods(producers);
+    for (int i = 0; i < workers; ++i) {
+        pthread_create(&consumers[i], nullptr, consumer, &ctx);
+    }
+
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < producers; ++i) {
+        pthread_create(&prods[i], nullptr, producer, &ctx);
+    }
+    for (int i = 0; i < producers; ++i) {
+        pthread_join(prods[i], nullptr);
+    }
+    for (int i = 0; i < workers; ++i) {
+        while (!ctx.queue->push(shared_ptr<Task>(), i)) {
+            sched_yield();
+        }
+    }
+    for (int i = 0; i < workers; ++i) {
+        pthread_join(consumers[i], nullptr);
+    }
+    auto end = chrono::steady_clock::now();
+
+    if (ctx.consumed != ctx.total) {
+        fprintf(stderr, "lost tasks: %ld of %ld\n", ctx.total - ctx.consumed.load(), ctx.total);
+        exit(1);
+    }
+    double seconds = chrono::duration<double>(end - begin).count();
+    return ctx.total / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    long tasksPerProducer = argc > 1 ? atol(argv[1]) : 1000000;
+    int producers = argc > 2 ? atoi(argv[2]) : 1;
+    const int workers[] = {8, 16, 32};
+    const TaskQueueType types[] = {TASK_QUEUE_LIST, TASK_QUEUE_LOCKFREE, TASK_QUEUE_STEALING};
+
+    printf("producers: %d, tasks per producer: %ld\n", producers, tasksPerProducer);
+    printf("%-10s %8s %16s\n", "queue", "workers", "tasks/sec");
+    for (int w : workers) {
+        for (TaskQueueType type : types) {
+            double rate = runOnce(type, w, producers, tasksPerProducer);
+            printf("%-10s %8d %16.0f\n", taskQueueTypeName(type), w, rate);
+        }
+    }
+    return 0;
+}
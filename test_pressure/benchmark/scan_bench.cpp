@@ -0,0 +1,98 @@
+// 比较分隔符查找的标量、SSE4.2和AVX2实现
+// 用法：./scan_bench [每种输入的次数]，默认100万次
+// 输入是浏览器的典型请求（500~1500字节，主要是Cookie），分别测试完整的请求解析和URL解码
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "http/http_parser.h"
+#include "http/simd_scan.h"
+#include "http/url.h"
+
+using namespace std;
+
+static double elapsedNs(chrono::steady_clock::time_point begin, long ops)
+{
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / ops;
+}
+
+static volatile size_t sink;
+
+// 生成大约size字节的请求，不足的部分用Cookie补齐
+static string browserRequest(size_t size)
+{
+    string request =
+        "GET /images/image1.jpg HTTP/1.1\r\n"
+        "Host: www.example.com:10000\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+        "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+        "Referer: http://www.example.com:10000/picture.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "If-None-Match: \"ce80af-106f1-18df8e5648a7e60d\"\r\n";
+    string cookie = "Cookie: sessionid=9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08; theme=dark";
+    for (int i = 0; request.size() + cookie.size() + 4 < size; ++i) {
+        cookie += "; _ga_" + to_string(i) + "=GA1.1.1234567890.1700000000";
+    }
+    return request + cookie + "\r\n\r\n";
+}
+
+static double benchParse(const string &request, long n)
+{
+    HttpParser parser;
+    auto begin = chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i) {
+        parser.reset();
+        if (parser.parse(request.data(), request.size()) == HttpParser::PARSE_DONE) {
+            sink += parser.headerCount();
+        }
+    }
+    return elapsedNs(begin, n);
+}
+
+static double benchDecode(const string &url, long n)
+{
+    auto begin = chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i) {
+        sink += urlDecode(url).size();
+    }
+    return elapsedNs(begin, n);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    const char *impls[] = {"scalar", "sse4.2", "avx2"};
+    vector<string> requests = {browserRequest(500), browserRequest(1000), browserRequest(1500)};
+    // 中文文件名的下载链接和一般的页面路径
+    vector<string> urls = {
+        "/files/%E6%9C%8D%E5%8A%A1%E5%99%A8%E6%80%A7%E8%83%BD%E6%B5%8B%E8%AF%95%E6%8A%A5%E5%91%8A.pdf",
+        "/static/js/vendor/jquery-3.7.1.min.js",
+    };
+
+    printf("%-8s", "impl");
+    for (const auto &request : requests) {
+        printf("   parse %4zuB", request.size());
+    }
+    for (const auto &url : urls) {
+        printf("  decode %3zuB", url.size());
+    }
+    printf("   (ns/op)\n");
+    for (const char *impl : impls) {
+        if (!setScanImpl(impl)) {
+            printf("%-8s not supported\n", impl);
+            continue;
+        }
+        printf("%-8s", scanImplName());
+        for (const auto &request : requests) {
+            printf(" %14.1f", benchParse(request, n));
+        }
+        for (const auto &url : urls) {
+            printf(" %13.1f", benchDecode(url, n));
+        }
+        printf("\n");
+    }
+    return 0;
+}
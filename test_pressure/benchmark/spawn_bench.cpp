@@ -0,0 +1,153 @@
+// 比较fork+exec和posix_spawn两种启动CGI子进程的方式，启动耗时随服务器内存占用的变化
+// 用法：./spawn_bench [次数] [内存占用MB...]，默认各启动200次，内存占用0/256/1024MB
+// fork要复制父进程的页表（并把可写页标记为写时复制），耗时随常驻内存线性增长；
+// posix_spawn（glibc用CLONE_VM|CLONE_VFORK实现）和父进程共享地址空间直到exec，耗时基本不变
+// "启动"是从创建管道到函数返回的时间，"完成"是直到读到子进程输出的文件结束（脚本执行完毕）的时间
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <csignal>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "http/cgi_process.h"
+
+using namespace std;
+
+static const char *PROGRAM = "/bin/true";
+
+static double elapsedUs(chrono::steady_clock::time_point begin)
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count();
+}
+
+// 等待输出管道的文件结束
+static void drain(int fd)
+{
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0 || (n < 0 && errno == EINTR)) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            pollfd pfd = { fd, POLLIN, 0 };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        return;
+    }
+}
+
+// 改动之前CgiProcess::start的做法：fork之后在子进程中putenv、恢复信号，再execl
+static pid_t forkExec(const vector<string> &env, int *outFd)
+{
+    int cgiOutput[2];
+    int cgiInput[2];
+    if (pipe2(cgiOutput, O_CLOEXEC) < 0 || pipe2(cgiInput, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(cgiOutput[1], 1);
+        dup2(cgiInput[0], 0);
+        for (const string &var : env) {
+            putenv(const_cast<char*>(var.c_str()));
+        }
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, nullptr);
+        signal(SIGPIPE, SIG_DFL);
+        execl(PROGRAM, PROGRAM, nullptr);
+        _exit(127);
+    }
+    close(cgiOutput[1]);
+    close(cgiInput[0]);
+    close(cgiInput[1]);
+    *outFd = cgiOutput[0];
+    return pid;
+}
+
+static void runOnce(int count, size_t mb, const vector<string> &env)
+{
+    // 分配并写满内存，让这些页都真正映射进页表
+    size_t bytes = mb << 20;
+    char *mem = nullptr;
+    if (bytes > 0) {
+        mem = (char*)malloc(bytes);
+        if (!mem) {
+            fprintf(stderr, "malloc %zu MB failed\n", mb);
+            exit(1);
+        }
+        memset(mem, 1, bytes);
+    }
+
+    double forkStart = 0, forkTotal = 0;
+    for (int i = 0; i < count; ++i) {
+        auto begin = chrono::steady_clock::now();
+        int outFd;
+        pid_t pid = forkExec(env, &outFd);
+        forkStart += elapsedUs(begin);
+        drain(outFd);
+        forkTotal += elapsedUs(begin);
+        close(outFd);
+        waitpid(pid, nullptr, 0);
+    }
+
+    double spawnStart = 0, spawnTotal = 0;
+    for (int i = 0; i < count; ++i) {
+        auto begin = chrono::steady_clock::now();
+        CgiProcess cgi;
+        if (!cgi.start(PROGRAM, env, "")) {
+            perror("posix_spawn");
+            exit(1);
+        }
+        spawnStart += elapsedUs(begin);
+        drain(cgi.outputFd());
+        spawnTotal += elapsedUs(begin);
+        cgi.finish();
+        CgiProcess::reapChildren();
+    }
+
+    printf("%8zu %14.1f %14.1f %14.1f %14.1f\n", mb, forkStart / count, forkTotal / count,
+           spawnStart / count, spawnTotal / count);
+    free(mem);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200;
+    vector<size_t> sizes;
+    for (int i = 2; i < argc; ++i) {
+        sizes.push_back(strtoul(argv[i], nullptr, 10));
+    }
+    if (sizes.empty()) {
+        sizes = { 0, 256, 1024 };
+    }
+    // 与服务器一样忽略SIGPIPE，验证子进程中恢复了默认处理
+    signal(SIGPIPE, SIG_IGN);
+
+    vector<string> env = {
+        "REQUEST_METHOD=GET",
+        "QUERY_STRING=a=1&b=2",
+        "CONTENT_LENGTH=0",
+        "HTTP_COOKIE=session=0123456789abcdef",
+        "DOCUMENT_ROOT=/var/www"
+    };
+
+    printf("%s, %d launches per size, time in us\n", PROGRAM, count);
+    printf("%8s %14s %14s %14s %14s\n", "RSS(MB)", "fork start", "fork done", "spawn start", "spawn done");
+    for (size_t mb : sizes) {
+        runOnce(count, mb, env);
+    }
+    return 0;
+}
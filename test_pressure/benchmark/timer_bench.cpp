@@ -0,0 +1,98 @@
+// 比较最小堆和时间轮两种定时器
+// 用法：./timer_bench [定时器数量...]，默认测试1万/10万/100万个定时器
+// 模拟keep-alive连接：每个连接添加一个15s后超时的定时器，每次读写都刷新一次，
+// 最后一部分连接主动关闭（删除），其余的随着时间推进全部到期
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "timer/Timer.h"
+
+using namespace std;
+
+static const int64_t TIMEOUT = 15000; // 毫秒
+static const int64_t STEP = 100; // 到期阶段每次推进的时间，和Reactor的timerfd按最早到期时间唤醒相当
+
+static double elapsedNs(chrono::steady_clock::time_point begin, long ops)
+{
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / ops;
+}
+
+static void runOnce(TimerType type, int n)
+{
+    unique_ptr<TimerQueue> timer = createTimerQueue(type);
+    long fired = 0;
+    timer->setTimeoutCallback([&fired](int) { fired++; });
+
+    mt19937 rng(12345);
+    vector<int> ids(n);
+    for (int i = 0; i < n; ++i) {
+        ids[i] = i;
+    }
+    shuffle(ids.begin(), ids.end(), rng);
+
+    int64_t now = 1000000000;
+    timer->tick(now);
+
+    // 添加
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) {
+        timer->addTimer(ids[i], now + TIMEOUT);
+    }
+    double addNs = elapsedNs(begin, n);
+
+    // 刷新：每个定时器刷新4次，每轮时间推进一秒
+    long refreshes = 4L * n;
+    begin = chrono::steady_clock::now();
+    for (long i = 0; i < refreshes; ++i) {
+        if (i % n == 0) {
+            now += 1000;
+            timer->tick(now);
+        }
+        timer->adjustTimer(ids[i % n], now + TIMEOUT);
+    }
+    double refreshNs = elapsedNs(begin, refreshes);
+
+    // 删除十分之一
+    int cancels = n / 10;
+    begin = chrono::steady_clock::now();
+    for (int i = 0; i < cancels; ++i) {
+        timer->delTimer(ids[i]);
+    }
+    double cancelNs = elapsedNs(begin, cancels);
+
+    // 剩下的全部到期
+    int remain = timer->size();
+    begin = chrono::steady_clock::now();
+    for (int64_t t = 0; t <= TIMEOUT; t += STEP) {
+        now += STEP;
+        timer->tick(now);
+    }
+    double expireNs = elapsedNs(begin, remain > 0 ? remain : 1);
+
+    if (fired != remain || timer->size() != 0) {
+        fprintf(stderr, "%s: expected %d timers fired, got %ld (%zu left)\n", timerTypeName(type), remain, fired, timer->size());
+        exit(1);
+    }
+    printf("%-6s %9d %10.1f %10.1f %10.1f %10.1f\n", timerTypeName(type), n, addNs, refreshNs, cancelNs, expireNs);
+}
+
+int main(int argc, char *argv[])
+{
+    vector<int> sizes;
+    for (int i = 1; i < argc; ++i) {
+        sizes.push_back(atoi(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {10000, 100000, 1000000};
+    }
+
+    printf("%-6s %9s %10s %10s %10s %10s\n", "timer", "timers", "add(ns)", "refresh", "cancel", "expire");
+    for (int n : sizes) {
+        runOnce(TIMER_HEAP, n);
+        runOnce(TIMER_WHEEL, n);
+    }
+    return 0;
+}
@@ -0,0 +1,344 @@
+#!/usr/bin/python3
+# FastCGI工作进程：在常驻的解释器中执行resources/cgi-bin中的CGI脚本，脚本不需要任何修改
+# 服务器按FastCGI的约定把监听socket作为标准输入传进来，每个Reactor连接一次，连接上的请求按请求ID复用（FCGI_MPXS_CONNS）
+# 主线程用selectors读所有连接上的记录，收齐的请求交给线程池并发执行，响应由执行它的线程写回
+# 每个请求的CGI环境变量作为os.environ，请求体作为sys.stdin，捕获sys.stdout作为响应，它们都是执行请求的线程自己的，
+# 脚本按修改时间编译一次后缓存，import的模块也留在进程中，省去每个请求启动解释器和导入模块的时间
+import builtins
+import collections.abc
+import ctypes
+import io
+import os
+import selectors
+import signal
+import socket
+import struct
+import sys
+import threading
+import traceback
+from concurrent.futures import ThreadPoolExecutor
+
+FCGI_VERSION_1 = 1
+FCGI_BEGIN_REQUEST = 1
+FCGI_ABORT_REQUEST = 2
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_STDERR = 7
+FCGI_GET_VALUES = 9
+FCGI_GET_VALUES_RESULT = 10
+FCGI_UNKNOWN_TYPE = 11
+
+FCGI_RESPONDER = 1
+FCGI_KEEP_CONN = 1
+FCGI_REQUEST_COMPLETE = 0
+FCGI_UNKNOWN_ROLE = 3
+
+MAX_CONTENT = 65535
+THREADS = 16  # 同时执行的请求数，更多的请求排队
+
+PR_SET_PDEATHSIG = 1
+
+BASE_ENVIRON = dict(os.environ)
+code_cache = {}  # 脚本路径 -> (修改时间, 编译后的代码)
+local = threading.local()  # 执行请求的线程的环境变量和标准输入输出
+
+
+class LocalStream:
+    """sys.stdin/stdout/stderr：执行请求的线程使用自己的流，其他线程使用原来的"""
+
+    def __init__(self, name, default):
+        self._name = name
+        self._default = default
+
+    def _stream(self):
+        return getattr(local, self._name, self._default)
+
+    def __getattr__(self, attr):
+        return getattr(self._stream(), attr)
+
+    def __iter__(self):
+        return iter(self._stream())
+
+
+class LocalEnviron(collections.abc.MutableMapping):
+    """os.environ：执行请求的线程看到请求的CGI环境变量，os.getenv也通过它读取"""
+
+    def __init__(self, default):
+        self._default = default
+
+    def _environ(self):
+        return getattr(local, 'environ', self._default)
+
+    def __getitem__(self, name):
+        return self._environ()[name]
+
+    def __setitem__(self, name, value):
+        self._environ()[name] = value
+
+    def __delitem__(self, name):
+        del self._environ()[name]
+
+    def __iter__(self):
+        return iter(self._environ())
+
+    def __len__(self):
+        return len(self._environ())
+
+    def copy(self):
+        return dict(self._environ())
+
+
+class Request:
+    def __init__(self, keep_conn):
+        self.keep_conn = keep_conn
+        self.params = bytearray()
+        self.stdin = bytearray()
+        self.params_done = False
+
+
+class Connection:
+    """一个服务器连接：主线程读记录，执行请求的线程写响应，写操作用锁串行化"""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.buffer = bytearray()
+        self.requests = {}  # 请求ID -> 还在接收的请求
+        self.lock = threading.Lock()
+        self.closed = False
+
+    def send(self, data):
+        with self.lock:
+            if self.closed:
+                return
+            try:
+                self.sock.sendall(data)
+            except OSError:
+                pass
+
+    def shutdown(self):
+        # 由主线程读到连接结束后关闭
+        with self.lock:
+            try:
+                self.sock.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+
+    def close(self):
+        with self.lock:
+            self.closed = True
+            self.sock.close()
+
+
+def record(rtype, request_id, content=b''):
+    out = bytearray()
+    view = memoryview(content)
+    while True:
+        chunk = view[:MAX_CONTENT]
+        view = view[MAX_CONTENT:]
+        padding = -len(chunk) % 8
+        out += struct.pack('>BBHHBx', FCGI_VERSION_1, rtype, request_id, len(chunk), padding)
+        out += chunk
+        out += b'\0' * padding
+        if not view:
+            return bytes(out)
+
+
+def end_request(request_id, app_status, protocol_status=FCGI_REQUEST_COMPLETE):
+    return record(FCGI_END_REQUEST, request_id, struct.pack('>IB3x', app_status & 0xffffffff, protocol_status))
+
+
+def parse_pairs(data):
+    pairs = {}
+    pos = 0
+    while pos < len(data):
+        lengths = []
+        for _ in range(2):
+            if data[pos] & 0x80:
+                lengths.append(struct.unpack('>I', data[pos:pos + 4])[0] & 0x7fffffff)
+                pos += 4
+            else:
+                lengths.append(data[pos])
+                pos += 1
+        name = bytes(data[pos:pos + lengths[0]]).decode('latin-1')
+        pos += lengths[0]
+        value = bytes(data[pos:pos + lengths[1]]).decode('latin-1')
+        pos += lengths[1]
+        pairs[name] = value
+    return pairs
+
+
+def load_script(path):
+    mtime = os.stat(path).st_mtime_ns
+    cached = code_cache.get(path)
+    if cached and cached[0] == mtime:
+        return cached[1]
+    with open(path, 'rb') as f:
+        code = compile(f.read(), path, 'exec')
+    code_cache[path] = (mtime, code)
+    return code
+
+
+def run_script(params, stdin):
+    """按CGI的方式执行脚本，返回(退出码, 标准输出, 标准错误)"""
+    path = params.get('SCRIPT_FILENAME', '')
+    environ = dict(BASE_ENVIRON)
+    environ.update(params)
+    local.environ = environ
+    local.stdin = io.TextIOWrapper(io.BytesIO(stdin), encoding='utf-8')
+    local.stdout = io.TextIOWrapper(io.BytesIO(), encoding='utf-8')
+    local.stderr = io.TextIOWrapper(io.BytesIO(), encoding='utf-8')
+    status = 0
+    try:
+        exec(load_script(path), {'__name__': '__main__', '__file__': path, '__builtins__': builtins})
+    except SystemExit as e:
+        if isinstance(e.code, int):
+            status = e.code
+        elif e.code is not None:
+            print(e.code, file=sys.stderr)
+            status = 1
+    except BaseException:
+        traceback.print_exc()
+        status = 1
+    try:
+        local.stdout.flush()
+        local.stderr.flush()
+        out, err = local.stdout.buffer.getvalue(), local.stderr.buffer.getvalue()
+    except ValueError:
+        # 脚本关闭了标准输出
+        out, err = b'', b''
+    del local.environ, local.stdin, local.stdout, local.stderr
+    return status, out, err
+
+
+def respond(conn, request_id, req):
+    status, out, err = run_script(parse_pairs(req.params), bytes(req.stdin))
+    response = bytearray()
+    if out:
+        response += record(FCGI_STDOUT, request_id, out)
+    response += record(FCGI_STDOUT, request_id)
+    if err:
+        response += record(FCGI_STDERR, request_id, err)
+    response += end_request(request_id, status)
+    conn.send(response)
+    if not req.keep_conn:
+        conn.shutdown()
+
+
+def get_values(data):
+    values = {'FCGI_MAX_CONNS': '1024', 'FCGI_MAX_REQS': str(THREADS), 'FCGI_MPXS_CONNS': '1'}
+    out = bytearray()
+    for name in parse_pairs(data):
+        if name in values:
+            value = values[name].encode()
+            out += bytes([len(name), len(value)]) + name.encode() + value
+    return bytes(out)
+
+
+def handle_records(conn, pool):
+    """处理连接上已经收到的完整记录，连接出错时返回False"""
+    buffer = conn.buffer
+    pos = 0
+    while len(buffer) - pos >= 8:
+        version, rtype, request_id, length, padding = struct.unpack_from('>BBHHBx', buffer, pos)
+        if version != FCGI_VERSION_1:
+            return False
+        if len(buffer) - pos < 8 + length + padding:
+            break
+        content = bytes(buffer[pos + 8:pos + 8 + length])
+        pos += 8 + length + padding
+
+        if request_id == 0:
+            # 管理记录
+            if rtype == FCGI_GET_VALUES:
+                conn.send(record(FCGI_GET_VALUES_RESULT, 0, get_values(content)))
+            else:
+                conn.send(record(FCGI_UNKNOWN_TYPE, 0, bytes([rtype]) + b'\0' * 7))
+            continue
+
+        if rtype == FCGI_BEGIN_REQUEST:
+            role, flags = struct.unpack('>HB5x', content)
+            if role != FCGI_RESPONDER:
+                conn.send(end_request(request_id, 0, FCGI_UNKNOWN_ROLE))
+                continue
+            conn.requests[request_id] = Request(flags & FCGI_KEEP_CONN)
+            continue
+
+        req = conn.requests.get(request_id)
+        if req is None:
+            # 已经开始执行的请求不能中止，结束后服务器丢弃它的输出
+            continue
+        if rtype == FCGI_ABORT_REQUEST:
+            del conn.requests[request_id]
+            conn.send(end_request(request_id, 0))
+        elif rtype == FCGI_PARAMS:
+            if content:
+                req.params += content
+            else:
+                req.params_done = True
+        elif rtype == FCGI_STDIN:
+            if content:
+                req.stdin += content
+            elif req.params_done:
+                # 请求体接收完毕，交给线程池执行脚本
+                del conn.requests[request_id]
+                pool.submit(respond, conn, request_id, req)
+    del buffer[:pos]
+    return True
+
+
+def exit_with_server():
+    """服务器用posix_spawn启动本进程，不能替它设置PR_SET_PDEATHSIG，服务器异常退出时本进程也要随之退出"""
+    try:
+        ctypes.CDLL(None, use_errno=True).prctl(PR_SET_PDEATHSIG, signal.SIGTERM)
+    except (OSError, AttributeError):
+        pass
+
+
+def main():
+    exit_with_server()
+    server = os.getppid()
+    sys.stdin = LocalStream('stdin', sys.stdin)
+    sys.stdout = LocalStream('stdout', sys.stdout)
+    sys.stderr = LocalStream('stderr', sys.stderr)
+    os.environ = LocalEnviron(os.environ)
+
+    pool = ThreadPoolExecutor(max_workers=THREADS)
+    listener = socket.socket(fileno=0)
+    listener.setblocking(False)
+    selector = selectors.DefaultSelector()
+    selector.register(listener, selectors.EVENT_READ)
+    while True:
+        for key, _ in selector.select():
+            if key.fileobj is listener:
+                try:
+                    sock, _ = listener.accept()
+                except OSError:
+                    continue
+                # 监听socket没有文件系统权限的保护，只接受启动本进程的服务器的连接
+                creds = sock.getsockopt(socket.SOL_SOCKET, socket.SO_PEERCRED, struct.calcsize('3i'))
+                if struct.unpack('3i', creds)[0] != server:
+                    sock.close()
+                    continue
+                sock.setblocking(True)
+                conn = Connection(sock)
+                selector.register(sock, selectors.EVENT_READ, conn)
+                continue
+
+            conn = key.data
+            try:
+                data = conn.sock.recv(65536)
+            except OSError:
+                data = b''
+            if data:
+                conn.buffer += data
+                if handle_records(conn, pool):
+                    continue
+            # 连接关闭或者出错，还在执行的请求的响应被丢弃
+            selector.unregister(conn.sock)
+            conn.close()
+
+
+if __name__ == '__main__':
+    main()